@@ -0,0 +1,208 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <util/shader_util.hpp>
+
+const uint32_t ASSET_ARCHIVE_MAGIC = 0x4b415049; // "IPAK"
+const uint32_t ASSET_ARCHIVE_VERSION = 1;
+// Blobs start on page boundaries and the file is padded to one, so every
+// blob is a page aligned range of the mapping that can be handed to the
+// device as host memory.
+const uint64_t ASSET_ARCHIVE_ALIGNMENT = 4096;
+const uint32_t ASSET_NAME_SIZE = 40;
+
+enum AssetType : uint32_t {
+  ASSET_VERTICES,
+  // format is the VkIndexType, width the index count.
+  ASSET_INDICES,
+  ASSET_SPIRV,
+  // format is the VkFormat, width and height the size of mip 0.
+  ASSET_TEXTURE,
+};
+
+struct AssetArchiveHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t entry_count;
+  uint32_t padding;
+};
+
+// Offset table entry, the table follows the header.
+struct AssetEntry {
+  char name[ASSET_NAME_SIZE];
+  uint32_t type;
+  uint32_t format;
+  uint32_t width;
+  uint32_t height;
+  // From the start of the file.
+  uint64_t offset;
+  uint64_t size;
+};
+
+// A blob inside the mapping, valid until the archive is closed.
+struct AssetBlob {
+  const AssetEntry *entry;
+  const void *data;
+  uint64_t size;
+};
+
+// Read only view of an asset archive. The file is mapped as a whole and
+// blobs point straight into the mapped pages, nothing is read into heap
+// buffers: the page cache is the only copy on the host until a blob is
+// copied into a staging buffer or imported by the device.
+class AssetArchive {
+public:
+  void open(const std::string &filename) {
+    int fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd < 0) {
+      throw std::runtime_error("failed to open asset archive " + filename);
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 ||
+        (size_t)st.st_size < sizeof(AssetArchiveHeader)) {
+      ::close(fd);
+      throw std::runtime_error("invalid asset archive " + filename);
+    }
+    mapping_size = (size_t)st.st_size;
+    void *data = mmap(nullptr, mapping_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    // The mapping keeps the file alive.
+    ::close(fd);
+    if (data == MAP_FAILED) {
+      throw std::runtime_error("failed to map asset archive " + filename);
+    }
+    mapping = (const char *)data;
+    // Everything is touched once on load, read ahead instead of faulting
+    // page by page.
+    madvise(data, mapping_size, MADV_WILLNEED);
+    const AssetArchiveHeader *header = (const AssetArchiveHeader *)mapping;
+    uint64_t table_end = sizeof(AssetArchiveHeader) +
+                         (uint64_t)header->entry_count * sizeof(AssetEntry);
+    if (header->magic != ASSET_ARCHIVE_MAGIC ||
+        header->version != ASSET_ARCHIVE_VERSION || table_end > mapping_size) {
+      close();
+      throw std::runtime_error("invalid asset archive " + filename);
+    }
+    entries = (const AssetEntry *)(mapping + sizeof(AssetArchiveHeader));
+    entry_count = header->entry_count;
+    for (uint32_t i = 0; i < entry_count; i++) {
+      if (entries[i].offset > mapping_size ||
+          entries[i].size > mapping_size - entries[i].offset) {
+        close();
+        throw std::runtime_error("invalid asset archive " + filename);
+      }
+    }
+  }
+
+  bool contains(const std::string &name) const {
+    return find_entry(name) != nullptr;
+  }
+
+  AssetBlob find(const std::string &name) const {
+    const AssetEntry *entry = find_entry(name);
+    if (!entry) {
+      throw std::runtime_error("missing asset " + name);
+    }
+    return {entry, mapping + entry->offset, entry->size};
+  }
+
+  // Type checked find().
+  AssetBlob find(const std::string &name, AssetType type) const {
+    AssetBlob blob = find(name);
+    if (blob.entry->type != type) {
+      throw std::runtime_error("asset " + name + " has the wrong type");
+    }
+    return blob;
+  }
+
+  const void *data() const { return mapping; }
+
+  size_t size() const { return mapping_size; }
+
+  void close() {
+    if (mapping) {
+      munmap((void *)mapping, mapping_size);
+    }
+    mapping = nullptr;
+    mapping_size = 0;
+    entries = nullptr;
+    entry_count = 0;
+  }
+
+private:
+  // A handful of entries, a linear scan is cheaper than building an index.
+  const AssetEntry *find_entry(const std::string &name) const {
+    for (uint32_t i = 0; i < entry_count; i++) {
+      if (strncmp(entries[i].name, name.c_str(), ASSET_NAME_SIZE) == 0) {
+        return &entries[i];
+      }
+    }
+    return nullptr;
+  }
+
+  const char *mapping = nullptr;
+  size_t mapping_size = 0;
+  const AssetEntry *entries = nullptr;
+  uint32_t entry_count = 0;
+};
+
+// Builds an archive in memory, for the offline packing step.
+class AssetArchiveWriter {
+public:
+  void add(const std::string &name, AssetType type, const void *data,
+           uint64_t size, uint32_t format = 0, uint32_t width = 0,
+           uint32_t height = 0) {
+    if (name.size() >= ASSET_NAME_SIZE) {
+      throw std::runtime_error("asset name too long: " + name);
+    }
+    AssetEntry entry{};
+    strncpy(entry.name, name.c_str(), ASSET_NAME_SIZE - 1);
+    entry.type = type;
+    entry.format = format;
+    entry.width = width;
+    entry.height = height;
+    entry.size = size;
+    entries.push_back(entry);
+    blobs.emplace_back((const char *)data, (const char *)data + size);
+  }
+
+  void write(const std::string &filename) {
+    uint64_t offset = align(sizeof(AssetArchiveHeader) +
+                            entries.size() * sizeof(AssetEntry));
+    for (auto &entry : entries) {
+      entry.offset = offset;
+      offset = align(offset + entry.size);
+    }
+    std::vector<char> file(offset, 0);
+    AssetArchiveHeader header{};
+    header.magic = ASSET_ARCHIVE_MAGIC;
+    header.version = ASSET_ARCHIVE_VERSION;
+    header.entry_count = static_cast<uint32_t>(entries.size());
+    memcpy(file.data(), &header, sizeof(header));
+    memcpy(file.data() + sizeof(header), entries.data(),
+           entries.size() * sizeof(AssetEntry));
+    for (size_t i = 0; i < entries.size(); i++) {
+      memcpy(file.data() + entries[i].offset, blobs[i].data(),
+             blobs[i].size());
+    }
+    write_file(filename, file.data(), file.size());
+  }
+
+private:
+  static uint64_t align(uint64_t offset) {
+    return (offset + ASSET_ARCHIVE_ALIGNMENT - 1) &
+           ~(ASSET_ARCHIVE_ALIGNMENT - 1);
+  }
+
+  std::vector<AssetEntry> entries;
+  std::vector<std::vector<char>> blobs;
+};
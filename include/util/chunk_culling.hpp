@@ -0,0 +1,190 @@
+#pragma once
+
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// Instruction set cull_chunk_batch() was built for.
+#if defined(__AVX__)
+const char *const CHUNK_CULL_ISA = "avx";
+#elif defined(__SSE2__)
+const char *const CHUNK_CULL_ISA = "sse2";
+#else
+const char *const CHUNK_CULL_ISA = "scalar";
+#endif
+
+// Edge length of a chunk in tiles. Every chunk owns CHUNK_TILES consecutive
+// slots of the tile buffer, unused ones hold empty tiles.
+const uint32_t CHUNK_SIZE = 16;
+const uint32_t CHUNK_TILES = CHUNK_SIZE * CHUNK_SIZE;
+// Chunks tested per kernel step, the bounds are padded to a multiple of it.
+const uint32_t CHUNK_CULL_BATCH = 8;
+
+// Visible rectangle in isometric space, iso = (x - y, x + y) of a world
+// position.
+struct IsoViewRect {
+  float min_x;
+  float min_y;
+  float max_x;
+  float max_y;
+};
+
+// World space bounds of every chunk with one array per component, so the
+// kernel loads the same component of a whole batch of chunks at once.
+struct ChunkBounds {
+  std::vector<float> min_x;
+  std::vector<float> min_y;
+  std::vector<float> max_x;
+  std::vector<float> max_y;
+  uint32_t count = 0;
+
+  void resize(uint32_t count) {
+    this->count = count;
+    uint32_t padded =
+        (count + CHUNK_CULL_BATCH - 1) / CHUNK_CULL_BATCH * CHUNK_CULL_BATCH;
+    // Padding boxes are inverted and never pass the test.
+    float inf = std::numeric_limits<float>::infinity();
+    min_x.assign(padded, inf);
+    min_y.assign(padded, inf);
+    max_x.assign(padded, -inf);
+    max_y.assign(padded, -inf);
+  }
+
+  void set(uint32_t chunk, float min_x, float min_y, float max_x,
+           float max_y) {
+    this->min_x[chunk] = min_x;
+    this->min_y[chunk] = min_y;
+    this->max_x[chunk] = max_x;
+    this->max_y[chunk] = max_y;
+  }
+};
+
+// Both shapes are convex, so they overlap unless one of their four edge
+// directions separates them: the iso axes of the view and the world axes of
+// the chunk. The view is taken to world space as its bounding box there,
+// which is exact since the view rectangle is a diamond in world space whose
+// corners lie on that box.
+struct ChunkCullPlanes {
+  float iso_min_x, iso_min_y, iso_max_x, iso_max_y;
+  float world_min_x, world_min_y, world_max_x, world_max_y;
+
+  explicit ChunkCullPlanes(const IsoViewRect &view)
+      : iso_min_x(view.min_x), iso_min_y(view.min_y), iso_max_x(view.max_x),
+        iso_max_y(view.max_y),
+        world_min_x((view.min_x + view.min_y) * 0.5f),
+        world_min_y((view.min_y - view.max_x) * 0.5f),
+        world_max_x((view.max_x + view.max_y) * 0.5f),
+        world_max_y((view.max_y - view.min_x) * 0.5f) {}
+};
+
+static bool chunk_visible(const ChunkCullPlanes &p, float min_x, float min_y,
+                          float max_x, float max_y) {
+  return min_x - max_y <= p.iso_max_x && max_x - min_y >= p.iso_min_x &&
+         min_x + min_y <= p.iso_max_y && max_x + max_y >= p.iso_min_y &&
+         min_x <= p.world_max_x && max_x >= p.world_min_x &&
+         min_y <= p.world_max_y && max_y >= p.world_min_y;
+}
+
+// Bit i set if chunk first + i is visible.
+static uint32_t cull_chunk_batch_scalar(const ChunkBounds &bounds,
+                                        const ChunkCullPlanes &p,
+                                        uint32_t first) {
+  uint32_t mask = 0;
+  for (uint32_t i = 0; i < CHUNK_CULL_BATCH; i++) {
+    uint32_t c = first + i;
+    if (chunk_visible(p, bounds.min_x[c], bounds.min_y[c], bounds.max_x[c],
+                      bounds.max_y[c])) {
+      mask |= 1u << i;
+    }
+  }
+  return mask;
+}
+
+// Same as cull_chunk_batch_scalar(), a whole batch per instruction.
+static uint32_t cull_chunk_batch(const ChunkBounds &bounds,
+                                 const ChunkCullPlanes &p, uint32_t first) {
+#if defined(__AVX__)
+  __m256 min_x = _mm256_loadu_ps(&bounds.min_x[first]);
+  __m256 min_y = _mm256_loadu_ps(&bounds.min_y[first]);
+  __m256 max_x = _mm256_loadu_ps(&bounds.max_x[first]);
+  __m256 max_y = _mm256_loadu_ps(&bounds.max_y[first]);
+  __m256 visible = _mm256_and_ps(
+      _mm256_cmp_ps(_mm256_sub_ps(min_x, max_y),
+                    _mm256_set1_ps(p.iso_max_x), _CMP_LE_OQ),
+      _mm256_cmp_ps(_mm256_sub_ps(max_x, min_y),
+                    _mm256_set1_ps(p.iso_min_x), _CMP_GE_OQ));
+  visible = _mm256_and_ps(
+      visible, _mm256_cmp_ps(_mm256_add_ps(min_x, min_y),
+                             _mm256_set1_ps(p.iso_max_y), _CMP_LE_OQ));
+  visible = _mm256_and_ps(
+      visible, _mm256_cmp_ps(_mm256_add_ps(max_x, max_y),
+                             _mm256_set1_ps(p.iso_min_y), _CMP_GE_OQ));
+  visible = _mm256_and_ps(
+      visible,
+      _mm256_cmp_ps(min_x, _mm256_set1_ps(p.world_max_x), _CMP_LE_OQ));
+  visible = _mm256_and_ps(
+      visible,
+      _mm256_cmp_ps(max_x, _mm256_set1_ps(p.world_min_x), _CMP_GE_OQ));
+  visible = _mm256_and_ps(
+      visible,
+      _mm256_cmp_ps(min_y, _mm256_set1_ps(p.world_max_y), _CMP_LE_OQ));
+  visible = _mm256_and_ps(
+      visible,
+      _mm256_cmp_ps(max_y, _mm256_set1_ps(p.world_min_y), _CMP_GE_OQ));
+  return (uint32_t)_mm256_movemask_ps(visible);
+#elif defined(__SSE2__)
+  uint32_t mask = 0;
+  for (uint32_t half = 0; half < CHUNK_CULL_BATCH; half += 4) {
+    __m128 min_x = _mm_loadu_ps(&bounds.min_x[first + half]);
+    __m128 min_y = _mm_loadu_ps(&bounds.min_y[first + half]);
+    __m128 max_x = _mm_loadu_ps(&bounds.max_x[first + half]);
+    __m128 max_y = _mm_loadu_ps(&bounds.max_y[first + half]);
+    __m128 visible = _mm_and_ps(
+        _mm_cmple_ps(_mm_sub_ps(min_x, max_y), _mm_set1_ps(p.iso_max_x)),
+        _mm_cmpge_ps(_mm_sub_ps(max_x, min_y), _mm_set1_ps(p.iso_min_x)));
+    visible = _mm_and_ps(visible, _mm_cmple_ps(_mm_add_ps(min_x, min_y),
+                                               _mm_set1_ps(p.iso_max_y)));
+    visible = _mm_and_ps(visible, _mm_cmpge_ps(_mm_add_ps(max_x, max_y),
+                                               _mm_set1_ps(p.iso_min_y)));
+    visible =
+        _mm_and_ps(visible, _mm_cmple_ps(min_x, _mm_set1_ps(p.world_max_x)));
+    visible =
+        _mm_and_ps(visible, _mm_cmpge_ps(max_x, _mm_set1_ps(p.world_min_x)));
+    visible =
+        _mm_and_ps(visible, _mm_cmple_ps(min_y, _mm_set1_ps(p.world_max_y)));
+    visible =
+        _mm_and_ps(visible, _mm_cmpge_ps(max_y, _mm_set1_ps(p.world_min_y)));
+    mask |= (uint32_t)_mm_movemask_ps(visible) << half;
+  }
+  return mask;
+#else
+  return cull_chunk_batch_scalar(bounds, p, first);
+#endif
+}
+
+typedef uint32_t (*ChunkCullKernel)(const ChunkBounds &bounds,
+                                    const ChunkCullPlanes &p, uint32_t first);
+
+// Replaces visible with the indices of every chunk overlapping the view, in
+// ascending order. Uses AVX when built with it, SSE2 otherwise and plain
+// scalar code on other architectures. The kernel is a template argument so
+// benchmarks can pick the scalar one without an indirect call per batch.
+template <ChunkCullKernel kernel = cull_chunk_batch>
+static void cull_chunks(const ChunkBounds &bounds, const IsoViewRect &view,
+                        std::vector<uint32_t> &visible) {
+  ChunkCullPlanes planes(view);
+  visible.clear();
+  for (uint32_t first = 0; first < bounds.count; first += CHUNK_CULL_BATCH) {
+    uint32_t mask = kernel(bounds, planes, first);
+    while (mask) {
+      visible.push_back(first + __builtin_ctz(mask));
+      mask &= mask - 1;
+    }
+  }
+}
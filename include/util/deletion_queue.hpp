@@ -0,0 +1,63 @@
+#pragma once
+
+#include <array>
+#include <deque>
+#include <functional>
+
+#include <util/timeline_scheduler.hpp>
+
+struct DeferredDeletion {
+  // Last submission of every queue when the object was retired.
+  std::array<TimelinePoint, TIMELINE_QUEUE_COUNT> points;
+  std::function<void()> destroy;
+};
+
+// Destroys objects once the GPU is done with them, instead of idling the
+// device. An object is retired after its last use was submitted and is
+// destroyed once every queue got past its submissions at that time, so
+// work recorded later never holds it up. Retired in order, completed in
+// order. Render thread only.
+class DeletionQueue {
+public:
+  void init(TimelineScheduler &timeline) { this->timeline = &timeline; }
+
+  void retire(std::function<void()> destroy) {
+    DeferredDeletion deletion;
+    for (uint32_t queue = 0; queue < TIMELINE_QUEUE_COUNT; queue++) {
+      deletion.points[queue] = timeline->last_point((TimelineQueue)queue);
+    }
+    deletion.destroy = std::move(destroy);
+    deletions.push_back(std::move(deletion));
+  }
+
+  // Destroys everything whose submissions completed.
+  void collect() {
+    while (!deletions.empty() && is_complete(deletions.front())) {
+      deletions.front().destroy();
+      deletions.pop_front();
+    }
+  }
+
+  // Destroys everything, the caller waited for the device.
+  void flush() {
+    for (auto &deletion : deletions) {
+      deletion.destroy();
+    }
+    deletions.clear();
+  }
+
+  size_t size() const { return deletions.size(); }
+
+private:
+  bool is_complete(const DeferredDeletion &deletion) {
+    for (const auto &point : deletion.points) {
+      if (!timeline->is_complete(point)) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  TimelineScheduler *timeline = nullptr;
+  std::deque<DeferredDeletion> deletions;
+};
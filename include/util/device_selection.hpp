@@ -0,0 +1,193 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <vulkan/vulkan_core.h>
+
+typedef std::array<uint8_t, VK_UUID_SIZE> DeviceUuid;
+
+// The device type outweighs every other term, the next largest is the
+// device local memory in MiB, so a bigger discrete GPU wins over a smaller
+// one and any discrete GPU over an integrated one. Dedicated queues and
+// optional extensions are worth as much as a GiB of memory each, enough to
+// break ties between otherwise equal devices.
+const int64_t DEVICE_SCORE_TYPE_WEIGHT = 1ll << 32;
+const int64_t DEVICE_SCORE_FEATURE_BONUS = 1024;
+
+struct DeviceCandidate {
+  VkPhysicalDevice device = VK_NULL_HANDLE;
+  VkPhysicalDeviceProperties properties{};
+  DeviceUuid uuid{};
+  VkDeviceSize device_local_bytes = 0;
+  // A family with transfer but neither graphics nor compute, a copy engine.
+  bool dedicated_transfer = false;
+  // A family with compute but no graphics, for async compute.
+  bool dedicated_compute = false;
+  uint32_t optional_extension_count = 0;
+  int64_t score = 0;
+};
+
+static int64_t device_type_rank(VkPhysicalDeviceType type) {
+  switch (type) {
+  case VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU:
+    return 4;
+  case VK_PHYSICAL_DEVICE_TYPE_INTEGRATED_GPU:
+    return 3;
+  case VK_PHYSICAL_DEVICE_TYPE_VIRTUAL_GPU:
+    return 2;
+  case VK_PHYSICAL_DEVICE_TYPE_CPU:
+    return 1;
+  default:
+    return 0;
+  }
+}
+
+// Gathers what the score is based on. The device has to be suitable
+// already, required extensions and features are not checked again.
+static DeviceCandidate
+score_device(VkPhysicalDevice device,
+             const std::vector<const char *> &optional_extensions) {
+  DeviceCandidate candidate;
+  candidate.device = device;
+  VkPhysicalDeviceIDProperties id_properties{};
+  id_properties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ID_PROPERTIES;
+  VkPhysicalDeviceProperties2 properties{};
+  properties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+  properties.pNext = &id_properties;
+  vkGetPhysicalDeviceProperties2(device, &properties);
+  candidate.properties = properties.properties;
+  memcpy(candidate.uuid.data(), id_properties.deviceUUID, VK_UUID_SIZE);
+  VkPhysicalDeviceMemoryProperties memory;
+  vkGetPhysicalDeviceMemoryProperties(device, &memory);
+  for (uint32_t i = 0; i < memory.memoryHeapCount; i++) {
+    if (memory.memoryHeaps[i].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT) {
+      candidate.device_local_bytes += memory.memoryHeaps[i].size;
+    }
+  }
+  uint32_t count = 0;
+  vkGetPhysicalDeviceQueueFamilyProperties(device, &count, nullptr);
+  std::vector<VkQueueFamilyProperties> families(count);
+  vkGetPhysicalDeviceQueueFamilyProperties(device, &count, families.data());
+  for (const auto &family : families) {
+    if ((family.queueFlags & VK_QUEUE_TRANSFER_BIT) &&
+        !(family.queueFlags & (VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT))) {
+      candidate.dedicated_transfer = true;
+    }
+    if ((family.queueFlags & VK_QUEUE_COMPUTE_BIT) &&
+        !(family.queueFlags & VK_QUEUE_GRAPHICS_BIT)) {
+      candidate.dedicated_compute = true;
+    }
+  }
+  vkEnumerateDeviceExtensionProperties(device, nullptr, &count, nullptr);
+  std::vector<VkExtensionProperties> extensions(count);
+  vkEnumerateDeviceExtensionProperties(device, nullptr, &count,
+                                       extensions.data());
+  for (const char *name : optional_extensions) {
+    for (const auto &extension : extensions) {
+      if (strcmp(extension.extensionName, name) == 0) {
+        candidate.optional_extension_count++;
+        break;
+      }
+    }
+  }
+  candidate.score =
+      device_type_rank(candidate.properties.deviceType) *
+          DEVICE_SCORE_TYPE_WEIGHT +
+      (int64_t)(candidate.device_local_bytes >> 20) +
+      (candidate.dedicated_transfer + candidate.dedicated_compute +
+       (int64_t)candidate.optional_extension_count) *
+          DEVICE_SCORE_FEATURE_BONUS;
+  return candidate;
+}
+
+// Lower case hex in the usual 8-4-4-4-12 grouping.
+static std::string format_device_uuid(const DeviceUuid &uuid) {
+  std::string text;
+  char digits[3];
+  for (uint32_t i = 0; i < VK_UUID_SIZE; i++) {
+    if (i == 4 || i == 6 || i == 8 || i == 10) {
+      text += '-';
+    }
+    snprintf(digits, sizeof(digits), "%02x", uuid[i]);
+    text += digits;
+  }
+  return text;
+}
+
+// Accepts 32 hex digits in either case, dashes anywhere are ignored.
+static DeviceUuid parse_device_uuid(const std::string &text) {
+  DeviceUuid uuid{};
+  uint32_t digit_count = 0;
+  for (char c : text) {
+    if (c == '-') {
+      continue;
+    }
+    uint32_t value;
+    if (c >= '0' && c <= '9') {
+      value = c - '0';
+    } else if (c >= 'a' && c <= 'f') {
+      value = c - 'a' + 10;
+    } else if (c >= 'A' && c <= 'F') {
+      value = c - 'A' + 10;
+    } else {
+      throw std::runtime_error("invalid device uuid " + text);
+    }
+    if (digit_count == 2 * VK_UUID_SIZE) {
+      throw std::runtime_error("invalid device uuid " + text);
+    }
+    uuid[digit_count / 2] |= value << (digit_count % 2 == 0 ? 4 : 0);
+    digit_count++;
+  }
+  if (digit_count != 2 * VK_UUID_SIZE) {
+    throw std::runtime_error("invalid device uuid " + text);
+  }
+  return uuid;
+}
+
+// The candidate with the given uuid if pinned is set, otherwise the one
+// with the highest score, the first of equals in enumeration order.
+static const DeviceCandidate &
+select_device(const std::vector<DeviceCandidate> &candidates,
+              const DeviceUuid *pinned) {
+  if (candidates.empty()) {
+    throw std::runtime_error("failed to find a suitable GPU");
+  }
+  if (pinned) {
+    for (const auto &candidate : candidates) {
+      if (candidate.uuid == *pinned) {
+        return candidate;
+      }
+    }
+    throw std::runtime_error("no suitable GPU with uuid " +
+                             format_device_uuid(*pinned));
+  }
+  const DeviceCandidate *best = &candidates[0];
+  for (const auto &candidate : candidates) {
+    if (candidate.score > best->score) {
+      best = &candidate;
+    }
+  }
+  return *best;
+}
+
+static void print_device_candidates(
+    std::ostream &out, const std::vector<DeviceCandidate> &candidates,
+    const DeviceCandidate &selected) {
+  for (const auto &candidate : candidates) {
+    out << (&candidate == &selected ? "* " : "  ")
+        << format_device_uuid(candidate.uuid) << " "
+        << candidate.properties.deviceName << ": score " << candidate.score
+        << ", " << (candidate.device_local_bytes >> 20) << " MiB"
+        << (candidate.dedicated_transfer ? ", transfer queue" : "")
+        << (candidate.dedicated_compute ? ", compute queue" : "") << ", "
+        << candidate.optional_extension_count << " optional extensions"
+        << std::endl;
+  }
+}
@@ -0,0 +1,104 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+// Draws are ordered by one 64 bit key each, sorted as plain integers. The
+// payload in the low bits says what to draw, usually an index into the
+// caller's own draw list. Opaque keys, most significant first:
+//
+//   layer:1 | pipeline:7 | material:8 | depth:24 | payload:24
+//
+// so opaque draws batch by state and run front to back inside a batch, which
+// lets the depth test reject hidden fragments before they are shaded.
+// Translucent keys sort after every opaque one and put the inverted depth
+// first, blending needs back to front more than it needs batching:
+//
+//   layer:1 | far depth:24 | pipeline:7 | material:8 | payload:24
+enum DrawLayer : uint32_t {
+  DRAW_LAYER_OPAQUE,
+  DRAW_LAYER_TRANSLUCENT,
+};
+
+const uint32_t DRAW_KEY_PIPELINE_BITS = 7;
+const uint32_t DRAW_KEY_MATERIAL_BITS = 8;
+const uint32_t DRAW_KEY_DEPTH_BITS = 24;
+const uint32_t DRAW_KEY_PAYLOAD_BITS = 24;
+const uint32_t DRAW_KEY_DEPTH_MAX = (1u << DRAW_KEY_DEPTH_BITS) - 1;
+const uint32_t DRAW_KEY_PAYLOAD_MAX = (1u << DRAW_KEY_PAYLOAD_BITS) - 1;
+
+// Depth in [0, 1] with 0 nearest, clamped.
+static uint32_t quantize_draw_depth(float depth) {
+  return (uint32_t)(std::clamp(depth, 0.0f, 1.0f) * DRAW_KEY_DEPTH_MAX);
+}
+
+static uint64_t opaque_draw_key(uint32_t pipeline, uint32_t material,
+                                float depth, uint32_t payload) {
+  uint64_t key = DRAW_LAYER_OPAQUE;
+  key = key << DRAW_KEY_PIPELINE_BITS |
+        (pipeline & ((1u << DRAW_KEY_PIPELINE_BITS) - 1));
+  key = key << DRAW_KEY_MATERIAL_BITS |
+        (material & ((1u << DRAW_KEY_MATERIAL_BITS) - 1));
+  key = key << DRAW_KEY_DEPTH_BITS | quantize_draw_depth(depth);
+  return key << DRAW_KEY_PAYLOAD_BITS | (payload & DRAW_KEY_PAYLOAD_MAX);
+}
+
+static uint64_t translucent_draw_key(uint32_t pipeline, uint32_t material,
+                                     float depth, uint32_t payload) {
+  uint64_t key = DRAW_LAYER_TRANSLUCENT;
+  key = key << DRAW_KEY_DEPTH_BITS |
+        (DRAW_KEY_DEPTH_MAX - quantize_draw_depth(depth));
+  key = key << DRAW_KEY_PIPELINE_BITS |
+        (pipeline & ((1u << DRAW_KEY_PIPELINE_BITS) - 1));
+  key = key << DRAW_KEY_MATERIAL_BITS |
+        (material & ((1u << DRAW_KEY_MATERIAL_BITS) - 1));
+  return key << DRAW_KEY_PAYLOAD_BITS | (payload & DRAW_KEY_PAYLOAD_MAX);
+}
+
+static uint32_t draw_key_payload(uint64_t key) {
+  return (uint32_t)(key & DRAW_KEY_PAYLOAD_MAX);
+}
+
+// Least significant digit first radix sort, one byte per pass. All eight
+// histograms are built in a single read of the keys, and a pass whose byte
+// is the same in every key is skipped, which drops the passes over fields
+// a frame never varies, like the pipeline of a single pipeline scene.
+// scratch is resized as needed, kept by the caller or taken from a frame
+// arena to avoid allocating per frame.
+template <typename Allocator>
+static void radix_sort_draw_keys(std::vector<uint64_t, Allocator> &keys,
+                                 std::vector<uint64_t, Allocator> &scratch) {
+  size_t count = keys.size();
+  if (count < 2) {
+    return;
+  }
+  uint32_t histograms[8][256] = {};
+  for (uint64_t key : keys) {
+    for (uint32_t pass = 0; pass < 8; pass++) {
+      histograms[pass][key >> (pass * 8) & 0xff]++;
+    }
+  }
+  scratch.resize(count);
+  uint64_t *src = keys.data();
+  uint64_t *dst = scratch.data();
+  for (uint32_t pass = 0; pass < 8; pass++) {
+    uint32_t *histogram = histograms[pass];
+    if (histogram[src[0] >> (pass * 8) & 0xff] == count) {
+      continue;
+    }
+    uint32_t offset = 0;
+    for (uint32_t digit = 0; digit < 256; digit++) {
+      uint32_t digit_count = histogram[digit];
+      histogram[digit] = offset;
+      offset += digit_count;
+    }
+    for (size_t i = 0; i < count; i++) {
+      dst[histogram[src[i] >> (pass * 8) & 0xff]++] = src[i];
+    }
+    std::swap(src, dst);
+  }
+  if (src != keys.data()) {
+    keys.swap(scratch);
+  }
+}
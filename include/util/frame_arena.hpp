@@ -0,0 +1,136 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+const size_t FRAME_ARENA_BLOCK_SIZE = 256 * 1024;
+
+// Linear allocator for data that lives until its frame in flight comes
+// round again: draw lists, sort keys, culling results, the frame graph.
+// Allocating bumps an offset into one block and reset() frees everything
+// at once, nothing is freed on its own. A frame that does not fit is
+// served from the heap, and the next reset grows the block to the whole
+// frame, so steady state frames never touch the heap. Render thread only.
+class FrameArena {
+public:
+  void init(size_t capacity = FRAME_ARENA_BLOCK_SIZE) {
+    block = static_cast<char *>(::operator new(capacity));
+    this->capacity = capacity;
+  }
+
+  void *allocate(size_t size, size_t alignment) {
+    uintptr_t start = reinterpret_cast<uintptr_t>(block) + used;
+    uintptr_t aligned = (start + alignment - 1) & ~(uintptr_t)(alignment - 1);
+    size_t end = used + (aligned - start) + size;
+    if (end <= capacity) {
+      used = end;
+      peak = std::max(peak, used);
+      return reinterpret_cast<void *>(aligned);
+    }
+    overflow_bytes += size + alignment;
+    char *memory = static_cast<char *>(::operator new(size + alignment));
+    overflow.push_back(memory);
+    start = reinterpret_cast<uintptr_t>(memory);
+    aligned = (start + alignment - 1) & ~(uintptr_t)(alignment - 1);
+    return reinterpret_cast<void *>(aligned);
+  }
+
+  // Objects are never destroyed, only trivially destructible ones belong
+  // in the arena on their own.
+  template <typename T, typename... Args> T *create(Args &&...args) {
+    static_assert(std::is_trivially_destructible<T>::value,
+                  "arena objects are never destroyed");
+    return new (allocate(sizeof(T), alignof(T)))
+        T(std::forward<Args>(args)...);
+  }
+
+  // Every allocation of the frame is invalid afterwards.
+  void reset() {
+    if (overflow_bytes > 0) {
+      for (char *memory : overflow) {
+        ::operator delete(memory);
+      }
+      overflow.clear();
+      size_t needed = peak + overflow_bytes;
+      ::operator delete(block);
+      capacity = std::max(capacity * 2, needed);
+      block = static_cast<char *>(::operator new(capacity));
+      overflow_bytes = 0;
+    }
+    used = 0;
+  }
+
+  size_t bytes_used() const { return used; }
+
+  size_t size() const { return capacity; }
+
+  void destroy() {
+    reset();
+    ::operator delete(block);
+    block = nullptr;
+    capacity = 0;
+  }
+
+private:
+  char *block = nullptr;
+  size_t capacity = 0;
+  size_t used = 0;
+  size_t peak = 0;
+  // Heap allocations of a frame that did not fit, until the next reset.
+  std::vector<char *> overflow;
+  size_t overflow_bytes = 0;
+};
+
+// STL allocator on a FrameArena. Deallocation does nothing, the memory
+// goes back with the arena's reset, so a container must not outlive the
+// frame its arena belongs to. Without an arena it falls back to the heap,
+// which lets containers be default constructed and take an arena from a
+// later assignment, the arena propagates with the container.
+template <typename T> class ArenaAllocator {
+public:
+  typedef T value_type;
+  typedef std::true_type propagate_on_container_copy_assignment;
+  typedef std::true_type propagate_on_container_move_assignment;
+  typedef std::true_type propagate_on_container_swap;
+
+  ArenaAllocator() = default;
+
+  explicit ArenaAllocator(FrameArena *arena) : arena(arena) {}
+
+  template <typename U>
+  ArenaAllocator(const ArenaAllocator<U> &other) : arena(other.arena) {}
+
+  T *allocate(size_t count) {
+    if (!arena) {
+      return static_cast<T *>(::operator new(count * sizeof(T)));
+    }
+    return static_cast<T *>(arena->allocate(count * sizeof(T), alignof(T)));
+  }
+
+  void deallocate(T *pointer, size_t) {
+    if (!arena) {
+      ::operator delete(pointer);
+    }
+  }
+
+  template <typename U> bool operator==(const ArenaAllocator<U> &other) const {
+    return arena == other.arena;
+  }
+
+  template <typename U> bool operator!=(const ArenaAllocator<U> &other) const {
+    return arena != other.arena;
+  }
+
+  FrameArena *arena = nullptr;
+};
+
+template <typename T> using FrameVector = std::vector<T, ArenaAllocator<T>>;
+
+template <typename T> FrameVector<T> make_frame_vector(FrameArena &arena) {
+  return FrameVector<T>(ArenaAllocator<T>(&arena));
+}
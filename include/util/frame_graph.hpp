@@ -0,0 +1,976 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <functional>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <vulkan/vulkan_core.h>
+
+#include <util/deletion_queue.hpp>
+#include <util/frame_arena.hpp>
+#include <util/gpu_allocator.hpp>
+#include <util/pipeline_registry.hpp>
+#include <util/timeline_scheduler.hpp>
+
+// Access bits that write, everything else in an access mask reads.
+const VkAccessFlags2 FRAME_GRAPH_WRITE_ACCESS =
+    VK_ACCESS_2_SHADER_WRITE_BIT | VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT |
+    VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT |
+    VK_ACCESS_2_TRANSFER_WRITE_BIT | VK_ACCESS_2_HOST_WRITE_BIT |
+    VK_ACCESS_2_MEMORY_WRITE_BIT | VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT;
+
+// Buffer range used by the passes of one frame. Contents are not carried
+// over from the previous frame across queue families: the first pass to
+// touch a range each frame has to overwrite what it reads.
+struct FrameGraphBuffer {
+  VkBuffer buffer = VK_NULL_HANDLE;
+  VkDeviceSize offset = 0;
+  VkDeviceSize size = VK_WHOLE_SIZE;
+  // Created with VK_SHARING_MODE_CONCURRENT, every queue owns it already.
+  bool concurrent = false;
+  // Read after the frame, so the passes writing it are never culled.
+  bool output = false;
+};
+
+// Image owned outside the graph, like a swap chain image.
+struct FrameGraphImage {
+  VkImage image = VK_NULL_HANDLE;
+  VkImageView view = VK_NULL_HANDLE;
+  VkImageAspectFlags aspect = VK_IMAGE_ASPECT_COLOR_BIT;
+  // State before the first pass. The stage is where the image was last
+  // used, or where the submission waits for it, like a swap chain acquire.
+  VkImageLayout initial_layout = VK_IMAGE_LAYOUT_UNDEFINED;
+  VkPipelineStageFlags2 initial_stage = VK_PIPELINE_STAGE_2_NONE;
+  VkAccessFlags2 initial_access = VK_ACCESS_2_NONE;
+  bool output = false;
+  // Where an output is left after its last pass, UNDEFINED to keep the
+  // layout of that pass.
+  VkImageLayout final_layout = VK_IMAGE_LAYOUT_UNDEFINED;
+};
+
+// Image created by the graph that lives for one frame. Transient images
+// whose passes do not overlap share memory, so contents never survive past
+// the last pass using them.
+struct FrameGraphTransientImage {
+  VkFormat format = VK_FORMAT_UNDEFINED;
+  VkExtent2D extent{};
+  VkImageUsageFlags usage = 0;
+  VkImageAspectFlags aspect = VK_IMAGE_ASPECT_COLOR_BIT;
+};
+
+struct FrameGraphAccess {
+  uint32_t buffer;
+  VkPipelineStageFlags2 stage;
+  VkAccessFlags2 access;
+};
+
+// A read or write of an image in the layout the pass needs it in. A write
+// that also reads, like a depth test or LOAD_OP_LOAD, keeps the passes
+// before it that wrote the image.
+struct FrameGraphImageAccess {
+  uint32_t image;
+  VkPipelineStageFlags2 stage;
+  VkAccessFlags2 access;
+  VkImageLayout layout;
+};
+
+// A resource appears at most once in a pass, read or written. Created by
+// FrameGraph::add_pass(), the access lists live in the frame's arena.
+struct FrameGraphPass {
+  std::string name;
+  TimelineQueue queue = TIMELINE_GRAPHICS;
+  FrameVector<FrameGraphAccess> reads;
+  FrameVector<FrameGraphAccess> writes;
+  FrameVector<FrameGraphImageAccess> image_reads;
+  FrameVector<FrameGraphImageAccess> image_writes;
+  // Kept even when nothing reads what it writes.
+  bool side_effects = false;
+  // Records into the command buffer of queue, after the barriers for its
+  // accesses.
+  std::function<void(VkCommandBuffer)> record;
+};
+
+// What the submission of one queue needs beyond the graph's own
+// dependencies.
+struct FrameGraphQueueSetup {
+  VkCommandBuffer command_buffer = VK_NULL_HANDLE;
+  std::vector<TimelineWait> waits;
+  VkSemaphore binary_wait = VK_NULL_HANDLE;
+  VkPipelineStageFlags binary_wait_stage = 0;
+  VkSemaphore binary_signal = VK_NULL_HANDLE;
+};
+
+// Per frame schedule of passes over the timeline queues. All passes of a
+// queue go into one command buffer and one submission, in the order they
+// were added.
+//
+// Passes that neither have side effects nor write anything an output or a
+// later kept pass reads are culled first. Whenever a kept pass uses a
+// buffer another queue wrote, or writes one another queue read, the
+// consumer's submission waits on the producer's timeline point; for
+// exclusive buffers on different queue families the graph also records the
+// release at the end of the producer and the matching acquire before the
+// consumer. Submissions go out in dependency order, a cycle between queues
+// is an error. Images stay on one queue.
+//
+// Inside a queue the graph tracks every resource from pass to pass and
+// puts one barrier batch in front of each pass with only the dependencies
+// it lacks: layout transitions as image barriers, the rest merged into a
+// single memory barrier, and reads a previous barrier already made the
+// data visible to get none.
+class FrameGraph {
+public:
+  // Queue family of every timeline queue, roles may share one.
+  // pipeline_barrier2 is vkCmdPipelineBarrier2KHR if synchronization2 is
+  // enabled, otherwise null and barriers go through vkCmdPipelineBarrier.
+  void init(VkDevice device, TimelineScheduler &timeline,
+            DeletionQueue &deletions, GpuAllocator &allocator,
+            const std::array<uint32_t, TIMELINE_QUEUE_COUNT> &families,
+            PFN_vkCmdPipelineBarrier2 pipeline_barrier2) {
+    this->device = device;
+    this->timeline = &timeline;
+    this->deletions = &deletions;
+    this->allocator = &allocator;
+    this->families = families;
+    this->pipeline_barrier2 = pipeline_barrier2;
+  }
+
+  // Forgets the passes and resources of the last frame, the new frame's
+  // go into arena. The queue setups are cleared as well, except for their
+  // command buffers. Transient images are kept for frames that declare the
+  // same ones.
+  void reset(FrameArena &arena) {
+    this->arena = &arena;
+    passes = make_frame_vector<FrameGraphPass>(arena);
+    buffers = make_frame_vector<FrameGraphBuffer>(arena);
+    images = make_frame_vector<ImageResource>(arena);
+    transients = make_frame_vector<uint32_t>(arena);
+    live = make_frame_vector<bool>(arena);
+    pass_barriers = make_frame_vector<Barriers>(arena);
+    for (auto &barriers : final_barriers) {
+      barriers = make_barriers();
+    }
+    prologue = nullptr;
+    for (auto &setup : setups) {
+      setup.waits.clear();
+      setup.binary_wait = VK_NULL_HANDLE;
+      setup.binary_wait_stage = 0;
+      setup.binary_signal = VK_NULL_HANDLE;
+    }
+  }
+
+  uint32_t import_buffer(const FrameGraphBuffer &buffer) {
+    buffers.push_back(buffer);
+    return static_cast<uint32_t>(buffers.size() - 1);
+  }
+
+  uint32_t import_image(const FrameGraphImage &image) {
+    ImageResource resource;
+    resource.image = image;
+    images.push_back(resource);
+    return static_cast<uint32_t>(images.size() - 1);
+  }
+
+  uint32_t create_image(const FrameGraphTransientImage &desc) {
+    ImageResource resource;
+    resource.image.aspect = desc.aspect;
+    resource.transient = true;
+    resource.desc = desc;
+    images.push_back(resource);
+    transients.push_back(static_cast<uint32_t>(images.size() - 1));
+    return transients.back();
+  }
+
+  // Valid inside the record functions of passes, transient images get
+  // their memory when the graph executes.
+  VkImage image(uint32_t image) const { return images[image].image.image; }
+
+  VkImageView image_view(uint32_t image) const {
+    return images[image].image.view;
+  }
+
+  // The reference is valid until the next call.
+  FrameGraphPass &add_pass(const std::string &name, TimelineQueue queue) {
+    FrameGraphPass pass;
+    pass.name = name;
+    pass.queue = queue;
+    pass.reads = make_frame_vector<FrameGraphAccess>(*arena);
+    pass.writes = make_frame_vector<FrameGraphAccess>(*arena);
+    pass.image_reads = make_frame_vector<FrameGraphImageAccess>(*arena);
+    pass.image_writes = make_frame_vector<FrameGraphImageAccess>(*arena);
+    passes.push_back(std::move(pass));
+    return passes.back();
+  }
+
+  FrameGraphQueueSetup &setup(TimelineQueue queue) { return setups[queue]; }
+
+  // Recorded first into whichever submission goes out first, for work all
+  // passes depend on, like resetting queries.
+  void set_prologue(std::function<void(VkCommandBuffer)> record) {
+    prologue = std::move(record);
+  }
+
+  // Records and submits every queue with kept passes. Returns the point of
+  // each submission, value 0 for queues without any.
+  std::array<TimelinePoint, TIMELINE_QUEUE_COUNT> execute() {
+    cull();
+    place_transients();
+    resolve();
+    std::array<TimelinePoint, TIMELINE_QUEUE_COUNT> points{};
+    for (TimelineQueue queue : submission_order()) {
+      submit(queue, points);
+    }
+    return points;
+  }
+
+  // Whether the last execute had to create new transient images, after
+  // the first frame only when the declared ones change.
+  bool transients_changed() const { return plan_changed; }
+
+  void print_transient_stats(std::ostream &out) const {
+    out << "transient images: " << plan.images.size() << " in "
+        << plan.allocations.size() << " allocations, " << plan.bytes
+        << " bytes, " << plan.unaliased_bytes << " without aliasing"
+        << std::endl;
+  }
+
+  // The caller waited for the device.
+  void destroy() {
+    destroy_plan(device, *allocator, plan);
+    release();
+  }
+
+  // Lets go of the last frame before its arena is reset or destroyed.
+  // Passes hold strings and functions, which have to be destroyed while
+  // the arena memory under them is still there.
+  void release() {
+    passes.clear();
+    buffers.clear();
+    images.clear();
+    transients.clear();
+    live.clear();
+    pass_barriers.clear();
+    for (auto &barriers : final_barriers) {
+      barriers.buffers.clear();
+      barriers.images.clear();
+    }
+  }
+
+private:
+  static constexpr uint32_t NO_PASS = UINT32_MAX;
+
+  // What happened to a resource on one queue since the barriers that
+  // cover it.
+  struct Hazard {
+    VkImageLayout layout = VK_IMAGE_LAYOUT_UNDEFINED;
+    VkPipelineStageFlags2 write_stage = 0;
+    VkAccessFlags2 write_access = 0;
+    // Reads since the last write.
+    VkPipelineStageFlags2 read_stages = 0;
+    // Every pair of these already sees the last write.
+    VkPipelineStageFlags2 visible_stages = 0;
+    VkAccessFlags2 visible_access = 0;
+  };
+
+  struct Dependency {
+    bool needed = false;
+    bool transition = false;
+    VkImageLayout old_layout = VK_IMAGE_LAYOUT_UNDEFINED;
+    VkPipelineStageFlags2 src_stage = 0;
+    VkAccessFlags2 src_access = 0;
+    VkPipelineStageFlags2 dst_stage = 0;
+    VkAccessFlags2 dst_access = 0;
+  };
+
+  struct Barriers {
+    bool has_memory = false;
+    VkMemoryBarrier2 memory{};
+    FrameVector<VkBufferMemoryBarrier2> buffers;
+    FrameVector<VkImageMemoryBarrier2> images;
+  };
+
+  struct BufferState {
+    // Last use on each queue, for the dependencies between queues.
+    std::array<VkPipelineStageFlags2, TIMELINE_QUEUE_COUNT> read_stages{};
+    bool written = false;
+    TimelineQueue writer = TIMELINE_GRAPHICS;
+    VkPipelineStageFlags2 write_stage = 0;
+    VkAccessFlags2 write_access = 0;
+    // Queues that already acquired the last write.
+    std::array<bool, TIMELINE_QUEUE_COUNT> acquired{};
+    std::array<Hazard, TIMELINE_QUEUE_COUNT> hazards{};
+  };
+
+  struct ImageResource {
+    // Filled in by place_transients() for transient images.
+    FrameGraphImage image;
+    bool transient = false;
+    FrameGraphTransientImage desc{};
+    // Kept passes using the image, and everything they do with it.
+    uint32_t first_pass = NO_PASS;
+    uint32_t last_pass = NO_PASS;
+    TimelineQueue queue = TIMELINE_GRAPHICS;
+    VkPipelineStageFlags2 stages = 0;
+    VkAccessFlags2 write_access = 0;
+  };
+
+  // Images and memory of the transient images one frame declared, in the
+  // order they were created.
+  struct TransientPlan {
+    uint64_t key = 0;
+    std::vector<VkImage> images;
+    std::vector<VkImageView> views;
+    std::vector<GpuAllocation> allocations;
+    // Transient that used the memory of each before it, the last one of
+    // the same allocation for the first, that one's frame is the previous.
+    std::vector<uint32_t> predecessors;
+    VkDeviceSize bytes = 0;
+    VkDeviceSize unaliased_bytes = 0;
+  };
+
+  // Walks the passes back to front keeping writers of whatever outputs and
+  // kept passes read. Buffer writes may be partial, so they keep earlier
+  // writers of the same buffer too; image writes that read nothing replace
+  // the whole image.
+  void cull() {
+    live.assign(passes.size(), false);
+    FrameVector<bool> buffer_needed = make_frame_vector<bool>(*arena);
+    FrameVector<bool> image_needed = make_frame_vector<bool>(*arena);
+    buffer_needed.resize(buffers.size());
+    image_needed.resize(images.size());
+    for (uint32_t i = 0; i < buffers.size(); i++) {
+      buffer_needed[i] = buffers[i].output;
+    }
+    for (uint32_t i = 0; i < images.size(); i++) {
+      image_needed[i] = !images[i].transient && images[i].image.output;
+    }
+    for (uint32_t i = static_cast<uint32_t>(passes.size()); i-- > 0;) {
+      const FrameGraphPass &pass = passes[i];
+      bool needed = pass.side_effects;
+      for (const auto &write : pass.writes) {
+        needed = needed || buffer_needed[write.buffer];
+      }
+      for (const auto &write : pass.image_writes) {
+        needed = needed || image_needed[write.image];
+      }
+      if (!needed) {
+        continue;
+      }
+      live[i] = true;
+      for (const auto &read : pass.reads) {
+        buffer_needed[read.buffer] = true;
+      }
+      for (const auto &write : pass.writes) {
+        buffer_needed[write.buffer] = true;
+      }
+      for (const auto &write : pass.image_writes) {
+        image_needed[write.image] =
+            (write.access & ~FRAME_GRAPH_WRITE_ACCESS) != 0;
+      }
+      for (const auto &read : pass.image_reads) {
+        image_needed[read.image] = true;
+      }
+    }
+  }
+
+  void place_transients() {
+    for (uint32_t i = 0; i < passes.size(); i++) {
+      if (!live[i]) {
+        continue;
+      }
+      for (const auto *accesses :
+           {&passes[i].image_reads, &passes[i].image_writes}) {
+        for (const auto &access : *accesses) {
+          ImageResource &resource = images[access.image];
+          if (resource.first_pass == NO_PASS) {
+            resource.first_pass = i;
+            resource.queue = passes[i].queue;
+          } else if (resource.queue != passes[i].queue) {
+            throw std::runtime_error("frame graph image used by " +
+                                     passes[i].name +
+                                     " on more than one queue");
+          }
+          resource.last_pass = i;
+          resource.stages |= access.stage;
+          resource.write_access |= access.access & FRAME_GRAPH_WRITE_ACCESS;
+        }
+      }
+    }
+    // The stages are in the key as well, the first use of a transient
+    // waits for the previous frame's last one with them.
+    PipelineHasher hasher;
+    for (uint32_t image : transients) {
+      const ImageResource &resource = images[image];
+      hasher.add(resource.desc.format);
+      hasher.add(resource.desc.extent.width);
+      hasher.add(resource.desc.extent.height);
+      hasher.add(resource.desc.usage);
+      hasher.add(resource.desc.aspect);
+      hasher.add(resource.first_pass);
+      hasher.add(resource.last_pass);
+      hasher.add(resource.queue);
+      hasher.add(resource.stages);
+      hasher.add(resource.write_access);
+    }
+    plan_changed = hasher.value != plan.key;
+    if (plan_changed) {
+      deletions->retire(
+          [device = device, allocator = allocator, plan = plan]() mutable {
+            destroy_plan(device, *allocator, plan);
+          });
+      plan = TransientPlan{};
+      plan.key = hasher.value;
+      build_plan();
+    }
+    for (uint32_t i = 0; i < transients.size(); i++) {
+      ImageResource &resource = images[transients[i]];
+      if (resource.first_pass == NO_PASS) {
+        continue;
+      }
+      const ImageResource &predecessor =
+          images[transients[plan.predecessors[i]]];
+      resource.image.image = plan.images[i];
+      resource.image.view = plan.views[i];
+      resource.image.initial_stage = predecessor.stages;
+      resource.image.initial_access = predecessor.write_access;
+    }
+  }
+
+  // First fit of the transients, by their first pass, into allocations
+  // whose last image is done before they start.
+  void build_plan() {
+    struct Slot {
+      uint32_t last_pass;
+      TimelineQueue queue;
+      VkMemoryRequirements requirements;
+      std::vector<uint32_t> members;
+    };
+    size_t count = transients.size();
+    plan.images.resize(count, VK_NULL_HANDLE);
+    plan.views.resize(count, VK_NULL_HANDLE);
+    plan.predecessors.resize(count, 0);
+    std::vector<VkMemoryRequirements> requirements(count);
+    std::vector<uint32_t> order;
+    for (uint32_t i = 0; i < count; i++) {
+      const ImageResource &resource = images[transients[i]];
+      if (resource.first_pass == NO_PASS) {
+        continue;
+      }
+      VkImageCreateInfo image_info{};
+      image_info.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+      image_info.imageType = VK_IMAGE_TYPE_2D;
+      image_info.format = resource.desc.format;
+      image_info.extent = {resource.desc.extent.width,
+                           resource.desc.extent.height, 1};
+      image_info.mipLevels = 1;
+      image_info.arrayLayers = 1;
+      image_info.samples = VK_SAMPLE_COUNT_1_BIT;
+      image_info.tiling = VK_IMAGE_TILING_OPTIMAL;
+      image_info.usage = resource.desc.usage;
+      image_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+      image_info.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+      if (vkCreateImage(device, &image_info, nullptr, &plan.images[i]) !=
+          VK_SUCCESS) {
+        throw std::runtime_error("failed to create transient image");
+      }
+      vkGetImageMemoryRequirements(device, plan.images[i], &requirements[i]);
+      plan.unaliased_bytes += requirements[i].size;
+      order.push_back(i);
+    }
+    std::stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+      return images[transients[a]].first_pass <
+             images[transients[b]].first_pass;
+    });
+    std::vector<Slot> slots;
+    for (uint32_t i : order) {
+      const ImageResource &resource = images[transients[i]];
+      Slot *slot = nullptr;
+      for (auto &candidate : slots) {
+        if (candidate.queue == resource.queue &&
+            candidate.last_pass < resource.first_pass &&
+            (candidate.requirements.memoryTypeBits &
+             requirements[i].memoryTypeBits) != 0) {
+          slot = &candidate;
+          break;
+        }
+      }
+      if (!slot) {
+        slots.push_back({resource.last_pass, resource.queue, requirements[i],
+                         {}});
+        slot = &slots.back();
+      }
+      slot->last_pass = resource.last_pass;
+      slot->requirements.size =
+          std::max(slot->requirements.size, requirements[i].size);
+      slot->requirements.alignment =
+          std::max(slot->requirements.alignment, requirements[i].alignment);
+      slot->requirements.memoryTypeBits &= requirements[i].memoryTypeBits;
+      slot->members.push_back(i);
+    }
+    for (const auto &slot : slots) {
+      GpuAllocation allocation = allocator->allocate(
+          slot.requirements,
+          allocator->find_memory_type(slot.requirements.memoryTypeBits,
+                                      VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT),
+          false);
+      plan.allocations.push_back(allocation);
+      plan.bytes += slot.requirements.size;
+      for (size_t j = 0; j < slot.members.size(); j++) {
+        uint32_t i = slot.members[j];
+        plan.predecessors[i] =
+            slot.members[(j + slot.members.size() - 1) % slot.members.size()];
+        vkBindImageMemory(device, plan.images[i], allocation.memory,
+                          allocation.offset);
+        VkImageViewCreateInfo view_info{};
+        view_info.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+        view_info.image = plan.images[i];
+        view_info.viewType = VK_IMAGE_VIEW_TYPE_2D;
+        view_info.format = images[transients[i]].desc.format;
+        view_info.subresourceRange.aspectMask =
+            images[transients[i]].desc.aspect;
+        view_info.subresourceRange.levelCount = 1;
+        view_info.subresourceRange.layerCount = 1;
+        if (vkCreateImageView(device, &view_info, nullptr, &plan.views[i]) !=
+            VK_SUCCESS) {
+          throw std::runtime_error("failed to create transient image view");
+        }
+      }
+    }
+  }
+
+  static void destroy_plan(VkDevice device, GpuAllocator &allocator,
+                           TransientPlan &plan) {
+    for (VkImageView view : plan.views) {
+      vkDestroyImageView(device, view, nullptr);
+    }
+    for (VkImage image : plan.images) {
+      vkDestroyImage(device, image, nullptr);
+    }
+    for (auto &allocation : plan.allocations) {
+      allocator.free(allocation);
+    }
+    plan = TransientPlan{};
+  }
+
+  // Dependencies of every pass are found against the state before it, so
+  // a pass never waits on itself, and only then applied.
+  void resolve() {
+    for (auto &stages : wait_stages) {
+      stages.fill(0);
+    }
+    pass_barriers.assign(passes.size(), make_barriers());
+    FrameVector<BufferState> states = make_frame_vector<BufferState>(*arena);
+    FrameVector<Hazard> image_hazards = make_frame_vector<Hazard>(*arena);
+    states.resize(buffers.size());
+    image_hazards.resize(images.size());
+    for (uint32_t i = 0; i < images.size(); i++) {
+      image_hazards[i].layout = images[i].image.initial_layout;
+      image_hazards[i].write_stage = images[i].image.initial_stage;
+      image_hazards[i].write_access = images[i].image.initial_access;
+    }
+    for (uint32_t i = 0; i < passes.size(); i++) {
+      if (!live[i]) {
+        continue;
+      }
+      const FrameGraphPass &pass = passes[i];
+      Barriers &barriers = pass_barriers[i];
+      for (const auto &read : pass.reads) {
+        BufferState &state = states[read.buffer];
+        if (state.written && state.writer != pass.queue &&
+            !state.acquired[pass.queue]) {
+          depend(state.writer, pass.queue, read.stage);
+          transfer(read.buffer, state, pass.queue, read, barriers);
+        }
+        add_memory(barriers, dependency(state.hazards[pass.queue], read.stage,
+                                        read.access, VK_IMAGE_LAYOUT_UNDEFINED,
+                                        false));
+      }
+      for (const auto &write : pass.writes) {
+        BufferState &state = states[write.buffer];
+        // Reads on other queues finish first, their contents are
+        // overwritten and need no transfer.
+        for (uint32_t queue = 0; queue < TIMELINE_QUEUE_COUNT; queue++) {
+          if (queue != pass.queue && state.read_stages[queue] != 0) {
+            depend((TimelineQueue)queue, pass.queue, write.stage);
+          }
+        }
+        if (state.written && state.writer != pass.queue) {
+          depend(state.writer, pass.queue, write.stage);
+        }
+        add_memory(barriers,
+                   dependency(state.hazards[pass.queue], write.stage,
+                              write.access, VK_IMAGE_LAYOUT_UNDEFINED, true));
+      }
+      for (const auto *accesses : {&pass.image_reads, &pass.image_writes}) {
+        bool write = accesses == &pass.image_writes;
+        for (const auto &access : *accesses) {
+          add_image(barriers, access,
+                    dependency(image_hazards[access.image], access.stage,
+                               access.access, access.layout, write));
+        }
+      }
+      for (const auto &read : pass.reads) {
+        BufferState &state = states[read.buffer];
+        if (state.written && state.writer != pass.queue) {
+          state.acquired[pass.queue] = true;
+        }
+        state.read_stages[pass.queue] |= read.stage;
+        update(state.hazards[pass.queue], read.stage, read.access,
+               VK_IMAGE_LAYOUT_UNDEFINED, false);
+      }
+      for (const auto &write : pass.writes) {
+        BufferState &state = states[write.buffer];
+        state.read_stages.fill(0);
+        state.acquired.fill(false);
+        state.acquired[pass.queue] = true;
+        state.written = true;
+        state.writer = pass.queue;
+        state.write_stage = write.stage;
+        state.write_access = write.access & FRAME_GRAPH_WRITE_ACCESS;
+        // Other queues see the write through their semaphore wait.
+        state.hazards.fill(Hazard{});
+        update(state.hazards[pass.queue], write.stage, write.access,
+               VK_IMAGE_LAYOUT_UNDEFINED, true);
+      }
+      for (const auto &read : pass.image_reads) {
+        update(image_hazards[read.image], read.stage, read.access,
+               read.layout, false);
+      }
+      for (const auto &write : pass.image_writes) {
+        update(image_hazards[write.image], write.stage, write.access,
+               write.layout, true);
+      }
+    }
+    for (uint32_t i = 0; i < images.size(); i++) {
+      const FrameGraphImage &image = images[i].image;
+      // An output already in its final layout needs no barrier, a barrier
+      // without a transition would order nothing the frame's semaphore
+      // signal does not already.
+      if (images[i].first_pass == NO_PASS || !image.output ||
+          image.final_layout == VK_IMAGE_LAYOUT_UNDEFINED ||
+          image.final_layout == image_hazards[i].layout) {
+        continue;
+      }
+      FrameGraphImageAccess access{i, VK_PIPELINE_STAGE_2_NONE,
+                                   VK_ACCESS_2_NONE, image.final_layout};
+      add_image(final_barriers[images[i].queue], access,
+                dependency(image_hazards[i], access.stage, access.access,
+                           access.layout, true));
+    }
+  }
+
+  // Transitions and writes wait for every earlier access, but only writes
+  // have to be made available. Reads wait for the last write unless an
+  // earlier barrier made it visible to them.
+  static Dependency dependency(const Hazard &hazard,
+                               VkPipelineStageFlags2 stage,
+                               VkAccessFlags2 access, VkImageLayout layout,
+                               bool write) {
+    Dependency dependency;
+    dependency.transition = layout != hazard.layout;
+    dependency.old_layout = hazard.layout;
+    if (dependency.transition || write) {
+      dependency.needed = dependency.transition ||
+                          hazard.write_stage != 0 || hazard.read_stages != 0;
+      dependency.src_stage = hazard.write_stage | hazard.read_stages;
+      dependency.src_access = hazard.write_access;
+      dependency.dst_stage = stage;
+      dependency.dst_access = access;
+    } else if (hazard.write_stage != 0 &&
+               ((stage & ~hazard.visible_stages) != 0 ||
+                (access & ~hazard.visible_access) != 0)) {
+      // Covering the earlier readers again keeps every pair of visible
+      // stages and accesses behind one barrier.
+      dependency.needed = true;
+      dependency.src_stage = hazard.write_stage;
+      dependency.src_access = hazard.write_access;
+      dependency.dst_stage = hazard.visible_stages | stage;
+      dependency.dst_access = hazard.visible_access | access;
+    }
+    return dependency;
+  }
+
+  static void update(Hazard &hazard, VkPipelineStageFlags2 stage,
+                     VkAccessFlags2 access, VkImageLayout layout,
+                     bool write) {
+    if (write) {
+      hazard = Hazard{};
+      hazard.layout = layout;
+      hazard.write_stage = stage;
+      hazard.write_access = access & FRAME_GRAPH_WRITE_ACCESS;
+    } else if (layout != hazard.layout) {
+      // The transition writes the image, later accesses wait for it.
+      hazard = Hazard{};
+      hazard.layout = layout;
+      hazard.write_stage = stage;
+      hazard.read_stages = stage;
+      hazard.visible_stages = stage;
+      hazard.visible_access = access;
+    } else {
+      hazard.read_stages |= stage;
+      if (hazard.write_stage != 0 &&
+          ((stage & ~hazard.visible_stages) != 0 ||
+           (access & ~hazard.visible_access) != 0)) {
+        hazard.visible_stages |= stage;
+        hazard.visible_access |= access;
+      }
+    }
+  }
+
+  Barriers make_barriers() {
+    Barriers barriers;
+    barriers.buffers = make_frame_vector<VkBufferMemoryBarrier2>(*arena);
+    barriers.images = make_frame_vector<VkImageMemoryBarrier2>(*arena);
+    return barriers;
+  }
+
+  static void add_memory(Barriers &barriers, const Dependency &dependency) {
+    if (!dependency.needed) {
+      return;
+    }
+    barriers.has_memory = true;
+    barriers.memory.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER_2;
+    barriers.memory.srcStageMask |= dependency.src_stage;
+    barriers.memory.srcAccessMask |= dependency.src_access;
+    barriers.memory.dstStageMask |= dependency.dst_stage;
+    barriers.memory.dstAccessMask |= dependency.dst_access;
+  }
+
+  void add_image(Barriers &barriers, const FrameGraphImageAccess &access,
+                 const Dependency &dependency) {
+    if (!dependency.transition) {
+      add_memory(barriers, dependency);
+      return;
+    }
+    VkImageMemoryBarrier2 barrier{};
+    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2;
+    barrier.srcStageMask = dependency.src_stage;
+    barrier.srcAccessMask = dependency.src_access;
+    barrier.dstStageMask = dependency.dst_stage;
+    barrier.dstAccessMask = dependency.dst_access;
+    barrier.oldLayout = dependency.old_layout;
+    barrier.newLayout = access.layout;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.image = images[access.image].image.image;
+    barrier.subresourceRange.aspectMask = images[access.image].image.aspect;
+    barrier.subresourceRange.levelCount = VK_REMAINING_MIP_LEVELS;
+    barrier.subresourceRange.layerCount = VK_REMAINING_ARRAY_LAYERS;
+    barriers.images.push_back(barrier);
+  }
+
+  void depend(TimelineQueue src, TimelineQueue dst,
+              VkPipelineStageFlags2 stage) {
+    wait_stages[dst][src] |= stage;
+  }
+
+  // The release goes after the producer's passes, the acquire in front of
+  // the consumer, both with the same families and range. The acquire
+  // starts at the stages the submission waits at, so it chains with the
+  // semaphore wait.
+  void transfer(uint32_t buffer, const BufferState &state,
+                TimelineQueue dst_queue, const FrameGraphAccess &read,
+                Barriers &acquires) {
+    if (buffers[buffer].concurrent ||
+        families[state.writer] == families[dst_queue]) {
+      return;
+    }
+    VkBufferMemoryBarrier2 barrier{};
+    barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER_2;
+    barrier.srcQueueFamilyIndex = families[state.writer];
+    barrier.dstQueueFamilyIndex = families[dst_queue];
+    barrier.buffer = buffers[buffer].buffer;
+    barrier.offset = buffers[buffer].offset;
+    barrier.size = buffers[buffer].size;
+    VkBufferMemoryBarrier2 release = barrier;
+    release.srcStageMask = state.write_stage;
+    release.srcAccessMask = state.write_access;
+    release.dstStageMask = VK_PIPELINE_STAGE_2_NONE;
+    final_barriers[state.writer].buffers.push_back(release);
+    VkBufferMemoryBarrier2 acquire = barrier;
+    acquire.srcStageMask = read.stage;
+    acquire.dstStageMask = read.stage;
+    acquire.dstAccessMask = read.access;
+    acquires.buffers.push_back(acquire);
+  }
+
+  FrameVector<TimelineQueue> submission_order() {
+    std::array<bool, TIMELINE_QUEUE_COUNT> used{};
+    for (uint32_t i = 0; i < passes.size(); i++) {
+      used[passes[i].queue] = used[passes[i].queue] || live[i];
+    }
+    FrameVector<TimelineQueue> order = make_frame_vector<TimelineQueue>(*arena);
+    std::array<bool, TIMELINE_QUEUE_COUNT> done{};
+    while (true) {
+      bool progress = false;
+      for (uint32_t queue = 0; queue < TIMELINE_QUEUE_COUNT; queue++) {
+        if (!used[queue] || done[queue]) {
+          continue;
+        }
+        bool ready = true;
+        for (uint32_t src = 0; src < TIMELINE_QUEUE_COUNT; src++) {
+          ready = ready && (wait_stages[queue][src] == 0 || done[src]);
+        }
+        if (ready) {
+          order.push_back((TimelineQueue)queue);
+          done[queue] = true;
+          progress = true;
+        }
+      }
+      if (!progress) {
+        break;
+      }
+    }
+    for (uint32_t queue = 0; queue < TIMELINE_QUEUE_COUNT; queue++) {
+      if (used[queue] && !done[queue]) {
+        throw std::runtime_error("frame graph queues depend on each other");
+      }
+    }
+    return order;
+  }
+
+  void submit(TimelineQueue queue,
+              std::array<TimelinePoint, TIMELINE_QUEUE_COUNT> &points) {
+    FrameGraphQueueSetup &queue_setup = setups[queue];
+    VkCommandBuffer buffer = queue_setup.command_buffer;
+    VkCommandBufferBeginInfo begin_info{};
+    begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    if (vkBeginCommandBuffer(buffer, &begin_info) != VK_SUCCESS) {
+      throw std::runtime_error("failed to begin recording command buffer");
+    }
+    if (prologue) {
+      prologue(buffer);
+      prologue = nullptr;
+    }
+    for (uint32_t i = 0; i < passes.size(); i++) {
+      if (live[i] && passes[i].queue == queue) {
+        record_barriers(buffer, pass_barriers[i]);
+        passes[i].record(buffer);
+      }
+    }
+    record_barriers(buffer, final_barriers[queue]);
+    if (vkEndCommandBuffer(buffer) != VK_SUCCESS) {
+      throw std::runtime_error("failed to record command buffer");
+    }
+    submit_waits = queue_setup.waits;
+    for (uint32_t src = 0; src < TIMELINE_QUEUE_COUNT; src++) {
+      if (wait_stages[queue][src] != 0) {
+        submit_waits.push_back(
+            {points[src], (VkPipelineStageFlags)wait_stages[queue][src]});
+      }
+    }
+    points[queue] = timeline->submit(
+        queue, buffer, submit_waits, queue_setup.binary_wait,
+        queue_setup.binary_wait_stage, queue_setup.binary_signal);
+  }
+
+  // Without synchronization2 the stages of all barriers in a batch merge
+  // into one pair. The graph only sees stages and accesses its callers
+  // declare, which are the ones both versions have, so the low bits
+  // convert as they are.
+  void record_barriers(VkCommandBuffer buffer, const Barriers &barriers) {
+    if (!barriers.has_memory && barriers.buffers.empty() &&
+        barriers.images.empty()) {
+      return;
+    }
+    if (pipeline_barrier2) {
+      VkDependencyInfo dependency_info{};
+      dependency_info.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO;
+      dependency_info.memoryBarrierCount = barriers.has_memory ? 1 : 0;
+      dependency_info.pMemoryBarriers = &barriers.memory;
+      dependency_info.bufferMemoryBarrierCount =
+          static_cast<uint32_t>(barriers.buffers.size());
+      dependency_info.pBufferMemoryBarriers = barriers.buffers.data();
+      dependency_info.imageMemoryBarrierCount =
+          static_cast<uint32_t>(barriers.images.size());
+      dependency_info.pImageMemoryBarriers = barriers.images.data();
+      pipeline_barrier2(buffer, &dependency_info);
+      return;
+    }
+    VkPipelineStageFlags src_stages = 0;
+    VkPipelineStageFlags dst_stages = 0;
+    VkMemoryBarrier memory{};
+    memory.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    if (barriers.has_memory) {
+      memory.srcAccessMask = (VkAccessFlags)barriers.memory.srcAccessMask;
+      memory.dstAccessMask = (VkAccessFlags)barriers.memory.dstAccessMask;
+      src_stages |= (VkPipelineStageFlags)barriers.memory.srcStageMask;
+      dst_stages |= (VkPipelineStageFlags)barriers.memory.dstStageMask;
+    }
+    legacy_buffer_barriers.clear();
+    for (const auto &barrier : barriers.buffers) {
+      VkBufferMemoryBarrier legacy{};
+      legacy.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+      legacy.srcAccessMask = (VkAccessFlags)barrier.srcAccessMask;
+      legacy.dstAccessMask = (VkAccessFlags)barrier.dstAccessMask;
+      legacy.srcQueueFamilyIndex = barrier.srcQueueFamilyIndex;
+      legacy.dstQueueFamilyIndex = barrier.dstQueueFamilyIndex;
+      legacy.buffer = barrier.buffer;
+      legacy.offset = barrier.offset;
+      legacy.size = barrier.size;
+      legacy_buffer_barriers.push_back(legacy);
+      src_stages |= (VkPipelineStageFlags)barrier.srcStageMask;
+      dst_stages |= (VkPipelineStageFlags)barrier.dstStageMask;
+    }
+    legacy_image_barriers.clear();
+    for (const auto &barrier : barriers.images) {
+      VkImageMemoryBarrier legacy{};
+      legacy.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+      legacy.srcAccessMask = (VkAccessFlags)barrier.srcAccessMask;
+      legacy.dstAccessMask = (VkAccessFlags)barrier.dstAccessMask;
+      legacy.oldLayout = barrier.oldLayout;
+      legacy.newLayout = barrier.newLayout;
+      legacy.srcQueueFamilyIndex = barrier.srcQueueFamilyIndex;
+      legacy.dstQueueFamilyIndex = barrier.dstQueueFamilyIndex;
+      legacy.image = barrier.image;
+      legacy.subresourceRange = barrier.subresourceRange;
+      legacy_image_barriers.push_back(legacy);
+      src_stages |= (VkPipelineStageFlags)barrier.srcStageMask;
+      dst_stages |= (VkPipelineStageFlags)barrier.dstStageMask;
+    }
+    vkCmdPipelineBarrier(
+        buffer, src_stages ? src_stages : VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+        dst_stages ? dst_stages : VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0,
+        barriers.has_memory ? 1 : 0, &memory,
+        static_cast<uint32_t>(legacy_buffer_barriers.size()),
+        legacy_buffer_barriers.data(),
+        static_cast<uint32_t>(legacy_image_barriers.size()),
+        legacy_image_barriers.data());
+  }
+
+  VkDevice device = VK_NULL_HANDLE;
+  TimelineScheduler *timeline = nullptr;
+  DeletionQueue *deletions = nullptr;
+  GpuAllocator *allocator = nullptr;
+  std::array<uint32_t, TIMELINE_QUEUE_COUNT> families{};
+  PFN_vkCmdPipelineBarrier2 pipeline_barrier2 = nullptr;
+  // Everything below that is a FrameVector belongs to the current frame.
+  FrameArena *arena = nullptr;
+  FrameVector<FrameGraphPass> passes;
+  FrameVector<FrameGraphBuffer> buffers;
+  FrameVector<ImageResource> images;
+  // Image handle of every transient, in creation order.
+  FrameVector<uint32_t> transients;
+  std::array<FrameGraphQueueSetup, TIMELINE_QUEUE_COUNT> setups;
+  std::function<void(VkCommandBuffer)> prologue;
+  FrameVector<bool> live;
+  TransientPlan plan;
+  bool plan_changed = false;
+  // wait_stages[dst][src], stages of dst that wait for src's submission.
+  std::array<std::array<VkPipelineStageFlags2, TIMELINE_QUEUE_COUNT>,
+             TIMELINE_QUEUE_COUNT>
+      wait_stages{};
+  FrameVector<Barriers> pass_barriers;
+  // Releases and final layouts, after the last pass of each queue.
+  std::array<Barriers, TIMELINE_QUEUE_COUNT> final_barriers;
+  // The rest keep their capacity from frame to frame.
+  std::vector<TimelineWait> submit_waits;
+  std::vector<VkBufferMemoryBarrier> legacy_buffer_barriers;
+  std::vector<VkImageMemoryBarrier> legacy_image_barriers;
+};
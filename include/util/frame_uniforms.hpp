@@ -0,0 +1,63 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+
+#include <vulkan/vulkan_core.h>
+
+// Bytes of uniform data a single frame can push.
+const VkDeviceSize FRAME_UNIFORM_RING_SIZE = 64 * 1024;
+
+// Hands out uniform data for the frames in flight from one persistently
+// mapped, host coherent buffer. Every frame owns its own region, the region
+// is only rewritten after the frame last reading it completed, so writes
+// need neither a map/unmap pair nor a flush. The buffer is bound once as a
+// dynamic uniform buffer and blocks are selected with dynamic offsets,
+// descriptors never change after init().
+class FrameUniformRing {
+public:
+  void init(VkBuffer buffer, void *data, VkDeviceSize frame_size,
+            uint32_t frame_count, VkDeviceSize alignment) {
+    this->buffer = buffer;
+    this->data = (char *)data;
+    this->frame_size = frame_size;
+    this->frame_count = frame_count;
+    this->alignment = alignment;
+  }
+
+  // Starts writing the region of frame, the caller waited for the last
+  // submission of that frame.
+  void begin_frame(uint32_t frame) {
+    frame_begin = frame * frame_size;
+    head = 0;
+  }
+
+  // Copies data into the current frame, returns the dynamic offset of it.
+  uint32_t push(const void *src, VkDeviceSize size) {
+    VkDeviceSize offset = (head + alignment - 1) / alignment * alignment;
+    if (offset + size > frame_size) {
+      throw std::runtime_error("frame uniform ring overflow");
+    }
+    memcpy(data + frame_begin + offset, src, size);
+    head = offset + size;
+    return static_cast<uint32_t>(frame_begin + offset);
+  }
+
+  template <typename T> uint32_t push(const T &value) {
+    return push(&value, sizeof(T));
+  }
+
+  VkBuffer get_buffer() const { return buffer; }
+
+  VkDeviceSize size() const { return frame_size * frame_count; }
+
+private:
+  VkBuffer buffer = VK_NULL_HANDLE;
+  char *data = nullptr;
+  VkDeviceSize frame_size = 0;
+  uint32_t frame_count = 0;
+  VkDeviceSize alignment = 1;
+  VkDeviceSize frame_begin = 0;
+  VkDeviceSize head = 0;
+};
@@ -0,0 +1,333 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <mutex>
+#include <ostream>
+#include <set>
+#include <stdexcept>
+#include <vector>
+
+#include <vulkan/vulkan_core.h>
+
+// Smallest range handed out by the buddy allocator, every order doubles it.
+const VkDeviceSize GPU_ALLOCATOR_MIN_RANGE = 256;
+const VkDeviceSize GPU_ALLOCATOR_BLOCK_SIZE = 64 * 1024 * 1024;
+
+struct GpuAllocation {
+  VkDeviceMemory memory = VK_NULL_HANDLE;
+  VkDeviceSize offset = 0;
+  VkDeviceSize size = 0;
+  // Non-null for host visible memory, blocks stay mapped for their lifetime.
+  void *mapped = nullptr;
+  uint32_t pool = 0;
+  uint32_t block = 0;
+  uint32_t order = 0;
+};
+
+struct GpuAllocatorStats {
+  uint32_t block_count = 0;
+  uint32_t allocation_count = 0;
+  VkDeviceSize bytes_reserved = 0;
+  VkDeviceSize bytes_allocated = 0;
+  VkDeviceSize bytes_used = 0;
+  VkDeviceSize largest_free_range = 0;
+
+  // Share of allocated bytes lost to power of two rounding.
+  float internal_fragmentation() const {
+    if (bytes_allocated == 0) {
+      return 0.0f;
+    }
+    return 1.0f - (float)bytes_used / (float)bytes_allocated;
+  }
+
+  // Share of free bytes that can not be served by a single request.
+  float external_fragmentation() const {
+    VkDeviceSize bytes_free = bytes_reserved - bytes_allocated;
+    if (bytes_free == 0) {
+      return 0.0f;
+    }
+    return 1.0f - (float)largest_free_range / (float)bytes_free;
+  }
+};
+
+struct GpuMemoryBlock {
+  VkDeviceMemory memory = VK_NULL_HANDLE;
+  VkDeviceSize size = 0;
+  uint32_t max_order = 0;
+  void *mapped = nullptr;
+  uint32_t allocation_count = 0;
+  // Free range offsets per order.
+  std::vector<std::set<VkDeviceSize>> free_lists;
+};
+
+struct GpuMemoryPool {
+  uint32_t memory_type;
+  bool linear;
+  std::vector<GpuMemoryBlock> blocks;
+};
+
+// Sub-allocates device memory out of large blocks with a buddy allocator.
+// Blocks are kept per memory type. When the device reports a
+// bufferImageGranularity above one, linear (buffers) and optimal (images)
+// resources get separate pools so they never share a granularity page.
+// Thread safe, background loaders allocate alongside the render thread.
+class GpuAllocator {
+public:
+  void init(VkPhysicalDevice physical_device, VkDevice device,
+            VkDeviceSize block_size = GPU_ALLOCATOR_BLOCK_SIZE) {
+    this->device = device;
+    this->block_size = block_size;
+    vkGetPhysicalDeviceMemoryProperties(physical_device, &mem_properties);
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(physical_device, &properties);
+    buffer_image_granularity = properties.limits.bufferImageGranularity;
+    max_allocation_count = properties.limits.maxMemoryAllocationCount;
+  }
+
+  // First memory type in type_bits with all the properties.
+  uint32_t find_memory_type(uint32_t type_bits,
+                            VkMemoryPropertyFlags properties) const {
+    for (uint32_t i = 0; i < mem_properties.memoryTypeCount; i++) {
+      if (type_bits & (1u << i) &&
+          (mem_properties.memoryTypes[i].propertyFlags & properties) ==
+              properties) {
+        return i;
+      }
+    }
+    throw std::runtime_error("failed to find suitable memory type");
+  }
+
+  GpuAllocation allocate(const VkMemoryRequirements &requirements,
+                         uint32_t memory_type, bool linear = true) {
+    std::lock_guard<std::mutex> lock(mutex);
+    // A buddy range of size 2^n is aligned to 2^n inside its block, so
+    // rounding up to the alignment is enough to satisfy it.
+    VkDeviceSize size = std::max(requirements.size, requirements.alignment);
+    uint32_t order = order_for_size(size);
+    uint32_t pool_index = find_pool(memory_type, linear);
+    GpuMemoryPool &pool = pools[pool_index];
+    GpuAllocation allocation{};
+    allocation.pool = pool_index;
+    allocation.order = order;
+    allocation.size = requirements.size;
+    bool found = false;
+    for (uint32_t i = 0; i < pool.blocks.size() && !found; i++) {
+      GpuMemoryBlock &block = pool.blocks[i];
+      if (block.memory != VK_NULL_HANDLE && block.max_order >= order &&
+          allocate_range(block, order, allocation.offset)) {
+        allocation.block = i;
+        found = true;
+      }
+    }
+    if (!found) {
+      allocation.block = create_block(pool, range_size(order));
+      allocate_range(pool.blocks[allocation.block], order, allocation.offset);
+    }
+    GpuMemoryBlock &block = pool.blocks[allocation.block];
+    allocation.memory = block.memory;
+    if (block.mapped) {
+      allocation.mapped = (char *)block.mapped + allocation.offset;
+    }
+    live_bytes += allocation.size;
+    return allocation;
+  }
+
+  void free(GpuAllocation &allocation) {
+    if (allocation.memory == VK_NULL_HANDLE) {
+      return;
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    GpuMemoryBlock &block = pools[allocation.pool].blocks[allocation.block];
+    VkDeviceSize offset = allocation.offset;
+    uint32_t order = allocation.order;
+    while (order < block.max_order) {
+      VkDeviceSize buddy = offset ^ range_size(order);
+      auto it = block.free_lists[order].find(buddy);
+      if (it == block.free_lists[order].end()) {
+        break;
+      }
+      block.free_lists[order].erase(it);
+      offset = std::min(offset, buddy);
+      order++;
+    }
+    block.free_lists[order].insert(offset);
+    block.allocation_count--;
+    live_bytes -= allocation.size;
+    allocation = GpuAllocation{};
+  }
+
+  // Returns empty blocks to the driver.
+  void trim() {
+    std::lock_guard<std::mutex> lock(mutex);
+    for (auto &pool : pools) {
+      for (auto &block : pool.blocks) {
+        if (block.memory != VK_NULL_HANDLE && block.allocation_count == 0) {
+          release_block(block);
+        }
+      }
+    }
+  }
+
+  GpuAllocatorStats stats() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    GpuAllocatorStats stats{};
+    stats.bytes_used = live_bytes;
+    for (const auto &pool : pools) {
+      for (const auto &block : pool.blocks) {
+        if (block.memory == VK_NULL_HANDLE) {
+          continue;
+        }
+        stats.block_count++;
+        stats.allocation_count += block.allocation_count;
+        stats.bytes_reserved += block.size;
+        VkDeviceSize bytes_free = 0;
+        for (uint32_t order = 0; order <= block.max_order; order++) {
+          if (block.free_lists[order].empty()) {
+            continue;
+          }
+          bytes_free += block.free_lists[order].size() * range_size(order);
+          stats.largest_free_range =
+              std::max(stats.largest_free_range, range_size(order));
+        }
+        stats.bytes_allocated += block.size - bytes_free;
+      }
+    }
+    return stats;
+  }
+
+  void print_stats(std::ostream &out) const {
+    GpuAllocatorStats s = stats();
+    out << "gpu memory: " << s.allocation_count << " allocations in "
+        << s.block_count << " blocks, " << s.bytes_used << " bytes used, "
+        << s.bytes_allocated << " allocated, " << s.bytes_reserved
+        << " reserved, internal fragmentation "
+        << s.internal_fragmentation() * 100.0f
+        << "%, external fragmentation " << s.external_fragmentation() * 100.0f
+        << "%" << std::endl;
+  }
+
+  void destroy() {
+    std::lock_guard<std::mutex> lock(mutex);
+    for (auto &pool : pools) {
+      for (auto &block : pool.blocks) {
+        if (block.memory != VK_NULL_HANDLE) {
+          release_block(block);
+        }
+      }
+    }
+    pools.clear();
+  }
+
+private:
+  static VkDeviceSize range_size(uint32_t order) {
+    return GPU_ALLOCATOR_MIN_RANGE << order;
+  }
+
+  static uint32_t order_for_size(VkDeviceSize size) {
+    uint32_t order = 0;
+    while (range_size(order) < size) {
+      order++;
+    }
+    return order;
+  }
+
+  uint32_t find_pool(uint32_t memory_type, bool linear) {
+    if (buffer_image_granularity <= 1) {
+      linear = true;
+    }
+    for (uint32_t i = 0; i < pools.size(); i++) {
+      if (pools[i].memory_type == memory_type && pools[i].linear == linear) {
+        return i;
+      }
+    }
+    GpuMemoryPool pool{};
+    pool.memory_type = memory_type;
+    pool.linear = linear;
+    pools.push_back(pool);
+    return (uint32_t)pools.size() - 1;
+  }
+
+  uint32_t create_block(GpuMemoryPool &pool, VkDeviceSize min_size) {
+    if (live_block_count() >= max_allocation_count) {
+      throw std::runtime_error("exceeded maxMemoryAllocationCount");
+    }
+    GpuMemoryBlock block{};
+    block.size = block_size;
+    while (block.size < min_size) {
+      block.size <<= 1;
+    }
+    block.max_order = order_for_size(block.size);
+    block.free_lists.resize(block.max_order + 1);
+    block.free_lists[block.max_order].insert(0);
+    VkMemoryAllocateInfo alloc_info{};
+    alloc_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+    alloc_info.allocationSize = block.size;
+    alloc_info.memoryTypeIndex = pool.memory_type;
+    if (vkAllocateMemory(device, &alloc_info, nullptr, &block.memory) !=
+        VK_SUCCESS) {
+      throw std::runtime_error("failed to allocate device memory block");
+    }
+    if (mem_properties.memoryTypes[pool.memory_type].propertyFlags &
+        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) {
+      vkMapMemory(device, block.memory, 0, block.size, 0, &block.mapped);
+    }
+    for (uint32_t i = 0; i < pool.blocks.size(); i++) {
+      if (pool.blocks[i].memory == VK_NULL_HANDLE) {
+        pool.blocks[i] = std::move(block);
+        return i;
+      }
+    }
+    pool.blocks.push_back(std::move(block));
+    return (uint32_t)pool.blocks.size() - 1;
+  }
+
+  void release_block(GpuMemoryBlock &block) {
+    if (block.mapped) {
+      vkUnmapMemory(device, block.memory);
+    }
+    vkFreeMemory(device, block.memory, nullptr);
+    block = GpuMemoryBlock{};
+  }
+
+  bool allocate_range(GpuMemoryBlock &block, uint32_t order,
+                      VkDeviceSize &offset) {
+    uint32_t available = order;
+    while (available <= block.max_order && block.free_lists[available].empty()) {
+      available++;
+    }
+    if (available > block.max_order) {
+      return false;
+    }
+    auto it = block.free_lists[available].begin();
+    offset = *it;
+    block.free_lists[available].erase(it);
+    while (available > order) {
+      available--;
+      block.free_lists[available].insert(offset + range_size(available));
+    }
+    block.allocation_count++;
+    return true;
+  }
+
+  uint32_t live_block_count() const {
+    uint32_t count = 0;
+    for (const auto &pool : pools) {
+      for (const auto &block : pool.blocks) {
+        if (block.memory != VK_NULL_HANDLE) {
+          count++;
+        }
+      }
+    }
+    return count;
+  }
+
+  VkDevice device = VK_NULL_HANDLE;
+  VkPhysicalDeviceMemoryProperties mem_properties{};
+  VkDeviceSize block_size = GPU_ALLOCATOR_BLOCK_SIZE;
+  VkDeviceSize buffer_image_granularity = 1;
+  uint32_t max_allocation_count = 4096;
+  VkDeviceSize live_bytes = 0;
+  std::vector<GpuMemoryPool> pools;
+  mutable std::mutex mutex;
+};
@@ -0,0 +1,234 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Tracks a group of jobs. Jobs submitted with the same counter, including
+// ones spawned from inside a job of the group, complete it together.
+// on_complete then runs on the render thread, see
+// JobSystem::dispatch_completions().
+struct JobCounter {
+  std::function<void()> on_complete;
+  std::atomic<uint32_t> remaining{0};
+  // First exception thrown by a job of the group, rethrown on dispatch.
+  std::exception_ptr error;
+  std::mutex error_mutex;
+
+  bool done() const { return remaining.load() == 0; }
+};
+
+struct Job {
+  std::function<void()> run;
+  std::shared_ptr<JobCounter> counter;
+};
+
+struct JobQueue {
+  std::mutex mutex;
+  std::deque<Job> jobs;
+};
+
+// Work-stealing pool for background work such as asset loading. Every
+// worker owns a deque: it pushes and pops its own jobs at the back, so
+// spawned work stays hot in its cache, and idle workers steal the oldest job
+// from the front of another deque. Jobs submitted from other threads are
+// spread over the deques round robin. Completions are never run on the
+// workers, the render thread picks them up once per frame, so it only ever
+// sees finished results.
+class JobSystem {
+public:
+  void init(uint32_t thread_count) {
+    queues.clear();
+    for (uint32_t i = 0; i < thread_count; i++) {
+      queues.push_back(std::make_unique<JobQueue>());
+    }
+    for (uint32_t i = 0; i < thread_count; i++) {
+      threads.emplace_back(&JobSystem::worker_main, this, i);
+    }
+  }
+
+  void submit(std::function<void()> run,
+              std::shared_ptr<JobCounter> counter = nullptr) {
+    if (counter) {
+      counter->remaining++;
+    }
+    uint32_t queue = worker_system == this
+                         ? worker_index
+                         : next_queue++ % (uint32_t)queues.size();
+    // Counted before it is visible, a thief may take it right away.
+    {
+      std::lock_guard<std::mutex> lock(sleep_mutex);
+      queued++;
+    }
+    {
+      std::lock_guard<std::mutex> lock(queues[queue]->mutex);
+      queues[queue]->jobs.push_back({std::move(run), std::move(counter)});
+    }
+    sleep_cv.notify_one();
+  }
+
+  // Runs on_complete of every group finished since the last call. Render
+  // thread only.
+  void dispatch_completions() {
+    std::vector<std::shared_ptr<JobCounter>> finished;
+    std::exception_ptr ungrouped_error;
+    {
+      std::lock_guard<std::mutex> lock(completion_mutex);
+      finished.swap(completions);
+      std::swap(ungrouped_error, error);
+    }
+    if (ungrouped_error) {
+      std::rethrow_exception(ungrouped_error);
+    }
+    for (auto &counter : finished) {
+      if (counter->error) {
+        std::rethrow_exception(counter->error);
+      }
+      if (counter->on_complete) {
+        counter->on_complete();
+      }
+    }
+  }
+
+  // Helps out with queued jobs until the group finished, then dispatches
+  // completions. Render thread only.
+  void wait(const std::shared_ptr<JobCounter> &counter) {
+    while (!counter->done()) {
+      if (!run_one(0)) {
+        std::unique_lock<std::mutex> lock(completion_mutex);
+        completion_cv.wait_for(lock, std::chrono::milliseconds(1),
+                               [&counter] { return counter->done(); });
+      }
+    }
+    dispatch_completions();
+  }
+
+  // Waits for every queued and running job.
+  void wait_idle() {
+    while (true) {
+      if (run_one(0)) {
+        continue;
+      }
+      std::unique_lock<std::mutex> lock(completion_mutex);
+      if (queued.load() == 0 && running.load() == 0) {
+        break;
+      }
+      completion_cv.wait_for(lock, std::chrono::milliseconds(1));
+    }
+    dispatch_completions();
+  }
+
+  void destroy() {
+    {
+      std::lock_guard<std::mutex> lock(sleep_mutex);
+      stopping = true;
+    }
+    sleep_cv.notify_all();
+    for (auto &thread : threads) {
+      thread.join();
+    }
+    threads.clear();
+    queues.clear();
+  }
+
+private:
+  void worker_main(uint32_t index) {
+    worker_system = this;
+    worker_index = index;
+    while (true) {
+      if (run_one(index)) {
+        continue;
+      }
+      std::unique_lock<std::mutex> lock(sleep_mutex);
+      sleep_cv.wait(lock, [this] { return stopping || queued.load() > 0; });
+      if (stopping) {
+        return;
+      }
+    }
+  }
+
+  // Pops from the back of queue home, otherwise steals from the front of
+  // the others. Returns false if every queue was empty.
+  bool run_one(uint32_t home) {
+    Job job;
+    if (!pop(home, job)) {
+      return false;
+    }
+    try {
+      job.run();
+    } catch (...) {
+      if (job.counter) {
+        std::lock_guard<std::mutex> lock(job.counter->error_mutex);
+        if (!job.counter->error) {
+          job.counter->error = std::current_exception();
+        }
+      } else {
+        std::lock_guard<std::mutex> lock(completion_mutex);
+        error = std::current_exception();
+      }
+    }
+    if (job.counter && --job.counter->remaining == 0) {
+      std::lock_guard<std::mutex> lock(completion_mutex);
+      completions.push_back(std::move(job.counter));
+    }
+    {
+      std::lock_guard<std::mutex> lock(completion_mutex);
+      running--;
+    }
+    completion_cv.notify_all();
+    return true;
+  }
+
+  bool pop(uint32_t home, Job &job) {
+    uint32_t count = (uint32_t)queues.size();
+    for (uint32_t i = 0; i < count; i++) {
+      JobQueue &queue = *queues[(home + i) % count];
+      std::lock_guard<std::mutex> lock(queue.mutex);
+      if (queue.jobs.empty()) {
+        continue;
+      }
+      if (i == 0) {
+        job = std::move(queue.jobs.back());
+        queue.jobs.pop_back();
+      } else {
+        job = std::move(queue.jobs.front());
+        queue.jobs.pop_front();
+      }
+      // Counted as running before it stops being queued, so wait_idle()
+      // never sees neither.
+      running++;
+      queued--;
+      return true;
+    }
+    return false;
+  }
+
+  std::vector<std::unique_ptr<JobQueue>> queues;
+  std::vector<std::thread> threads;
+  std::atomic<uint32_t> next_queue{0};
+  std::atomic<uint32_t> queued{0};
+  std::atomic<uint32_t> running{0};
+  std::mutex sleep_mutex;
+  std::condition_variable sleep_cv;
+  bool stopping = false;
+  std::mutex completion_mutex;
+  std::condition_variable completion_cv;
+  std::vector<std::shared_ptr<JobCounter>> completions;
+  // Thrown by a job without a counter.
+  std::exception_ptr error;
+
+  static thread_local JobSystem *worker_system;
+  static thread_local uint32_t worker_index;
+};
+
+inline thread_local JobSystem *JobSystem::worker_system = nullptr;
+inline thread_local uint32_t JobSystem::worker_index = 0;
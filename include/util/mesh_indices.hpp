@@ -0,0 +1,135 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include <vulkan/vulkan_core.h>
+
+// Post transform cache size the index order is tuned for. Tipsify is not
+// sensitive to the exact value, small caches of current GPUs are 16-32.
+const uint32_t MESH_VERTEX_CACHE_SIZE = 16;
+
+// Index buffer contents in the smallest type that holds every index.
+struct MeshIndexData {
+  VkIndexType type = VK_INDEX_TYPE_UINT16;
+  uint32_t count = 0;
+  std::vector<uint8_t> bytes;
+
+  VkDeviceSize size() const { return bytes.size(); }
+};
+
+static MeshIndexData pack_mesh_indices(const std::vector<uint32_t> &indices) {
+  MeshIndexData data;
+  data.count = static_cast<uint32_t>(indices.size());
+  uint32_t max_index = 0;
+  for (uint32_t index : indices) {
+    max_index = std::max(max_index, index);
+  }
+  if (max_index <= UINT16_MAX) {
+    data.type = VK_INDEX_TYPE_UINT16;
+    std::vector<uint16_t> narrow(indices.begin(), indices.end());
+    data.bytes.resize(narrow.size() * sizeof(uint16_t));
+    memcpy(data.bytes.data(), narrow.data(), data.bytes.size());
+  } else {
+    data.type = VK_INDEX_TYPE_UINT32;
+    data.bytes.resize(indices.size() * sizeof(uint32_t));
+    memcpy(data.bytes.data(), indices.data(), data.bytes.size());
+  }
+  return data;
+}
+
+// Reorders the triangles of indices[first, first + count) for post
+// transform cache locality with Tipsify (Sander, Nehab and Barczak, "Fast
+// Triangle Reordering for Vertex Locality and Reduced Overdraw"). Fans
+// around one vertex at a time and moves on to the neighbour that is still
+// in the cache and would stay there, falling back to recently used vertices
+// and then to input order. Linear in the number of triangles.
+static void optimize_vertex_cache(std::vector<uint32_t> &indices,
+                                  uint32_t first, uint32_t count,
+                                  uint32_t cache_size = MESH_VERTEX_CACHE_SIZE) {
+  const uint32_t *in = indices.data() + first;
+  uint32_t triangle_count = count / 3;
+  if (triangle_count == 0) {
+    return;
+  }
+  uint32_t vertex_count = *std::max_element(in, in + count) + 1;
+  // Triangles using each vertex, as offsets into one array.
+  std::vector<uint32_t> live(vertex_count, 0);
+  for (uint32_t i = 0; i < triangle_count * 3; i++) {
+    live[in[i]]++;
+  }
+  std::vector<uint32_t> adjacency_offsets(vertex_count + 1, 0);
+  for (uint32_t v = 0; v < vertex_count; v++) {
+    adjacency_offsets[v + 1] = adjacency_offsets[v] + live[v];
+  }
+  std::vector<uint32_t> adjacency(adjacency_offsets[vertex_count]);
+  std::vector<uint32_t> fill(adjacency_offsets.begin(),
+                             adjacency_offsets.end() - 1);
+  for (uint32_t i = 0; i < triangle_count * 3; i++) {
+    adjacency[fill[in[i]]++] = i / 3;
+  }
+
+  const uint32_t none = UINT32_MAX;
+  std::vector<uint32_t> cache_time(vertex_count, 0);
+  std::vector<bool> emitted(triangle_count, false);
+  std::vector<uint32_t> dead_end;
+  std::vector<uint32_t> candidates;
+  std::vector<uint32_t> out;
+  out.reserve(triangle_count * 3);
+  uint32_t time = cache_size + 1;
+  uint32_t cursor = 0;
+  uint32_t fan = in[0];
+  while (fan != none) {
+    candidates.clear();
+    for (uint32_t a = adjacency_offsets[fan]; a < adjacency_offsets[fan + 1];
+         a++) {
+      uint32_t triangle = adjacency[a];
+      if (emitted[triangle]) {
+        continue;
+      }
+      emitted[triangle] = true;
+      for (uint32_t k = 0; k < 3; k++) {
+        uint32_t v = in[triangle * 3 + k];
+        out.push_back(v);
+        dead_end.push_back(v);
+        candidates.push_back(v);
+        live[v]--;
+        if (time - cache_time[v] > cache_size) {
+          cache_time[v] = time++;
+        }
+      }
+    }
+    // Prefer the oldest candidate that survives its own fan in the cache.
+    fan = none;
+    uint32_t best_priority = 0;
+    for (uint32_t v : candidates) {
+      if (live[v] == 0) {
+        continue;
+      }
+      uint32_t priority = 1;
+      if (time - cache_time[v] + 2 * live[v] <= cache_size) {
+        priority += time - cache_time[v];
+      }
+      if (priority > best_priority) {
+        best_priority = priority;
+        fan = v;
+      }
+    }
+    while (fan == none && !dead_end.empty()) {
+      uint32_t v = dead_end.back();
+      dead_end.pop_back();
+      if (live[v] > 0) {
+        fan = v;
+      }
+    }
+    while (fan == none && cursor < vertex_count) {
+      if (live[cursor] > 0) {
+        fan = cursor;
+      }
+      cursor++;
+    }
+  }
+  std::copy(out.begin(), out.end(), indices.begin() + first);
+}
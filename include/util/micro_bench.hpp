@@ -0,0 +1,146 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <ctime>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// A benchmark repeats its iteration until this much time passed, a single
+// iteration slower than that is enough.
+const double MICRO_BENCH_MIN_SECONDS = 0.5;
+const uint64_t MICRO_BENCH_MAX_ITERATIONS = 1000000000;
+
+struct MicroBenchResult {
+  std::string name;
+  uint64_t iterations;
+  // Nanoseconds per iteration.
+  double real_time;
+  double cpu_time;
+  // 0 when the benchmark counts no bytes or items.
+  double bytes_per_second;
+  double items_per_second;
+};
+
+// Times repeated iterations of a piece of code and writes the results in
+// the JSON format of Google Benchmark, so its tools compare two runs.
+// Iterations run in batches that grow until one takes long enough, which
+// keeps the clock reads out of short iterations. cpu_time is the calling
+// thread's alone, as in Google Benchmark, work on other threads or the GPU
+// shows in real_time only.
+class MicroBench {
+public:
+  // bytes and items are what one iteration processes, 0 for neither.
+  void run(const std::string &name, double bytes, double items,
+           const std::function<void()> &iteration) {
+    // Untimed, first touches of memory and caches are not what is measured.
+    iteration();
+    uint64_t batch = 1;
+    uint64_t iterations = 0;
+    double real_seconds = 0.0;
+    double cpu_seconds = 0.0;
+    while (real_seconds < MICRO_BENCH_MIN_SECONDS &&
+           iterations < MICRO_BENCH_MAX_ITERATIONS) {
+      auto real_start = std::chrono::steady_clock::now();
+      double cpu_start = thread_cpu_seconds();
+      for (uint64_t i = 0; i < batch; i++) {
+        iteration();
+      }
+      cpu_seconds += thread_cpu_seconds() - cpu_start;
+      real_seconds += std::chrono::duration<double>(
+                          std::chrono::steady_clock::now() - real_start)
+                          .count();
+      iterations += batch;
+      batch *= 2;
+    }
+    MicroBenchResult result{};
+    result.name = name;
+    result.iterations = iterations;
+    result.real_time = real_seconds * 1e9 / iterations;
+    result.cpu_time = cpu_seconds * 1e9 / iterations;
+    result.bytes_per_second = bytes * iterations / real_seconds;
+    result.items_per_second = items * iterations / real_seconds;
+    results.push_back(result);
+    std::cout << name << ": " << result.real_time << " ns, cpu "
+              << result.cpu_time << " ns, " << iterations << " iterations";
+    if (bytes > 0) {
+      std::cout << ", " << result.bytes_per_second / (1 << 20) << " MiB/s";
+    }
+    if (items > 0) {
+      std::cout << ", " << result.items_per_second << " items/s";
+    }
+    std::cout << std::endl;
+  }
+
+  // context holds key and value pairs about the run next to the ones
+  // Google Benchmark writes itself.
+  void write_json(
+      const std::string &filename,
+      const std::vector<std::pair<std::string, std::string>> &context) const {
+    std::ofstream out(filename);
+    if (!out) {
+      throw std::runtime_error("failed to open " + filename);
+    }
+    char date[32];
+    time_t now = time(nullptr);
+    strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S%z", localtime(&now));
+    out << "{\n  \"context\": {\n";
+    out << "    \"date\": " << quote(date) << ",\n";
+    out << "    \"num_cpus\": " << std::thread::hardware_concurrency()
+        << ",\n";
+#ifdef NDEBUG
+    out << "    \"library_build_type\": \"release\"";
+#else
+    out << "    \"library_build_type\": \"debug\"";
+#endif
+    for (const auto &entry : context) {
+      out << ",\n    " << quote(entry.first) << ": " << quote(entry.second);
+    }
+    out << "\n  },\n  \"benchmarks\": [";
+    for (size_t i = 0; i < results.size(); i++) {
+      const MicroBenchResult &result = results[i];
+      out << (i > 0 ? ",\n" : "\n") << "    {\n";
+      out << "      \"name\": " << quote(result.name) << ",\n";
+      out << "      \"run_name\": " << quote(result.name) << ",\n";
+      out << "      \"run_type\": \"iteration\",\n";
+      out << "      \"iterations\": " << result.iterations << ",\n";
+      out << "      \"real_time\": " << result.real_time << ",\n";
+      out << "      \"cpu_time\": " << result.cpu_time << ",\n";
+      out << "      \"time_unit\": \"ns\"";
+      if (result.bytes_per_second > 0) {
+        out << ",\n      \"bytes_per_second\": " << result.bytes_per_second;
+      }
+      if (result.items_per_second > 0) {
+        out << ",\n      \"items_per_second\": " << result.items_per_second;
+      }
+      out << "\n    }";
+    }
+    out << "\n  ]\n}\n";
+  }
+
+private:
+  static double thread_cpu_seconds() {
+    timespec time;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &time);
+    return time.tv_sec + time.tv_nsec * 1e-9;
+  }
+
+  static std::string quote(const std::string &text) {
+    std::string quoted = "\"";
+    for (char c : text) {
+      if (c == '"' || c == '\\') {
+        quoted += '\\';
+      }
+      quoted += (unsigned char)c < 0x20 ? ' ' : c;
+    }
+    return quoted + "\"";
+  }
+
+  std::vector<MicroBenchResult> results;
+};
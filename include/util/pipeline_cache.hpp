@@ -0,0 +1,72 @@
+#pragma once
+
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <vulkan/vulkan_core.h>
+
+#include <util/shader_util.hpp>
+
+// Drivers reject foreign cache blobs on their own, but validating the header
+// up front lets a stale cache from another GPU or driver be dropped quietly.
+static bool pipeline_cache_compatible(
+    const std::vector<char>& data,
+    const VkPhysicalDeviceProperties& properties) {
+  VkPipelineCacheHeaderVersionOne header;
+  if (data.size() < sizeof(header)) {
+    return false;
+  }
+  memcpy(&header, data.data(), sizeof(header));
+  return header.headerSize >= sizeof(header) &&
+         header.headerSize <= data.size() &&
+         header.headerVersion == VK_PIPELINE_CACHE_HEADER_VERSION_ONE &&
+         header.vendorID == properties.vendorID &&
+         header.deviceID == properties.deviceID &&
+         memcmp(header.pipelineCacheUUID, properties.pipelineCacheUUID,
+                VK_UUID_SIZE) == 0;
+}
+
+static VkPipelineCache load_pipeline_cache(VkPhysicalDevice physical_device,
+                                           VkDevice device,
+                                           const std::string& filename) {
+  std::vector<char> data;
+  try {
+    data = read_file(filename);
+  } catch (const std::runtime_error&) {
+    // No cache yet, first launch.
+  }
+  VkPhysicalDeviceProperties properties;
+  vkGetPhysicalDeviceProperties(physical_device, &properties);
+  if (!data.empty() && !pipeline_cache_compatible(data, properties)) {
+    std::cout << "discarding incompatible pipeline cache" << std::endl;
+    data.clear();
+  }
+  VkPipelineCacheCreateInfo create_info{};
+  create_info.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+  create_info.initialDataSize = data.size();
+  create_info.pInitialData = data.empty() ? nullptr : data.data();
+  VkPipelineCache cache;
+  if (vkCreatePipelineCache(device, &create_info, nullptr, &cache) !=
+      VK_SUCCESS) {
+    throw std::runtime_error("failed to create pipeline cache");
+  }
+  return cache;
+}
+
+static void save_pipeline_cache(VkDevice device, VkPipelineCache cache,
+                                const std::string& filename) {
+  size_t size = 0;
+  if (vkGetPipelineCacheData(device, cache, &size, nullptr) != VK_SUCCESS ||
+      size == 0) {
+    return;
+  }
+  std::vector<char> data(size);
+  if (vkGetPipelineCacheData(device, cache, &size, data.data()) !=
+      VK_SUCCESS) {
+    return;
+  }
+  write_file(filename, data.data(), size);
+}
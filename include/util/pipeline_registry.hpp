@@ -0,0 +1,540 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <vulkan/vulkan_core.h>
+
+#include <util/asset_archive.hpp>
+
+// Specialization constants of one stage, data holds the values the entries
+// point into.
+struct ShaderSpecialization {
+  std::vector<VkSpecializationMapEntry> entries;
+  std::vector<uint8_t> data;
+
+  bool operator==(const ShaderSpecialization &other) const {
+    return entries.size() == other.entries.size() &&
+           memcmp(entries.data(), other.entries.data(),
+                  entries.size() * sizeof(entries[0])) == 0 &&
+           data == other.data;
+  }
+
+  // nullptr without constants, so the stage keeps its defaults.
+  const VkSpecializationInfo *info(VkSpecializationInfo &info) const {
+    if (entries.empty()) {
+      return nullptr;
+    }
+    info.mapEntryCount = static_cast<uint32_t>(entries.size());
+    info.pMapEntries = entries.data();
+    info.dataSize = data.size();
+    info.pData = data.data();
+    return &info;
+  }
+};
+
+// Everything that makes two graphics pipelines different. Viewport and
+// scissor are dynamic state, a new extent needs no new pipeline.
+struct GraphicsPipelineDesc {
+  // Names of SPIR-V blobs in the registry's asset archive.
+  std::string vert_shader;
+  std::string frag_shader;
+  ShaderSpecialization vert_specialization;
+  ShaderSpecialization frag_specialization;
+  std::vector<VkVertexInputBindingDescription> bindings;
+  std::vector<VkVertexInputAttributeDescription> attributes;
+  VkPrimitiveTopology topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+  VkPolygonMode polygon_mode = VK_POLYGON_MODE_FILL;
+  VkCullModeFlags cull_mode = VK_CULL_MODE_BACK_BIT;
+  VkFrontFace front_face = VK_FRONT_FACE_CLOCKWISE;
+  bool blend_enable = false;
+  VkBlendFactor src_blend_factor = VK_BLEND_FACTOR_SRC_ALPHA;
+  VkBlendFactor dst_blend_factor = VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA;
+  bool depth_test = false;
+  bool depth_write = false;
+  VkCompareOp depth_compare_op = VK_COMPARE_OP_LESS_OR_EQUAL;
+  VkPipelineLayout layout = VK_NULL_HANDLE;
+  // VK_NULL_HANDLE for dynamic rendering, which only needs the color
+  // attachment format.
+  VkRenderPass render_pass = VK_NULL_HANDLE;
+  uint32_t subpass = 0;
+  VkFormat color_format = VK_FORMAT_UNDEFINED;
+  // VK_FORMAT_UNDEFINED without a depth attachment.
+  VkFormat depth_format = VK_FORMAT_UNDEFINED;
+
+  bool operator==(const GraphicsPipelineDesc &other) const {
+    return vert_shader == other.vert_shader &&
+           frag_shader == other.frag_shader &&
+           vert_specialization == other.vert_specialization &&
+           frag_specialization == other.frag_specialization &&
+           bindings.size() == other.bindings.size() &&
+           memcmp(bindings.data(), other.bindings.data(),
+                  bindings.size() * sizeof(bindings[0])) == 0 &&
+           attributes.size() == other.attributes.size() &&
+           memcmp(attributes.data(), other.attributes.data(),
+                  attributes.size() * sizeof(attributes[0])) == 0 &&
+           topology == other.topology && polygon_mode == other.polygon_mode &&
+           cull_mode == other.cull_mode && front_face == other.front_face &&
+           blend_enable == other.blend_enable &&
+           src_blend_factor == other.src_blend_factor &&
+           dst_blend_factor == other.dst_blend_factor &&
+           depth_test == other.depth_test &&
+           depth_write == other.depth_write &&
+           depth_compare_op == other.depth_compare_op &&
+           layout == other.layout && render_pass == other.render_pass &&
+           subpass == other.subpass && color_format == other.color_format &&
+           depth_format == other.depth_format;
+  }
+};
+
+// FNV-1a over the raw bytes of each field.
+struct PipelineHasher {
+  uint64_t value = 14695981039346656037ull;
+
+  void add(const void *data, size_t size) {
+    const unsigned char *bytes = (const unsigned char *)data;
+    for (size_t i = 0; i < size; i++) {
+      value = (value ^ bytes[i]) * 1099511628211ull;
+    }
+  }
+
+  template <typename T> void add(const T &field) { add(&field, sizeof(T)); }
+};
+
+struct GraphicsPipelineDescHash {
+  size_t operator()(const GraphicsPipelineDesc &desc) const {
+    PipelineHasher hasher;
+    hasher.add(desc.vert_shader.data(), desc.vert_shader.size());
+    hasher.add(desc.frag_shader.data(), desc.frag_shader.size());
+    for (const auto *specialization :
+         {&desc.vert_specialization, &desc.frag_specialization}) {
+      hasher.add(specialization->entries.data(),
+                 specialization->entries.size() *
+                     sizeof(specialization->entries[0]));
+      hasher.add(specialization->data.data(), specialization->data.size());
+    }
+    hasher.add(desc.bindings.data(),
+               desc.bindings.size() * sizeof(desc.bindings[0]));
+    hasher.add(desc.attributes.data(),
+               desc.attributes.size() * sizeof(desc.attributes[0]));
+    hasher.add(desc.topology);
+    hasher.add(desc.polygon_mode);
+    hasher.add(desc.cull_mode);
+    hasher.add(desc.front_face);
+    hasher.add((uint32_t)desc.blend_enable);
+    hasher.add(desc.src_blend_factor);
+    hasher.add(desc.dst_blend_factor);
+    hasher.add((uint32_t)desc.depth_test);
+    hasher.add((uint32_t)desc.depth_write);
+    hasher.add(desc.depth_compare_op);
+    hasher.add(desc.layout);
+    hasher.add(desc.render_pass);
+    hasher.add(desc.subpass);
+    hasher.add(desc.color_format);
+    hasher.add(desc.depth_format);
+    return (size_t)hasher.value;
+  }
+};
+
+struct PipelineEntry {
+  GraphicsPipelineDesc desc;
+  std::atomic<VkPipeline> pipeline{VK_NULL_HANDLE};
+  // Used until pipeline is compiled, or for good if compiling failed.
+  PipelineEntry *fallback = nullptr;
+  // Bumped by every recompile update_shader() queues, a compile started
+  // before the last bump read older code. Guarded by the registry's mutex.
+  uint64_t generation = 0;
+};
+
+// Handles stay valid until the registry is destroyed.
+typedef PipelineEntry *PipelineHandle;
+
+// Deduplicates pipeline requests by description and compiles missing ones
+// on background threads. get() never blocks: while a variant is still
+// compiling it resolves to the fallback given at request time.
+class PipelineRegistry {
+public:
+  // Shader code is read from assets, which has to stay open until the
+  // registry is destroyed.
+  void init(VkDevice device, VkPipelineCache cache, const AssetArchive &assets,
+            uint32_t thread_count) {
+    this->device = device;
+    this->cache = cache;
+    this->assets = &assets;
+    for (uint32_t i = 0; i < thread_count; i++) {
+      threads.emplace_back(&PipelineRegistry::compile_main, this);
+    }
+  }
+
+  // Compiles on the calling thread, for pipelines that have no fallback.
+  PipelineHandle request_blocking(const GraphicsPipelineDesc &desc) {
+    bool created;
+    PipelineHandle handle = find_or_insert(desc, nullptr, created);
+    if (created) {
+      try {
+        install(handle, 0, compile(desc));
+      } catch (...) {
+        finish_compile();
+        throw;
+      }
+      finish_compile();
+    }
+    // Waits for the compile of an earlier request, or for the recompile a
+    // shader update queued while this one ran. If the compile for an
+    // earlier request failed, any fallback it was given does not stand in
+    // for a blocking request.
+    wait(handle);
+    if (!is_ready(handle)) {
+      throw std::runtime_error("failed to create graphics pipeline");
+    }
+    return handle;
+  }
+
+  PipelineHandle request(const GraphicsPipelineDesc &desc,
+                         PipelineHandle fallback) {
+    bool created;
+    PipelineHandle handle = find_or_insert(desc, fallback, created);
+    if (created) {
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        queue.push_back(handle);
+      }
+      queue_cv.notify_one();
+    }
+    return handle;
+  }
+
+  VkPipeline get(PipelineHandle handle) const {
+    for (PipelineEntry *entry = handle; entry; entry = entry->fallback) {
+      VkPipeline pipeline = entry->pipeline.load(std::memory_order_acquire);
+      if (pipeline != VK_NULL_HANDLE) {
+        return pipeline;
+      }
+    }
+    return VK_NULL_HANDLE;
+  }
+
+  bool is_ready(PipelineHandle handle) const {
+    return handle->pipeline.load(std::memory_order_acquire) != VK_NULL_HANDLE;
+  }
+
+  // Replaces the code of a shader and recompiles every pipeline using it in
+  // the background. get() returns the old pipeline until its recompile
+  // finished, take_retired() hands it out afterwards.
+  void update_shader(const std::string &name, std::vector<uint32_t> code) {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      shader_overrides[name] =
+          std::make_shared<const std::vector<uint32_t>>(std::move(code));
+      for (auto &entry : entries) {
+        if (entry->desc.vert_shader == name ||
+            entry->desc.frag_shader == name) {
+          entry->generation++;
+          queue.push_back(entry.get());
+          pending++;
+        }
+      }
+    }
+    queue_cv.notify_all();
+  }
+
+  // Pipelines replaced by recompiles, recorded frames may still use them.
+  // The caller destroys them once those completed.
+  std::vector<VkPipeline> take_retired() {
+    std::lock_guard<std::mutex> lock(mutex);
+    std::vector<VkPipeline> pipelines;
+    pipelines.swap(retired);
+    return pipelines;
+  }
+
+  // Blocks until every queued compile finished.
+  void wait_idle() {
+    std::unique_lock<std::mutex> lock(mutex);
+    done_cv.wait(lock, [this] { return pending == 0; });
+  }
+
+  void destroy() {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      stopping = true;
+      pending -= (uint32_t)queue.size();
+      queue.clear();
+    }
+    queue_cv.notify_all();
+    for (auto &thread : threads) {
+      thread.join();
+    }
+    threads.clear();
+    for (auto &entry : entries) {
+      VkPipeline pipeline = entry->pipeline.load();
+      if (pipeline != VK_NULL_HANDLE) {
+        vkDestroyPipeline(device, pipeline, nullptr);
+      }
+    }
+    for (VkPipeline pipeline : take_retired()) {
+      vkDestroyPipeline(device, pipeline, nullptr);
+    }
+    entries.clear();
+    lookup.clear();
+  }
+
+private:
+  PipelineHandle find_or_insert(const GraphicsPipelineDesc &desc,
+                                PipelineHandle fallback, bool &created) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = lookup.find(desc);
+    if (it != lookup.end()) {
+      created = false;
+      return it->second;
+    }
+    entries.push_back(std::make_unique<PipelineEntry>());
+    PipelineHandle handle = entries.back().get();
+    handle->desc = desc;
+    handle->fallback = fallback;
+    lookup[desc] = handle;
+    // Counted from insertion so waiters never see a gap before the compile
+    // starts.
+    pending++;
+    created = true;
+    return handle;
+  }
+
+  void wait(PipelineHandle handle) {
+    std::unique_lock<std::mutex> lock(mutex);
+    done_cv.wait(lock, [this, handle] {
+      return is_ready(handle) || pending == 0;
+    });
+  }
+
+  void compile_main() {
+    while (true) {
+      PipelineHandle handle;
+      uint64_t generation;
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        queue_cv.wait(lock, [this] { return stopping || !queue.empty(); });
+        if (stopping) {
+          return;
+        }
+        handle = queue.front();
+        queue.pop_front();
+        generation = handle->generation;
+      }
+      try {
+        install(handle, generation, compile(handle->desc));
+      } catch (const std::exception &e) {
+        std::cerr << "pipeline compile failed, keeping fallback: " << e.what()
+                  << std::endl;
+      }
+      finish_compile();
+    }
+  }
+
+  // Two compiles of an entry can run at once when its shaders change in
+  // quick succession and finish in either order. Only a pipeline from the
+  // entry's latest generation replaces the current one, older ones were
+  // never handed out and go right away.
+  void install(PipelineHandle handle, uint64_t generation,
+               VkPipeline pipeline) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (generation != handle->generation) {
+      vkDestroyPipeline(device, pipeline, nullptr);
+      return;
+    }
+    VkPipeline old =
+        handle->pipeline.exchange(pipeline, std::memory_order_acq_rel);
+    if (old != VK_NULL_HANDLE) {
+      retired.push_back(old);
+    }
+  }
+
+  void finish_compile() {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      pending--;
+    }
+    done_cv.notify_all();
+  }
+
+  // Straight from the mapped archive, blobs are page aligned, unless the
+  // shader was replaced by update_shader().
+  VkShaderModule create_shader_module(const std::string &name) {
+    std::shared_ptr<const std::vector<uint32_t>> override_code;
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      auto it = shader_overrides.find(name);
+      if (it != shader_overrides.end()) {
+        override_code = it->second;
+      }
+    }
+    VkShaderModuleCreateInfo create_info{};
+    create_info.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+    if (override_code) {
+      create_info.codeSize = override_code->size() * sizeof(uint32_t);
+      create_info.pCode = override_code->data();
+    } else {
+      AssetBlob code = assets->find(name, ASSET_SPIRV);
+      create_info.codeSize = code.size;
+      create_info.pCode = reinterpret_cast<const uint32_t *>(code.data);
+    }
+    VkShaderModule shader_module;
+    if (vkCreateShaderModule(device, &create_info, nullptr, &shader_module) !=
+        VK_SUCCESS) {
+      throw std::runtime_error("failed to create shader module");
+    }
+    return shader_module;
+  }
+
+  VkPipeline compile(const GraphicsPipelineDesc &desc) {
+    VkShaderModule vert_shader = create_shader_module(desc.vert_shader);
+    VkShaderModule frag_shader = create_shader_module(desc.frag_shader);
+    VkPipelineShaderStageCreateInfo vert_create_info{};
+    vert_create_info.sType =
+        VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    vert_create_info.stage = VK_SHADER_STAGE_VERTEX_BIT;
+    vert_create_info.module = vert_shader;
+    vert_create_info.pName = "main";
+    VkSpecializationInfo vert_specialization{};
+    vert_create_info.pSpecializationInfo =
+        desc.vert_specialization.info(vert_specialization);
+    VkPipelineShaderStageCreateInfo frag_create_info{};
+    frag_create_info.sType =
+        VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    frag_create_info.stage = VK_SHADER_STAGE_FRAGMENT_BIT;
+    frag_create_info.module = frag_shader;
+    frag_create_info.pName = "main";
+    VkSpecializationInfo frag_specialization{};
+    frag_create_info.pSpecializationInfo =
+        desc.frag_specialization.info(frag_specialization);
+    VkPipelineShaderStageCreateInfo shader_stages[] = {vert_create_info,
+                                                       frag_create_info};
+    VkPipelineDynamicStateCreateInfo dynamic_state{};
+    dynamic_state.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
+    VkDynamicState dynamic_states[] = {VK_DYNAMIC_STATE_VIEWPORT,
+                                       VK_DYNAMIC_STATE_SCISSOR};
+    dynamic_state.dynamicStateCount = 2;
+    dynamic_state.pDynamicStates = dynamic_states;
+    VkPipelineVertexInputStateCreateInfo vertex_input_info{};
+    vertex_input_info.sType =
+        VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+    vertex_input_info.vertexBindingDescriptionCount =
+        static_cast<uint32_t>(desc.bindings.size());
+    vertex_input_info.pVertexBindingDescriptions = desc.bindings.data();
+    vertex_input_info.vertexAttributeDescriptionCount =
+        static_cast<uint32_t>(desc.attributes.size());
+    vertex_input_info.pVertexAttributeDescriptions = desc.attributes.data();
+    VkPipelineInputAssemblyStateCreateInfo input_assembly{};
+    input_assembly.sType =
+        VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
+    input_assembly.topology = desc.topology;
+    input_assembly.primitiveRestartEnable = VK_FALSE;
+    VkPipelineViewportStateCreateInfo viewport_state{};
+    viewport_state.sType =
+        VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
+    viewport_state.viewportCount = 1;
+    viewport_state.scissorCount = 1;
+    VkPipelineRasterizationStateCreateInfo rasterizer{};
+    rasterizer.sType =
+        VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
+    rasterizer.depthClampEnable = VK_FALSE;
+    rasterizer.rasterizerDiscardEnable = VK_FALSE;
+    rasterizer.polygonMode = desc.polygon_mode;
+    rasterizer.lineWidth = 1.0f;
+    rasterizer.cullMode = desc.cull_mode;
+    rasterizer.frontFace = desc.front_face;
+    rasterizer.depthBiasEnable = VK_FALSE;
+    VkPipelineMultisampleStateCreateInfo multisampling{};
+    multisampling.sType =
+        VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
+    multisampling.sampleShadingEnable = VK_FALSE;
+    multisampling.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
+    VkPipelineDepthStencilStateCreateInfo depth_stencil{};
+    depth_stencil.sType =
+        VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
+    depth_stencil.depthTestEnable = desc.depth_test;
+    depth_stencil.depthWriteEnable = desc.depth_write;
+    depth_stencil.depthCompareOp = desc.depth_compare_op;
+    depth_stencil.depthBoundsTestEnable = VK_FALSE;
+    depth_stencil.stencilTestEnable = VK_FALSE;
+    VkPipelineColorBlendAttachmentState color_blend_attachment{};
+    color_blend_attachment.colorWriteMask =
+        VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT |
+        VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
+    color_blend_attachment.blendEnable = desc.blend_enable;
+    color_blend_attachment.srcColorBlendFactor = desc.src_blend_factor;
+    color_blend_attachment.dstColorBlendFactor = desc.dst_blend_factor;
+    color_blend_attachment.colorBlendOp = VK_BLEND_OP_ADD;
+    color_blend_attachment.srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE;
+    color_blend_attachment.dstAlphaBlendFactor = VK_BLEND_FACTOR_ZERO;
+    color_blend_attachment.alphaBlendOp = VK_BLEND_OP_ADD;
+    VkPipelineColorBlendStateCreateInfo color_blending{};
+    color_blending.sType =
+        VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
+    color_blending.logicOpEnable = VK_FALSE;
+    color_blending.attachmentCount = 1;
+    color_blending.pAttachments = &color_blend_attachment;
+    VkPipelineRenderingCreateInfoKHR rendering_info{};
+    rendering_info.sType = VK_STRUCTURE_TYPE_PIPELINE_RENDERING_CREATE_INFO_KHR;
+    rendering_info.colorAttachmentCount = 1;
+    rendering_info.pColorAttachmentFormats = &desc.color_format;
+    rendering_info.depthAttachmentFormat = desc.depth_format;
+    VkGraphicsPipelineCreateInfo pipeline_info{};
+    pipeline_info.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+    if (desc.render_pass == VK_NULL_HANDLE) {
+      pipeline_info.pNext = &rendering_info;
+    }
+    pipeline_info.stageCount = 2;
+    pipeline_info.pStages = shader_stages;
+    pipeline_info.pVertexInputState = &vertex_input_info;
+    pipeline_info.pInputAssemblyState = &input_assembly;
+    pipeline_info.pViewportState = &viewport_state;
+    pipeline_info.pRasterizationState = &rasterizer;
+    pipeline_info.pMultisampleState = &multisampling;
+    pipeline_info.pDepthStencilState = &depth_stencil;
+    pipeline_info.pColorBlendState = &color_blending;
+    pipeline_info.pDynamicState = &dynamic_state;
+    pipeline_info.layout = desc.layout;
+    pipeline_info.renderPass = desc.render_pass;
+    pipeline_info.subpass = desc.subpass;
+    pipeline_info.basePipelineHandle = VK_NULL_HANDLE;
+    pipeline_info.basePipelineIndex = -1;
+    VkPipeline pipeline;
+    VkResult result = vkCreateGraphicsPipelines(device, cache, 1, &pipeline_info,
+                                                nullptr, &pipeline);
+    vkDestroyShaderModule(device, vert_shader, nullptr);
+    vkDestroyShaderModule(device, frag_shader, nullptr);
+    if (result != VK_SUCCESS) {
+      throw std::runtime_error("failed to create graphics pipeline");
+    }
+    return pipeline;
+  }
+
+  VkDevice device = VK_NULL_HANDLE;
+  VkPipelineCache cache = VK_NULL_HANDLE;
+  const AssetArchive *assets = nullptr;
+  std::mutex mutex;
+  std::condition_variable queue_cv;
+  std::condition_variable done_cv;
+  std::deque<PipelineHandle> queue;
+  uint32_t pending = 0;
+  bool stopping = false;
+  std::vector<std::thread> threads;
+  std::vector<std::unique_ptr<PipelineEntry>> entries;
+  std::unordered_map<std::string, std::shared_ptr<const std::vector<uint32_t>>>
+      shader_overrides;
+  std::vector<VkPipeline> retired;
+  std::unordered_map<GraphicsPipelineDesc, PipelineHandle,
+                     GraphicsPipelineDescHash>
+      lookup;
+};
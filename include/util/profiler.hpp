@@ -0,0 +1,556 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <vulkan/vulkan_core.h>
+
+const uint32_t PROFILER_MAX_GPU_SCOPES = 32;
+const uint32_t PROFILER_RING_SIZE = 256;
+const uint32_t PROFILER_HISTORY_SIZE = 8192;
+
+// Calls of the global operator new, counted by the replacement main.cpp
+// installs. Frames in steady state are expected to make none.
+inline std::atomic<uint64_t> heap_allocation_count{0};
+
+enum ProfilePhase {
+  PROFILE_WAIT_FRAME,
+  PROFILE_PRESENT_WAIT,
+  PROFILE_ACQUIRE,
+  PROFILE_RECORD,
+  PROFILE_SUBMIT,
+  PROFILE_PRESENT,
+  PROFILE_PHASE_COUNT,
+};
+
+static const char *profile_phase_name(uint32_t phase) {
+  static const char *names[PROFILE_PHASE_COUNT] = {
+      "wait frame", "present wait", "acquire", "record", "submit", "present",
+  };
+  return names[phase];
+}
+
+// Times are in microseconds since the profiler was created. GPU times are
+// moved onto the CPU timeline by pinning the first GPU timestamp ever read
+// to the CPU start of its frame, good enough to eyeball a trace.
+struct FrameTiming {
+  uint64_t frame;
+  double begin_us;
+  double frame_ms;
+  double phase_begin_us[PROFILE_PHASE_COUNT];
+  double phase_ms[PROFILE_PHASE_COUNT];
+  bool gpu_valid;
+  // First scope begin to last scope end.
+  double gpu_frame_ms;
+  double gpu_begin_us[PROFILER_MAX_GPU_SCOPES];
+  double gpu_ms[PROFILER_MAX_GPU_SCOPES];
+  // Pixels of the measured pass, zero if the frame has no fragment
+  // statistics.
+  uint32_t pixel_count;
+  bool overdraw_valid;
+  // Fragment shader invocations per pixel, 1 means every pixel was shaded
+  // exactly once.
+  double overdraw;
+  // Heap allocations of any thread between begin_frame() and end_frame().
+  uint64_t heap_allocations;
+
+  // Time the CPU spent on the frame, without waiting for the GPU.
+  double cpu_ms() const {
+    double ms = 0.0;
+    for (uint32_t phase = PROFILE_ACQUIRE; phase < PROFILE_PHASE_COUNT;
+         phase++) {
+      ms += phase_ms[phase];
+    }
+    return ms;
+  }
+};
+
+struct ProfileSummary {
+  uint32_t frame_count = 0;
+  double frame_ms_p50 = 0.0;
+  double frame_ms_p99 = 0.0;
+  double cpu_ms_p50 = 0.0;
+  double cpu_ms_p99 = 0.0;
+  // Zero without timestamp support.
+  double gpu_ms_p50 = 0.0;
+  double gpu_ms_p99 = 0.0;
+  // Zero without pipeline statistics support.
+  double overdraw_p50 = 0.0;
+  double overdraw_p99 = 0.0;
+  double heap_allocations_p50 = 0.0;
+  double heap_allocations_p99 = 0.0;
+};
+
+// Single producer, single consumer queue without locks. One slot is kept
+// empty to tell a full ring from an empty one.
+template <typename T, uint32_t N> class SpscRing {
+public:
+  bool push(const T &value) {
+    uint32_t head = write.load(std::memory_order_relaxed);
+    uint32_t next = (head + 1) % N;
+    if (next == read.load(std::memory_order_acquire)) {
+      return false;
+    }
+    slots[head] = value;
+    write.store(next, std::memory_order_release);
+    return true;
+  }
+
+  bool pop(T &value) {
+    uint32_t tail = read.load(std::memory_order_relaxed);
+    if (tail == write.load(std::memory_order_acquire)) {
+      return false;
+    }
+    value = slots[tail];
+    read.store((tail + 1) % N, std::memory_order_release);
+    return true;
+  }
+
+private:
+  std::array<T, N> slots;
+  std::atomic<uint32_t> write{0};
+  std::atomic<uint32_t> read{0};
+};
+
+class FrameProfiler;
+
+struct ProfileScope {
+  ProfileScope(FrameProfiler &profiler, ProfilePhase phase);
+  ~ProfileScope();
+  FrameProfiler &profiler;
+  ProfilePhase phase;
+};
+
+// CPU phase timers, GPU timestamp queries and optionally one fragment
+// statistics query per frame in flight. Finished
+// frames go through a lock-free ring so a consumer on another thread could
+// drain them; collect() moves them into a bounded history that report() and
+// export_chrome_trace() summarize.
+class FrameProfiler {
+public:
+  void init(VkPhysicalDevice physical_device, VkDevice device,
+            uint32_t timestamp_valid_bits, uint32_t frames_in_flight,
+            const std::vector<std::string> &gpu_scope_names,
+            bool fragment_statistics = false) {
+    this->device = device;
+    if (gpu_scope_names.size() > PROFILER_MAX_GPU_SCOPES) {
+      throw std::runtime_error("too many gpu profiler scopes");
+    }
+    this->gpu_scope_names = gpu_scope_names;
+    epoch = std::chrono::steady_clock::now();
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(physical_device, &properties);
+    timestamp_period_ns = properties.limits.timestampPeriod;
+    timestamp_mask = timestamp_valid_bits >= 64
+                         ? ~0ull
+                         : ((1ull << timestamp_valid_bits) - 1);
+    gpu_enabled = timestamp_valid_bits > 0 && !gpu_scope_names.empty();
+    queries_per_frame = 2 * static_cast<uint32_t>(gpu_scope_names.size());
+    pending.resize(frames_in_flight);
+    pending_used.assign(frames_in_flight, false);
+    gpu_written.assign(frames_in_flight, false);
+    query_results.resize(queries_per_frame);
+    history.resize(PROFILER_HISTORY_SIZE);
+    scratch.reserve(PROFILER_HISTORY_SIZE);
+    if (gpu_enabled) {
+      VkQueryPoolCreateInfo pool_info{};
+      pool_info.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+      pool_info.queryType = VK_QUERY_TYPE_TIMESTAMP;
+      pool_info.queryCount = queries_per_frame * frames_in_flight;
+      if (vkCreateQueryPool(device, &pool_info, nullptr, &query_pool) !=
+          VK_SUCCESS) {
+        throw std::runtime_error("failed to create timestamp query pool");
+      }
+    }
+    stats_enabled = fragment_statistics;
+    if (stats_enabled) {
+      VkQueryPoolCreateInfo pool_info{};
+      pool_info.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+      pool_info.queryType = VK_QUERY_TYPE_PIPELINE_STATISTICS;
+      pool_info.queryCount = frames_in_flight;
+      pool_info.pipelineStatistics =
+          VK_QUERY_PIPELINE_STATISTIC_FRAGMENT_SHADER_INVOCATIONS_BIT;
+      if (vkCreateQueryPool(device, &pool_info, nullptr, &stats_pool) !=
+          VK_SUCCESS) {
+        throw std::runtime_error("failed to create statistics query pool");
+      }
+    }
+  }
+
+  bool fragment_statistics_enabled() const { return stats_enabled; }
+
+  void begin_frame() {
+    FrameTiming &timing = current;
+    timing = FrameTiming{};
+    timing.frame = frame_counter++;
+    timing.begin_us = now_us();
+    timing.frame_ms =
+        last_begin_us > 0.0 ? (timing.begin_us - last_begin_us) / 1000.0 : -1.0;
+    last_begin_us = timing.begin_us;
+    allocations_at_begin =
+        heap_allocation_count.load(std::memory_order_relaxed);
+  }
+
+  void begin_phase(ProfilePhase phase) {
+    current.phase_begin_us[phase] = now_us();
+  }
+
+  void end_phase(ProfilePhase phase) {
+    current.phase_ms[phase] +=
+        (now_us() - current.phase_begin_us[phase]) / 1000.0;
+  }
+
+  // Call once the frame's last submission completed: the GPU results recorded
+  // the last time this slot was used are final now.
+  void resolve(uint32_t frame) {
+    if (!pending_used[frame]) {
+      return;
+    }
+    FrameTiming &timing = pending[frame];
+    if (gpu_written[frame] && gpu_enabled) {
+      read_gpu_scopes(frame, timing);
+    }
+    if (gpu_written[frame] && stats_enabled && timing.pixel_count > 0) {
+      read_fragment_statistics(frame, timing);
+    }
+    if (!ring.push(timing)) {
+      dropped++;
+    }
+    pending_used[frame] = false;
+    gpu_written[frame] = false;
+  }
+
+  void end_frame(uint32_t frame, bool submitted) {
+    current.heap_allocations =
+        heap_allocation_count.load(std::memory_order_relaxed) -
+        allocations_at_begin;
+    pending[frame] = current;
+    pending_used[frame] = true;
+    gpu_written[frame] = submitted && (gpu_enabled || stats_enabled);
+  }
+
+  // Must be recorded outside a render pass before any timestamp of the frame.
+  void reset_queries(VkCommandBuffer buffer, uint32_t frame) {
+    if (gpu_enabled) {
+      vkCmdResetQueryPool(buffer, query_pool, frame * queries_per_frame,
+                          queries_per_frame);
+    }
+    if (stats_enabled) {
+      vkCmdResetQueryPool(buffer, stats_pool, frame, 1);
+    }
+  }
+
+  // Counts the fragment shader invocations of everything recorded until
+  // end_fragment_statistics(), at most once per frame. Secondary command
+  // buffers executed meanwhile have to inherit the query.
+  void begin_fragment_statistics(VkCommandBuffer buffer, uint32_t frame) {
+    if (stats_enabled) {
+      vkCmdBeginQuery(buffer, stats_pool, frame, 0);
+    }
+  }
+
+  // pixel_count is the area the counted draws cover, usually the render
+  // area.
+  void end_fragment_statistics(VkCommandBuffer buffer, uint32_t frame,
+                               uint32_t pixel_count) {
+    if (stats_enabled) {
+      vkCmdEndQuery(buffer, stats_pool, frame);
+      current.pixel_count = pixel_count;
+    }
+  }
+
+  void begin_gpu_scope(VkCommandBuffer buffer, uint32_t frame,
+                       uint32_t scope) {
+    if (gpu_enabled) {
+      vkCmdWriteTimestamp(buffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                          query_pool, frame * queries_per_frame + 2 * scope);
+    }
+  }
+
+  void end_gpu_scope(VkCommandBuffer buffer, uint32_t frame, uint32_t scope) {
+    if (gpu_enabled) {
+      vkCmdWriteTimestamp(buffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+                          query_pool,
+                          frame * queries_per_frame + 2 * scope + 1);
+    }
+  }
+
+  // Drains the ring into the history.
+  void collect() {
+    FrameTiming timing;
+    while (ring.pop(timing)) {
+      history[history_count % PROFILER_HISTORY_SIZE] = timing;
+      history_count++;
+    }
+  }
+
+  // Resolves every frame still in flight, the device has to be idle.
+  void flush() {
+    for (uint32_t frame = 0; frame < pending.size(); frame++) {
+      resolve(frame);
+    }
+    collect();
+  }
+
+  ProfileSummary summary() {
+    ProfileSummary summary{};
+    summary.frame_count = history_size();
+    if (gather([](const FrameTiming &t) { return t.frame_ms; })) {
+      summary.frame_ms_p50 = percentile(0.50);
+      summary.frame_ms_p99 = percentile(0.99);
+    }
+    if (gather([](const FrameTiming &t) { return t.cpu_ms(); })) {
+      summary.cpu_ms_p50 = percentile(0.50);
+      summary.cpu_ms_p99 = percentile(0.99);
+    }
+    if (gather([](const FrameTiming &t) {
+          return t.gpu_valid ? t.gpu_frame_ms : -1.0;
+        })) {
+      summary.gpu_ms_p50 = percentile(0.50);
+      summary.gpu_ms_p99 = percentile(0.99);
+    }
+    if (gather([](const FrameTiming &t) {
+          return t.overdraw_valid ? t.overdraw : -1.0;
+        })) {
+      summary.overdraw_p50 = percentile(0.50);
+      summary.overdraw_p99 = percentile(0.99);
+    }
+    if (gather([](const FrameTiming &t) {
+          return (double)t.heap_allocations;
+        })) {
+      summary.heap_allocations_p50 = percentile(0.50);
+      summary.heap_allocations_p99 = percentile(0.99);
+    }
+    return summary;
+  }
+
+  // Forgets the history, frames still in flight are kept.
+  void reset() {
+    collect();
+    history_count = 0;
+    dropped = 0;
+    last_begin_us = 0.0;
+  }
+
+  void report(std::ostream &out) {
+    uint32_t count = history_size();
+    if (count == 0) {
+      return;
+    }
+    out << "frame timings over " << count << " frames";
+    if (dropped > 0) {
+      out << " (" << dropped << " dropped)";
+    }
+    out << std::endl;
+    print_percentiles(out, "frame",
+                      [](const FrameTiming &t) { return t.frame_ms; });
+    for (uint32_t phase = 0; phase < PROFILE_PHASE_COUNT; phase++) {
+      print_percentiles(out, profile_phase_name(phase),
+                        [phase](const FrameTiming &t) {
+                          return t.phase_ms[phase];
+                        });
+    }
+    for (uint32_t scope = 0; scope < gpu_scope_names.size(); scope++) {
+      print_percentiles(out, "gpu " + gpu_scope_names[scope],
+                        [scope](const FrameTiming &t) {
+                          return t.gpu_valid ? t.gpu_ms[scope] : -1.0;
+                        });
+    }
+    if (gather([](const FrameTiming &t) {
+          return t.overdraw_valid ? t.overdraw : -1.0;
+        })) {
+      out << "  overdraw: p50 " << percentile(0.50) << "x, p99 "
+          << percentile(0.99) << "x" << std::endl;
+    }
+    if (gather([](const FrameTiming &t) {
+          return (double)t.heap_allocations;
+        })) {
+      out << "  heap allocations: p50 " << percentile(0.50) << ", p99 "
+          << percentile(0.99) << " per frame" << std::endl;
+    }
+  }
+
+  // Writes the history in the Chrome trace event format, open it in
+  // chrome://tracing or Perfetto.
+  void export_chrome_trace(const std::string &filename) {
+    std::ofstream file(filename);
+    if (!file.is_open()) {
+      throw std::runtime_error("failed to open trace file");
+    }
+    file << "{\"traceEvents\":[\n";
+    bool first = true;
+    auto event = [&](const std::string &name, uint32_t tid, double ts,
+                     double dur_ms) {
+      file << (first ? "" : ",\n") << "{\"name\":\"" << name
+           << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << tid << ",\"ts\":" << ts
+           << ",\"dur\":" << dur_ms * 1000.0 << "}";
+      first = false;
+    };
+    uint32_t count = history_size();
+    for (uint32_t i = 0; i < count; i++) {
+      const FrameTiming &t = history_at(i);
+      event("frame " + std::to_string(t.frame), 1, t.begin_us,
+            std::max(t.frame_ms, 0.0));
+      for (uint32_t phase = 0; phase < PROFILE_PHASE_COUNT; phase++) {
+        if (t.phase_ms[phase] > 0.0) {
+          event(profile_phase_name(phase), 1, t.phase_begin_us[phase],
+                t.phase_ms[phase]);
+        }
+      }
+      if (!t.gpu_valid) {
+        continue;
+      }
+      for (uint32_t scope = 0; scope < gpu_scope_names.size(); scope++) {
+        event(gpu_scope_names[scope], 2, t.gpu_begin_us[scope],
+              t.gpu_ms[scope]);
+      }
+    }
+    file << "\n],\"displayTimeUnit\":\"ms\"}\n";
+  }
+
+  void destroy() {
+    if (query_pool != VK_NULL_HANDLE) {
+      vkDestroyQueryPool(device, query_pool, nullptr);
+      query_pool = VK_NULL_HANDLE;
+    }
+    if (stats_pool != VK_NULL_HANDLE) {
+      vkDestroyQueryPool(device, stats_pool, nullptr);
+      stats_pool = VK_NULL_HANDLE;
+    }
+  }
+
+private:
+  double now_us() const {
+    return std::chrono::duration<double, std::micro>(
+               std::chrono::steady_clock::now() - epoch)
+        .count();
+  }
+
+  void read_gpu_scopes(uint32_t frame, FrameTiming &timing) {
+    VkResult result = vkGetQueryPoolResults(
+        device, query_pool, frame * queries_per_frame, queries_per_frame,
+        query_results.size() * sizeof(uint64_t), query_results.data(),
+        sizeof(uint64_t), VK_QUERY_RESULT_64_BIT);
+    if (result != VK_SUCCESS) {
+      return;
+    }
+    if (!gpu_epoch_set) {
+      gpu_epoch = query_results[0] & timestamp_mask;
+      gpu_epoch_us = timing.begin_us;
+      gpu_epoch_set = true;
+    }
+    double us_per_tick = timestamp_period_ns / 1000.0;
+    double frame_begin_us = 0.0;
+    double frame_end_us = 0.0;
+    for (uint32_t scope = 0; scope < gpu_scope_names.size(); scope++) {
+      uint64_t begin = query_results[2 * scope] & timestamp_mask;
+      uint64_t end = query_results[2 * scope + 1] & timestamp_mask;
+      timing.gpu_begin_us[scope] =
+          gpu_epoch_us + (double)(int64_t)(begin - gpu_epoch) * us_per_tick;
+      timing.gpu_ms[scope] =
+          (double)((end - begin) & timestamp_mask) * us_per_tick / 1000.0;
+      double end_us =
+          timing.gpu_begin_us[scope] + timing.gpu_ms[scope] * 1000.0;
+      if (scope == 0 || timing.gpu_begin_us[scope] < frame_begin_us) {
+        frame_begin_us = timing.gpu_begin_us[scope];
+      }
+      frame_end_us = std::max(frame_end_us, end_us);
+    }
+    timing.gpu_frame_ms = (frame_end_us - frame_begin_us) / 1000.0;
+    timing.gpu_valid = true;
+  }
+
+  void read_fragment_statistics(uint32_t frame, FrameTiming &timing) {
+    uint64_t invocations = 0;
+    if (vkGetQueryPoolResults(device, stats_pool, frame, 1,
+                              sizeof(invocations), &invocations,
+                              sizeof(invocations),
+                              VK_QUERY_RESULT_64_BIT) != VK_SUCCESS) {
+      return;
+    }
+    timing.overdraw = (double)invocations / timing.pixel_count;
+    timing.overdraw_valid = true;
+  }
+
+  uint32_t history_size() const {
+    return std::min(history_count, (uint64_t)PROFILER_HISTORY_SIZE);
+  }
+
+  // Oldest first.
+  const FrameTiming &history_at(uint32_t i) const {
+    uint64_t start = history_count - history_size();
+    return history[(start + i) % PROFILER_HISTORY_SIZE];
+  }
+
+  // Fills scratch with every non-negative value, returns false if none.
+  template <typename F> bool gather(F value) {
+    scratch.clear();
+    uint32_t count = history_size();
+    for (uint32_t i = 0; i < count; i++) {
+      double v = value(history_at(i));
+      if (v >= 0.0) {
+        scratch.push_back(v);
+      }
+    }
+    return !scratch.empty();
+  }
+
+  template <typename F>
+  void print_percentiles(std::ostream &out, const std::string &name,
+                         F value) {
+    if (!gather(value)) {
+      return;
+    }
+    out << "  " << name << ": p50 " << percentile(0.50) << " ms, p99 "
+        << percentile(0.99) << " ms" << std::endl;
+  }
+
+  double percentile(double p) {
+    size_t index = std::min(scratch.size() - 1,
+                            (size_t)(p * (double)(scratch.size() - 1) + 0.5));
+    std::nth_element(scratch.begin(), scratch.begin() + index, scratch.end());
+    return scratch[index];
+  }
+
+  VkDevice device = VK_NULL_HANDLE;
+  VkQueryPool query_pool = VK_NULL_HANDLE;
+  bool gpu_enabled = false;
+  VkQueryPool stats_pool = VK_NULL_HANDLE;
+  bool stats_enabled = false;
+  uint32_t queries_per_frame = 0;
+  float timestamp_period_ns = 1.0f;
+  uint64_t timestamp_mask = ~0ull;
+  bool gpu_epoch_set = false;
+  uint64_t gpu_epoch = 0;
+  double gpu_epoch_us = 0.0;
+  std::vector<std::string> gpu_scope_names;
+  std::chrono::steady_clock::time_point epoch;
+  uint64_t frame_counter = 0;
+  double last_begin_us = 0.0;
+  uint64_t allocations_at_begin = 0;
+  FrameTiming current{};
+  std::vector<FrameTiming> pending;
+  std::vector<bool> pending_used;
+  std::vector<bool> gpu_written;
+  std::vector<uint64_t> query_results;
+  SpscRing<FrameTiming, PROFILER_RING_SIZE> ring;
+  uint64_t dropped = 0;
+  std::vector<FrameTiming> history;
+  uint64_t history_count = 0;
+  std::vector<double> scratch;
+};
+
+inline ProfileScope::ProfileScope(FrameProfiler &profiler, ProfilePhase phase)
+    : profiler(profiler), phase(phase) {
+  profiler.begin_phase(phase);
+}
+
+inline ProfileScope::~ProfileScope() { profiler.end_phase(phase); }
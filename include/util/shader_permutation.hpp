@@ -0,0 +1,56 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+
+#include <vulkan/vulkan_core.h>
+
+#include <util/pipeline_registry.hpp>
+
+// Set of boolean shader features, one bit per value of Feature. Each feature
+// is the specialization constant whose constant_id is its bit, so a key
+// names one fully specialized variant of a shader and disabled features are
+// compiled out instead of branched around. Keys are plain values, usable in
+// constant expressions and as part of a pipeline description.
+template <typename Feature, uint32_t FeatureCount> struct PermutationKey {
+  static_assert(FeatureCount <= 32, "permutation key holds 32 features");
+
+  uint32_t bits = 0;
+
+  constexpr PermutationKey with(Feature feature, bool enabled = true) const {
+    return {enabled ? bits | 1u << feature : bits & ~(1u << feature)};
+  }
+
+  constexpr PermutationKey toggled(Feature feature) const {
+    return {bits ^ 1u << feature};
+  }
+
+  constexpr bool has(Feature feature) const {
+    return (bits >> feature & 1u) != 0;
+  }
+
+  constexpr bool operator==(PermutationKey other) const {
+    return bits == other.bits;
+  }
+
+  constexpr bool operator!=(PermutationKey other) const {
+    return bits != other.bits;
+  }
+
+  // Every feature as a VkBool32 constant, also the disabled ones, so no
+  // variant depends on the defaults in the shader.
+  ShaderSpecialization specialization() const {
+    ShaderSpecialization specialization;
+    specialization.entries.resize(FeatureCount);
+    specialization.data.resize(FeatureCount * sizeof(VkBool32));
+    for (uint32_t i = 0; i < FeatureCount; i++) {
+      VkBool32 value = has((Feature)i) ? VK_TRUE : VK_FALSE;
+      specialization.entries[i].constantID = i;
+      specialization.entries[i].offset = i * sizeof(VkBool32);
+      specialization.entries[i].size = sizeof(VkBool32);
+      memcpy(specialization.data.data() + i * sizeof(VkBool32), &value,
+             sizeof(VkBool32));
+    }
+    return specialization;
+  }
+};
@@ -0,0 +1,185 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <shaderc/shaderc.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+#include <util/pipeline_registry.hpp>
+#include <util/shader_util.hpp>
+
+struct WatchedShader {
+  // Source file inside the watched directory.
+  std::string file;
+  // SPIR-V asset the source compiles to.
+  std::string name;
+  shaderc_shader_kind kind;
+  uint64_t source_hash;
+};
+
+struct ShaderUpdate {
+  std::string name;
+  std::vector<uint32_t> code;
+};
+
+// Recompiles GLSL sources in process when they change on disk. The watched
+// directory is observed with inotify, closed writes and renames into it
+// both count, since editors often save through a temporary file. Results
+// are cached by a hash of the source, saving an unchanged file or going
+// back to an earlier version compiles nothing.
+class ShaderReloader {
+public:
+  void init(const std::string &directory) {
+    this->directory = directory;
+    fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (fd < 0) {
+      throw std::runtime_error("failed to create inotify instance");
+    }
+    uint32_t mask = IN_CLOSE_WRITE | IN_MOVED_TO;
+    if (inotify_add_watch(fd, directory.c_str(), mask) < 0) {
+      throw std::runtime_error("failed to watch " + directory);
+    }
+    compiler = shaderc_compiler_initialize();
+    compile_options = shaderc_compile_options_initialize();
+    shaderc_compile_options_set_target_env(compile_options,
+                                           shaderc_target_env_vulkan,
+                                           shaderc_env_version_vulkan_1_2);
+    shaderc_compile_options_set_optimization_level(
+        compile_options, shaderc_optimization_level_performance);
+  }
+
+  // The stage follows from the extension, as for glslc.
+  void watch(const std::string &file, const std::string &name) {
+    WatchedShader shader{};
+    shader.file = file;
+    shader.name = name;
+    std::string extension = file.substr(file.find_last_of('.') + 1);
+    if (extension == "vert") {
+      shader.kind = shaderc_vertex_shader;
+    } else if (extension == "frag") {
+      shader.kind = shaderc_fragment_shader;
+    } else if (extension == "comp") {
+      shader.kind = shaderc_compute_shader;
+    } else {
+      throw std::runtime_error("unknown shader stage of " + file);
+    }
+    // The running code was built from the current source.
+    shader.source_hash = hash_source(read_file(path(file)));
+    shaders.push_back(shader);
+  }
+
+  // Recompiles every source changed since the last call. Sources that fail
+  // to compile report their errors and keep their last good code.
+  std::vector<ShaderUpdate> poll() {
+    std::vector<ShaderUpdate> updates;
+    alignas(inotify_event) char events[4096];
+    ssize_t length;
+    std::vector<WatchedShader *> changed;
+    while ((length = read(fd, events, sizeof(events))) > 0) {
+      for (char *ptr = events; ptr < events + length;) {
+        const inotify_event *event = (const inotify_event *)ptr;
+        ptr += sizeof(inotify_event) + event->len;
+        for (auto &shader : shaders) {
+          if (event->len > 0 && shader.file == event->name &&
+              std::find(changed.begin(), changed.end(), &shader) ==
+                  changed.end()) {
+            changed.push_back(&shader);
+          }
+        }
+      }
+    }
+    for (WatchedShader *shader : changed) {
+      ShaderUpdate update;
+      if (reload(*shader, update)) {
+        updates.push_back(std::move(update));
+      }
+    }
+    return updates;
+  }
+
+  void destroy() {
+    if (fd >= 0) {
+      close(fd);
+      fd = -1;
+    }
+    if (compile_options) {
+      shaderc_compile_options_release(compile_options);
+      compile_options = nullptr;
+    }
+    if (compiler) {
+      shaderc_compiler_release(compiler);
+      compiler = nullptr;
+    }
+  }
+
+private:
+  bool reload(WatchedShader &shader, ShaderUpdate &update) {
+    std::vector<char> source;
+    try {
+      source = read_file(path(shader.file));
+    } catch (const std::runtime_error &) {
+      // Removed or in the middle of being replaced, the rename reports it
+      // again.
+      return false;
+    }
+    uint64_t hash = hash_source(source);
+    if (hash == shader.source_hash) {
+      return false;
+    }
+    auto start = std::chrono::steady_clock::now();
+    uint64_t key = hash ^ (uint64_t)shader.kind;
+    auto cached = cache.find(key);
+    if (cached == cache.end()) {
+      shaderc_compilation_result_t result = shaderc_compile_into_spv(
+          compiler, source.data(), source.size(), shader.kind,
+          shader.file.c_str(), "main", compile_options);
+      if (shaderc_result_get_compilation_status(result) !=
+          shaderc_compilation_status_success) {
+        std::cerr << shaderc_result_get_error_message(result);
+        shaderc_result_release(result);
+        return false;
+      }
+      const uint32_t *code =
+          (const uint32_t *)shaderc_result_get_bytes(result);
+      size_t word_count = shaderc_result_get_length(result) / sizeof(uint32_t);
+      std::vector<uint32_t> spirv(code, code + word_count);
+      cached = cache.emplace(key, std::move(spirv)).first;
+      shaderc_result_release(result);
+    }
+    shader.source_hash = hash;
+    update.name = shader.name;
+    update.code = cached->second;
+    double ms = std::chrono::duration<double, std::milli>(
+                    std::chrono::steady_clock::now() - start)
+                    .count();
+    std::cout << "reloaded " << shader.file << " in " << ms << " ms"
+              << std::endl;
+    return true;
+  }
+
+  std::string path(const std::string &file) const {
+    return directory + "/" + file;
+  }
+
+  static uint64_t hash_source(const std::vector<char> &source) {
+    PipelineHasher hasher;
+    hasher.add(source.data(), source.size());
+    return hasher.value;
+  }
+
+  std::string directory;
+  int fd = -1;
+  shaderc_compiler_t compiler = nullptr;
+  shaderc_compile_options_t compile_options = nullptr;
+  std::vector<WatchedShader> shaders;
+  // SPIR-V by source hash and stage.
+  std::unordered_map<uint64_t, std::vector<uint32_t>> cache;
+};
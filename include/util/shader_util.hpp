@@ -1,3 +1,6 @@
+#pragma once
+
+#include <cstdio>
 #include <fstream>
 #include <stdexcept>
 #include <string>
@@ -15,3 +18,23 @@ static std::vector<char> read_file(const std::string& filename) {
   file.close();
   return buffer;
 }
+
+// Writes to a temporary file first so a crash or a failed write never leaves
+// a truncated file.
+static void write_file(const std::string& filename, const void* data,
+                       size_t size) {
+  std::string tmp_filename = filename + ".tmp";
+  std::ofstream file(tmp_filename, std::ios::binary | std::ios::trunc);
+  if (!file.is_open()) {
+    throw std::runtime_error("failed to open file for writing!");
+  }
+  file.write((const char*) data, size);
+  file.close();
+  if (!file) {
+    std::remove(tmp_filename.c_str());
+    throw std::runtime_error("failed to write file!");
+  }
+  if (std::rename(tmp_filename.c_str(), filename.c_str()) != 0) {
+    throw std::runtime_error("failed to replace file!");
+  }
+}
@@ -0,0 +1,121 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <thread>
+
+// Hands the latest value from one writer thread to one reader thread
+// without locks. The writer fills a slot of its own and swaps it with the
+// shared middle one, the reader swaps the middle one for its own whenever
+// it holds something newer. Neither ever waits for the other, the reader
+// skips values it was too slow for, and a value stays untouched while the
+// reader holds it.
+template <typename T> class TripleBuffer {
+public:
+  // Slot to fill, only valid until publish().
+  T &back() { return slots[back_index]; }
+
+  void publish() {
+    uint32_t previous =
+        middle.exchange(back_index | FRESH, std::memory_order_acq_rel);
+    back_index = previous & INDEX_MASK;
+  }
+
+  // The last published value, or the one before if nothing new arrived.
+  // Stays valid until the next call. Default constructed before the first
+  // publish(), check has_value().
+  const T &latest() {
+    if (middle.load(std::memory_order_relaxed) & FRESH) {
+      front_index =
+          middle.exchange(front_index, std::memory_order_acq_rel) & INDEX_MASK;
+      received = true;
+    }
+    return slots[front_index];
+  }
+
+  // Whether latest() returned a published value.
+  bool has_value() const { return received; }
+
+private:
+  static constexpr uint32_t FRESH = 4;
+  static constexpr uint32_t INDEX_MASK = 3;
+
+  std::array<T, 3> slots{};
+  std::atomic<uint32_t> middle{1};
+  uint32_t back_index = 0;
+  uint32_t front_index = 2;
+  bool received = false;
+};
+
+// Calls step at a fixed rate on a thread of its own, with the time the tick
+// stands for on the steady clock. Ticks the thread fell behind on are
+// caught up back to back, up to max_catch_up, the rest are dropped so a
+// stall does not turn into a burst of ticks.
+class SimulationThread {
+public:
+  typedef std::chrono::steady_clock Clock;
+
+  void start(double tick_seconds, uint32_t max_catch_up,
+             std::function<void(double)> step) {
+    this->tick = std::chrono::duration_cast<Clock::duration>(
+        std::chrono::duration<double>(tick_seconds));
+    this->max_catch_up = max_catch_up;
+    this->step = std::move(step);
+    running = true;
+    thread = std::thread(&SimulationThread::main, this);
+  }
+
+  // Seconds on the clock step is given.
+  static double now() {
+    return std::chrono::duration<double>(Clock::now().time_since_epoch())
+        .count();
+  }
+
+  // Rethrows what step threw, if anything.
+  void stop() {
+    if (!thread.joinable()) {
+      return;
+    }
+    running = false;
+    thread.join();
+    if (error) {
+      std::rethrow_exception(error);
+    }
+  }
+
+  // Set once step threw, the thread stops ticking then.
+  bool failed() const { return failed_flag.load(std::memory_order_acquire); }
+
+private:
+  void main() {
+    Clock::time_point next = Clock::now();
+    try {
+      while (running) {
+        Clock::time_point now = Clock::now();
+        for (uint32_t i = 0; next <= now && i < max_catch_up; i++) {
+          step(std::chrono::duration<double>(next.time_since_epoch()).count());
+          next += tick;
+        }
+        if (next <= now) {
+          next = now + tick;
+        }
+        std::this_thread::sleep_until(next);
+      }
+    } catch (...) {
+      error = std::current_exception();
+      failed_flag.store(true, std::memory_order_release);
+    }
+  }
+
+  Clock::duration tick{};
+  uint32_t max_catch_up = 1;
+  std::function<void(double)> step;
+  std::atomic<bool> running{false};
+  std::atomic<bool> failed_flag{false};
+  std::exception_ptr error;
+  std::thread thread;
+};
@@ -0,0 +1,245 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+
+#include <glm/glm.hpp>
+#include <vulkan/vulkan_core.h>
+
+#include <util/draw_sort.hpp>
+#include <util/frame_arena.hpp>
+#include <util/pipeline_registry.hpp>
+#include <util/vertex_layout.hpp>
+
+// Quads a single frame can push, indices are 16 bit.
+const uint32_t SPRITE_BATCH_MAX_QUADS = 16384;
+const uint32_t SPRITE_BATCH_MAX_VERTICES = SPRITE_BATCH_MAX_QUADS * 4;
+const uint32_t SPRITE_BATCH_MAX_INDICES = SPRITE_BATCH_MAX_QUADS * 6;
+static_assert(SPRITE_BATCH_MAX_VERTICES <= 65536, "indices are 16 bit");
+
+// Page of quads without a texture, they are drawn in their color alone.
+// Also in sprite.frag.
+const uint32_t SPRITE_NO_TEXTURE = ~0u;
+
+// Also read by sprite.vert, keep both in sync.
+enum SpriteSpace : uint32_t {
+  // Tile grid units, transformed by the camera like the tiles.
+  SPRITE_SPACE_WORLD,
+  // Pixels from the top left corner of the screen.
+  SPRITE_SPACE_SCREEN,
+};
+
+struct SpriteVertex {
+  glm::vec2 position;
+  glm::vec2 uv;
+  Unorm8x4 color;
+  // Bindless atlas page, or SPRITE_NO_TEXTURE.
+  uint32_t page;
+};
+
+template <> struct VertexLayout<SpriteVertex> {
+  static constexpr VkVertexInputRate input_rate = VK_VERTEX_INPUT_RATE_VERTEX;
+  static constexpr std::array<VertexAttribute, 4> attributes = {
+      VERTEX_ATTRIBUTE(SpriteVertex, position),
+      VERTEX_ATTRIBUTE(SpriteVertex, uv), VERTEX_ATTRIBUTE(SpriteVertex, color),
+      VERTEX_ATTRIBUTE(SpriteVertex, page)};
+};
+
+// One draw call, consecutive quads of the same pipeline and space.
+// first_index counts from the frame's index_offset(), the indices from its
+// vertex_offset().
+struct SpriteDraw {
+  PipelineHandle pipeline;
+  SpriteSpace space;
+  uint32_t first_index;
+  uint32_t index_count;
+};
+
+// Immediate mode quads for geometry that changes every frame, like debug
+// overlays, UI and moving entities. Quads are written straight into one
+// persistently mapped, host coherent buffer with a vertex and an index
+// region per frame in flight, like FrameUniformRing a region is only
+// rewritten once the frame last reading it completed. A quad continues the
+// draw of the one before it unless its pipeline or space differs. Textures
+// are bindless pages picked per vertex, so they never split a draw. A frame
+// with more than SPRITE_BATCH_MAX_QUADS quads drops the rest. Quads blend,
+// sort_back_to_front() orders the world space ones by depth before the
+// batch is drawn. Render thread only.
+class SpriteBatch {
+public:
+  static VkDeviceSize buffer_size(uint32_t frame_count) {
+    return frame_count * (vertex_region_size() + index_region_size());
+  }
+
+  void init(VkBuffer buffer, void *data, uint32_t frame_count) {
+    this->buffer = buffer;
+    this->data = (char *)data;
+    this->frame_count = frame_count;
+  }
+
+  // Starts writing the regions of frame, the caller waited for the last
+  // submission of that frame. The draw list lives in arena.
+  void begin_frame(uint32_t frame, FrameArena &arena) {
+    this->frame = frame;
+    vertices = (SpriteVertex *)(data + vertex_offset());
+    indices = (uint16_t *)(data + index_offset());
+    quad_count = 0;
+    dropped = 0;
+    batches = make_frame_vector<SpriteDraw>(arena);
+  }
+
+  // Corners in order around the quad, either winding is drawn.
+  void push_quad(PipelineHandle pipeline, SpriteSpace space,
+                 const glm::vec2 corners[4], const glm::vec2 uvs[4],
+                 Unorm8x4 color, uint32_t page) {
+    if (quad_count == SPRITE_BATCH_MAX_QUADS) {
+      dropped++;
+      return;
+    }
+    uint32_t first_vertex = quad_count * 4;
+    for (uint32_t i = 0; i < 4; i++) {
+      vertices[first_vertex + i] = {corners[i], uvs[i], color, page};
+    }
+    place_quad(batches, quad_count, quad_count, pipeline, space);
+    quad_count++;
+  }
+
+  // Axis aligned rectangle in a single color.
+  void push_quad(PipelineHandle pipeline, SpriteSpace space, glm::vec2 min,
+                 glm::vec2 max, Unorm8x4 color) {
+    const glm::vec2 corners[4] = {min, {max.x, min.y}, max, {min.x, max.y}};
+    const glm::vec2 uvs[4] = {};
+    push_quad(pipeline, space, corners, uvs, color, SPRITE_NO_TEXTURE);
+  }
+
+  // Atlas sprite centered on position, uv_rect is its min and max uv on
+  // page. color tints the texels.
+  void push_sprite(PipelineHandle pipeline, SpriteSpace space,
+                   glm::vec2 position, glm::vec2 size, glm::vec4 uv_rect,
+                   uint32_t page, Unorm8x4 color) {
+    glm::vec2 min = position - size * 0.5f;
+    glm::vec2 max = position + size * 0.5f;
+    const glm::vec2 corners[4] = {min, {max.x, min.y}, max, {min.x, max.y}};
+    const glm::vec2 uvs[4] = {{uv_rect.x, uv_rect.y},
+                              {uv_rect.z, uv_rect.y},
+                              {uv_rect.z, uv_rect.w},
+                              {uv_rect.x, uv_rect.w}};
+    push_quad(pipeline, space, corners, uvs, color, page);
+  }
+
+  // Reorders the world space quads back to front with depth(center), 0
+  // nearest, as translucent draw keys. Screen space quads keep their push
+  // order and follow them, so UI stays on top of the world. Indices are
+  // rewritten, the vertices stay where they are.
+  template <typename DepthFunction>
+  void sort_back_to_front(FrameArena &arena, DepthFunction depth) {
+    FrameVector<PipelineHandle> pipelines =
+        make_frame_vector<PipelineHandle>(arena);
+    FrameVector<PipelineHandle> quad_pipelines =
+        make_frame_vector<PipelineHandle>(arena);
+    FrameVector<uint64_t> keys = make_frame_vector<uint64_t>(arena);
+    FrameVector<uint64_t> scratch = make_frame_vector<uint64_t>(arena);
+    quad_pipelines.resize(quad_count);
+    keys.reserve(quad_count);
+    for (const auto &draw : batches) {
+      if (draw.space != SPRITE_SPACE_WORLD) {
+        continue;
+      }
+      uint32_t pipeline = (uint32_t)(
+          std::find(pipelines.begin(), pipelines.end(), draw.pipeline) -
+          pipelines.begin());
+      if (pipeline == pipelines.size()) {
+        pipelines.push_back(draw.pipeline);
+      }
+      uint32_t first_quad = draw.first_index / 6;
+      for (uint32_t quad = first_quad;
+           quad < first_quad + draw.index_count / 6; quad++) {
+        const SpriteVertex *corners = vertices + quad * 4;
+        glm::vec2 center = (corners[0].position + corners[2].position) * 0.5f;
+        quad_pipelines[quad] = draw.pipeline;
+        keys.push_back(translucent_draw_key(pipeline, 0, depth(center), quad));
+      }
+    }
+    if (keys.empty()) {
+      return;
+    }
+    radix_sort_draw_keys(keys, scratch);
+    FrameVector<SpriteDraw> sorted = make_frame_vector<SpriteDraw>(arena);
+    uint32_t slot = 0;
+    for (uint64_t key : keys) {
+      uint32_t quad = draw_key_payload(key);
+      place_quad(sorted, slot++, quad, quad_pipelines[quad],
+                 SPRITE_SPACE_WORLD);
+    }
+    for (const auto &draw : batches) {
+      if (draw.space == SPRITE_SPACE_WORLD) {
+        continue;
+      }
+      uint32_t first_quad = draw.first_index / 6;
+      for (uint32_t quad = first_quad;
+           quad < first_quad + draw.index_count / 6; quad++) {
+        place_quad(sorted, slot++, quad, draw.pipeline, draw.space);
+      }
+    }
+    batches = std::move(sorted);
+  }
+
+  // Lets go of the draw list before its arena is reset.
+  void release() { batches.clear(); }
+
+  // Draws of the current frame in push order.
+  const FrameVector<SpriteDraw> &draws() const { return batches; }
+
+  bool empty() const { return batches.empty(); }
+
+  uint32_t dropped_quads() const { return dropped; }
+
+  VkBuffer get_buffer() const { return buffer; }
+
+  // Where the current frame's vertices and indices start in the buffer.
+  VkDeviceSize vertex_offset() const { return frame * vertex_region_size(); }
+
+  VkDeviceSize index_offset() const {
+    return frame_count * vertex_region_size() + frame * index_region_size();
+  }
+
+private:
+  // Writes the indices of quad into index slot, extending the last draw of
+  // draws where it matches.
+  void place_quad(FrameVector<SpriteDraw> &draws, uint32_t slot,
+                  uint32_t quad, PipelineHandle pipeline, SpriteSpace space) {
+    write_quad_indices(slot, quad);
+    if (draws.empty() || draws.back().pipeline != pipeline ||
+        draws.back().space != space) {
+      draws.push_back({pipeline, space, slot * 6, 0});
+    }
+    draws.back().index_count += 6;
+  }
+
+  void write_quad_indices(uint32_t slot, uint32_t quad) {
+    uint16_t *quad_indices = indices + slot * 6;
+    const uint16_t order[6] = {0, 1, 2, 2, 3, 0};
+    for (uint32_t i = 0; i < 6; i++) {
+      quad_indices[i] = (uint16_t)(quad * 4 + order[i]);
+    }
+  }
+
+  static VkDeviceSize vertex_region_size() {
+    return SPRITE_BATCH_MAX_VERTICES * sizeof(SpriteVertex);
+  }
+
+  static VkDeviceSize index_region_size() {
+    return SPRITE_BATCH_MAX_INDICES * sizeof(uint16_t);
+  }
+
+  VkBuffer buffer = VK_NULL_HANDLE;
+  char *data = nullptr;
+  uint32_t frame_count = 0;
+  uint32_t frame = 0;
+  SpriteVertex *vertices = nullptr;
+  uint16_t *indices = nullptr;
+  uint32_t quad_count = 0;
+  uint32_t dropped = 0;
+  FrameVector<SpriteDraw> batches;
+};
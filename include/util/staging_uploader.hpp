@@ -0,0 +1,302 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <stdexcept>
+#include <vector>
+
+#include <vulkan/vulkan_core.h>
+
+#include <util/timeline_scheduler.hpp>
+
+const VkDeviceSize STAGING_RING_SIZE = 32 * 1024 * 1024;
+const VkDeviceSize STAGING_RING_ALIGNMENT = 16;
+
+struct StagingCopy {
+  VkBuffer src;
+  VkBuffer dst;
+  VkBufferCopy region;
+};
+
+struct StagingImageCopy {
+  VkImage dst;
+  VkBufferImageCopy region;
+};
+
+struct StagingBatch {
+  VkCommandBuffer command_buffer;
+  TimelinePoint point;
+  // Ring write position once this batch was submitted, space before it can
+  // be reused once the batch completed.
+  uint64_t ring_end;
+};
+
+// Streams data to device local buffers and images through one persistently
+// mapped staging ring. Uploads are batched until flush(), which records
+// every pending region into a single command buffer on the transfer queue.
+// Batches are tracked on the transfer timeline, so other queues can wait on
+// an upload without a CPU round trip. Uploads may come from any thread.
+class StagingUploader {
+public:
+  void init(VkDevice device, uint32_t queue_family, TimelineScheduler &timeline,
+            VkBuffer ring_buffer, void *ring_data, VkDeviceSize capacity) {
+    this->device = device;
+    this->timeline = &timeline;
+    this->ring_buffer = ring_buffer;
+    this->ring_data = (char *)ring_data;
+    this->capacity = capacity;
+    VkCommandPoolCreateInfo pool_info{};
+    pool_info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    pool_info.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT |
+                      VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+    pool_info.queueFamilyIndex = queue_family;
+    if (vkCreateCommandPool(device, &pool_info, nullptr, &command_pool) !=
+        VK_SUCCESS) {
+      throw std::runtime_error("failed to create transfer command pool");
+    }
+  }
+
+  // Copies data into the ring and queues a copy into dst until the next
+  // flush().
+  void upload(VkBuffer dst, VkDeviceSize dst_offset, const void *data,
+              VkDeviceSize size) {
+    std::lock_guard<std::mutex> lock(mutex);
+    const char *src = (const char *)data;
+    VkDeviceSize max_chunk = capacity / 2;
+    while (size > 0) {
+      VkDeviceSize chunk = std::min(size, max_chunk);
+      VkDeviceSize ring_offset = reserve(chunk);
+      memcpy(ring_data + ring_offset, src, chunk);
+      StagingCopy copy{};
+      copy.src = ring_buffer;
+      copy.dst = dst;
+      copy.region.srcOffset = ring_offset;
+      copy.region.dstOffset = dst_offset;
+      copy.region.size = chunk;
+      pending.push_back(copy);
+      src += chunk;
+      dst_offset += chunk;
+      size -= chunk;
+    }
+  }
+
+  // Queues a copy out of a buffer the caller owns, such as host memory the
+  // device imported, without going through the ring. src has to stay alive
+  // until the point returned by the next flush() completed.
+  void copy(VkBuffer src, VkDeviceSize src_offset, VkBuffer dst,
+            VkDeviceSize dst_offset, VkDeviceSize size) {
+    std::lock_guard<std::mutex> lock(mutex);
+    StagingCopy copy{};
+    copy.src = src;
+    copy.dst = dst;
+    copy.region.srcOffset = src_offset;
+    copy.region.dstOffset = dst_offset;
+    copy.region.size = size;
+    pending.push_back(copy);
+  }
+
+  // Queues a copy of pixels into mip 0, layer 0 of image. The image has to
+  // be in UNDEFINED layout and is SHADER_READ_ONLY_OPTIMAL once the upload
+  // completed. Sharing between the transfer and graphics families is the
+  // caller's, as for buffers.
+  void upload_image(VkImage dst, VkExtent3D extent, const void *pixels,
+                    VkDeviceSize size) {
+    if (size > capacity / 2) {
+      throw std::runtime_error("image too large for staging ring");
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    VkDeviceSize ring_offset = reserve(size);
+    memcpy(ring_data + ring_offset, pixels, size);
+    StagingImageCopy copy{};
+    copy.dst = dst;
+    copy.region.bufferOffset = ring_offset;
+    copy.region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    copy.region.imageSubresource.layerCount = 1;
+    copy.region.imageExtent = extent;
+    pending_images.push_back(copy);
+  }
+
+  // Submits all pending copies. Returns the point covering them and every
+  // earlier upload.
+  TimelinePoint flush() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return flush_pending();
+  }
+
+  bool is_complete(TimelinePoint point) {
+    std::lock_guard<std::mutex> lock(mutex);
+    reclaim();
+    return timeline->is_complete(point);
+  }
+
+  void wait(TimelinePoint point) {
+    timeline->wait(point);
+    std::lock_guard<std::mutex> lock(mutex);
+    reclaim();
+  }
+
+  void destroy() {
+    wait(flush());
+    free_batches.clear();
+    vkDestroyCommandPool(device, command_pool, nullptr);
+  }
+
+private:
+  TimelinePoint flush_pending() {
+    if (pending.empty() && pending_images.empty()) {
+      return last_point;
+    }
+    StagingBatch batch = acquire_batch();
+    batch.ring_end = head;
+    VkCommandBufferBeginInfo begin_info{};
+    begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    vkBeginCommandBuffer(batch.command_buffer, &begin_info);
+    std::stable_sort(pending.begin(), pending.end(),
+                     [](const StagingCopy &a, const StagingCopy &b) {
+                       return a.src != b.src ? a.src < b.src : a.dst < b.dst;
+                     });
+    regions.clear();
+    for (size_t i = 0; i < pending.size(); i++) {
+      regions.push_back(pending[i].region);
+      if (i + 1 == pending.size() || pending[i + 1].src != pending[i].src ||
+          pending[i + 1].dst != pending[i].dst) {
+        vkCmdCopyBuffer(batch.command_buffer, pending[i].src, pending[i].dst,
+                        static_cast<uint32_t>(regions.size()),
+                        regions.data());
+        regions.clear();
+      }
+    }
+    record_image_copies(batch.command_buffer);
+    vkEndCommandBuffer(batch.command_buffer);
+    batch.point = timeline->submit(TIMELINE_TRANSFER, batch.command_buffer);
+    pending.clear();
+    pending_images.clear();
+    in_flight.push_back(batch);
+    last_point = batch.point;
+    return batch.point;
+  }
+
+  // Consumers wait on the batch's timeline point, which makes the writes
+  // visible to them, so the final barrier only needs the layout change.
+  void record_image_copies(VkCommandBuffer command_buffer) {
+    if (pending_images.empty()) {
+      return;
+    }
+    image_barriers.clear();
+    for (const auto &copy : pending_images) {
+      VkImageMemoryBarrier barrier{};
+      barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+      barrier.srcAccessMask = 0;
+      barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+      barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+      barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+      barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+      barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+      barrier.image = copy.dst;
+      barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+      barrier.subresourceRange.levelCount = 1;
+      barrier.subresourceRange.layerCount = 1;
+      image_barriers.push_back(barrier);
+    }
+    vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                         VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0,
+                         nullptr, static_cast<uint32_t>(image_barriers.size()),
+                         image_barriers.data());
+    for (const auto &copy : pending_images) {
+      vkCmdCopyBufferToImage(command_buffer, ring_buffer, copy.dst,
+                             VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1,
+                             &copy.region);
+    }
+    for (auto &barrier : image_barriers) {
+      barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+      barrier.dstAccessMask = 0;
+      barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+      barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    }
+    vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, nullptr,
+                         0, nullptr,
+                         static_cast<uint32_t>(image_barriers.size()),
+                         image_barriers.data());
+  }
+
+  // Returns the ring offset of size free bytes, waiting on the oldest batch
+  // when the ring is full.
+  VkDeviceSize reserve(VkDeviceSize size) {
+    if (in_flight.empty() && pending.empty() && pending_images.empty()) {
+      head = 0;
+      tail = 0;
+    }
+    head = (head + STAGING_RING_ALIGNMENT - 1) & ~(STAGING_RING_ALIGNMENT - 1);
+    VkDeviceSize offset = head % capacity;
+    VkDeviceSize padding = offset + size > capacity ? capacity - offset : 0;
+    while (head + padding + size - tail > capacity) {
+      if (in_flight.empty()) {
+        // Pending copies still read from the ring, push them out first.
+        flush_pending();
+      }
+      timeline->wait(in_flight.front().point);
+      reclaim();
+    }
+    head += padding;
+    VkDeviceSize ring_offset = head % capacity;
+    head += size;
+    return ring_offset;
+  }
+
+  void reclaim() {
+    if (in_flight.empty()) {
+      return;
+    }
+    uint64_t completed = timeline->completed_value(TIMELINE_TRANSFER);
+    while (!in_flight.empty() && in_flight.front().point.value <= completed) {
+      StagingBatch batch = in_flight.front();
+      in_flight.pop_front();
+      tail = batch.ring_end;
+      vkResetCommandBuffer(batch.command_buffer, 0);
+      free_batches.push_back(batch);
+    }
+  }
+
+  StagingBatch acquire_batch() {
+    reclaim();
+    if (!free_batches.empty()) {
+      StagingBatch batch = free_batches.back();
+      free_batches.pop_back();
+      return batch;
+    }
+    StagingBatch batch{};
+    VkCommandBufferAllocateInfo alloc_info{};
+    alloc_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    alloc_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    alloc_info.commandPool = command_pool;
+    alloc_info.commandBufferCount = 1;
+    if (vkAllocateCommandBuffers(device, &alloc_info, &batch.command_buffer) !=
+        VK_SUCCESS) {
+      throw std::runtime_error("failed to allocate transfer command buffer");
+    }
+    return batch;
+  }
+
+  VkDevice device = VK_NULL_HANDLE;
+  TimelineScheduler *timeline = nullptr;
+  VkCommandPool command_pool = VK_NULL_HANDLE;
+  VkBuffer ring_buffer = VK_NULL_HANDLE;
+  char *ring_data = nullptr;
+  VkDeviceSize capacity = 0;
+  // Monotonic byte counters, the ring position is counter % capacity.
+  uint64_t head = 0;
+  uint64_t tail = 0;
+  TimelinePoint last_point{TIMELINE_TRANSFER, 0};
+  std::vector<StagingCopy> pending;
+  std::vector<StagingImageCopy> pending_images;
+  std::vector<VkBufferCopy> regions;
+  std::vector<VkImageMemoryBarrier> image_barriers;
+  std::deque<StagingBatch> in_flight;
+  std::vector<StagingBatch> free_batches;
+  std::mutex mutex;
+};
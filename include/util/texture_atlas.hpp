@@ -0,0 +1,127 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <stdexcept>
+#include <vector>
+
+const uint32_t TEXTURE_ATLAS_PAGE_SIZE = 1024;
+// Edge pixels are repeated this far around every sprite, so filtering never
+// picks up a neighbour.
+const uint32_t TEXTURE_ATLAS_PADDING = 2;
+
+// Pixel rectangle of one sprite inside its page, without padding.
+struct AtlasRegion {
+  uint32_t page;
+  uint32_t x;
+  uint32_t y;
+  uint32_t width;
+  uint32_t height;
+};
+
+struct AtlasShelf {
+  uint32_t y;
+  uint32_t height;
+  uint32_t width_used;
+};
+
+// Packs RGBA8 sprites into square pages with a shelf packer. Every page is
+// a row of shelves, a sprite goes onto the shelf it wastes the least height
+// on and opens a new shelf or page when none fits. Pages are meant to be
+// uploaded as one image each and indexed by page in a bindless array.
+class TextureAtlas {
+public:
+  explicit TextureAtlas(uint32_t page_size = TEXTURE_ATLAS_PAGE_SIZE,
+                        uint32_t padding = TEXTURE_ATLAS_PADDING)
+      : page_size(page_size), padding(padding) {}
+
+  // Returns the sprite index of pixels, width * height packed RGBA8 values
+  // in row order.
+  uint32_t add(uint32_t width, uint32_t height, const uint32_t *pixels) {
+    uint32_t padded_width = width + 2 * padding;
+    uint32_t padded_height = height + 2 * padding;
+    if (padded_width > page_size || padded_height > page_size) {
+      throw std::runtime_error("sprite larger than atlas page");
+    }
+    AtlasRegion region{};
+    region.width = width;
+    region.height = height;
+    place(padded_width, padded_height, region);
+    std::vector<uint32_t> &page = pages[region.page];
+    // Clamps the source coordinate, which repeats the edges into the
+    // padding.
+    for (uint32_t y = 0; y < padded_height; y++) {
+      uint32_t src_y = std::min(y > padding ? y - padding : 0, height - 1);
+      for (uint32_t x = 0; x < padded_width; x++) {
+        uint32_t src_x = std::min(x > padding ? x - padding : 0, width - 1);
+        page[(region.y + y) * page_size + region.x + x] =
+            pixels[src_y * width + src_x];
+      }
+    }
+    region.x += padding;
+    region.y += padding;
+    regions.push_back(region);
+    return static_cast<uint32_t>(regions.size() - 1);
+  }
+
+  const AtlasRegion &region(uint32_t sprite) const { return regions[sprite]; }
+
+  uint32_t sprite_count() const {
+    return static_cast<uint32_t>(regions.size());
+  }
+
+  uint32_t page_count() const { return static_cast<uint32_t>(pages.size()); }
+
+  const std::vector<uint32_t> &page_pixels(uint32_t page) const {
+    return pages[page];
+  }
+
+  uint32_t get_page_size() const { return page_size; }
+
+private:
+  // Finds room for a padded sprite, region gets page and the padded
+  // top left corner.
+  void place(uint32_t width, uint32_t height, AtlasRegion &region) {
+    uint32_t page = static_cast<uint32_t>(pages.size());
+    AtlasShelf *best = nullptr;
+    for (uint32_t p = 0; p < shelves.size(); p++) {
+      for (auto &shelf : shelves[p]) {
+        if (shelf.height >= height && shelf.width_used + width <= page_size &&
+            (!best || shelf.height < best->height)) {
+          best = &shelf;
+          page = p;
+        }
+      }
+    }
+    if (!best) {
+      // Open a shelf on the first page with enough height left.
+      for (page = 0; page < shelves.size(); page++) {
+        uint32_t top = shelves[page].empty() ? 0
+                                             : shelves[page].back().y +
+                                                   shelves[page].back().height;
+        if (top + height <= page_size) {
+          break;
+        }
+      }
+      if (page == shelves.size()) {
+        shelves.emplace_back();
+        pages.emplace_back(page_size * page_size, 0);
+      }
+      uint32_t top = shelves[page].empty() ? 0
+                                           : shelves[page].back().y +
+                                                 shelves[page].back().height;
+      shelves[page].push_back({top, height, 0});
+      best = &shelves[page].back();
+    }
+    region.page = page;
+    region.x = best->width_used;
+    region.y = best->y;
+    best->width_used += width;
+  }
+
+  uint32_t page_size;
+  uint32_t padding;
+  std::vector<std::vector<AtlasShelf>> shelves;
+  std::vector<std::vector<uint32_t>> pages;
+  std::vector<AtlasRegion> regions;
+};
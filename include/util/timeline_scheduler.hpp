@@ -0,0 +1,183 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <mutex>
+#include <stdexcept>
+#include <vector>
+
+#include <vulkan/vulkan_core.h>
+
+enum TimelineQueue {
+  TIMELINE_GRAPHICS,
+  TIMELINE_COMPUTE,
+  TIMELINE_TRANSFER,
+  TIMELINE_QUEUE_COUNT,
+};
+
+// Position on the timeline of one queue. Value 0 is complete from the start.
+struct TimelinePoint {
+  TimelineQueue queue = TIMELINE_GRAPHICS;
+  uint64_t value = 0;
+};
+
+struct TimelineWait {
+  TimelinePoint point;
+  VkPipelineStageFlags stage;
+};
+
+// Tracks every submission with timeline semaphores instead of fences. All
+// queues draw their signal values from one counter, so a point names exactly
+// one submission. Each queue still signals its own semaphore, a timeline can
+// not move backwards and queues finish out of order. Roles may share a queue,
+// submits are serialized since vkQueueSubmit needs the queue externally
+// synchronized.
+class TimelineScheduler {
+public:
+  void init(VkDevice device, VkQueue graphics_queue, VkQueue compute_queue,
+            VkQueue transfer_queue) {
+    this->device = device;
+    queues = {graphics_queue, compute_queue, transfer_queue};
+    VkSemaphoreTypeCreateInfo type_info{};
+    type_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO;
+    type_info.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE;
+    type_info.initialValue = 0;
+    VkSemaphoreCreateInfo semaphore_info{};
+    semaphore_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+    semaphore_info.pNext = &type_info;
+    for (auto &semaphore : semaphores) {
+      if (vkCreateSemaphore(device, &semaphore_info, nullptr, &semaphore) !=
+          VK_SUCCESS) {
+        throw std::runtime_error("failed to create timeline semaphore");
+      }
+    }
+  }
+
+  // Binary semaphores are only for the swap chain, which can not wait on or
+  // signal timelines.
+  TimelinePoint submit(TimelineQueue queue, VkCommandBuffer command_buffer,
+                       const std::vector<TimelineWait> &waits = {},
+                       VkSemaphore binary_wait = VK_NULL_HANDLE,
+                       VkPipelineStageFlags binary_wait_stage = 0,
+                       VkSemaphore binary_signal = VK_NULL_HANDLE) {
+    std::lock_guard<std::mutex> lock(mutex);
+    wait_semaphores.clear();
+    wait_values.clear();
+    wait_stages.clear();
+    for (const auto &wait : waits) {
+      if (wait.point.value == 0) {
+        continue;
+      }
+      wait_semaphores.push_back(semaphores[wait.point.queue]);
+      wait_values.push_back(wait.point.value);
+      wait_stages.push_back(wait.stage);
+    }
+    if (binary_wait != VK_NULL_HANDLE) {
+      wait_semaphores.push_back(binary_wait);
+      wait_values.push_back(0);
+      wait_stages.push_back(binary_wait_stage);
+    }
+    TimelinePoint point{queue, ++counter};
+    VkSemaphore signal_semaphores[] = {semaphores[queue], binary_signal};
+    uint64_t signal_values[] = {point.value, 0};
+    uint32_t signal_count = binary_signal != VK_NULL_HANDLE ? 2 : 1;
+    VkTimelineSemaphoreSubmitInfo timeline_info{};
+    timeline_info.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+    timeline_info.waitSemaphoreValueCount =
+        static_cast<uint32_t>(wait_values.size());
+    timeline_info.pWaitSemaphoreValues = wait_values.data();
+    timeline_info.signalSemaphoreValueCount = signal_count;
+    timeline_info.pSignalSemaphoreValues = signal_values;
+    VkSubmitInfo submit_info{};
+    submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submit_info.pNext = &timeline_info;
+    submit_info.waitSemaphoreCount =
+        static_cast<uint32_t>(wait_semaphores.size());
+    submit_info.pWaitSemaphores = wait_semaphores.data();
+    submit_info.pWaitDstStageMask = wait_stages.data();
+    submit_info.commandBufferCount = 1;
+    submit_info.pCommandBuffers = &command_buffer;
+    submit_info.signalSemaphoreCount = signal_count;
+    submit_info.pSignalSemaphores = signal_semaphores;
+    if (vkQueueSubmit(queues[queue], 1, &submit_info, VK_NULL_HANDLE) !=
+        VK_SUCCESS) {
+      throw std::runtime_error("failed to submit command buffer");
+    }
+    last_submitted[queue] = point.value;
+    return point;
+  }
+
+  // Presents under the lock submits take, the present queue is usually one
+  // of the scheduler's queues and needs the same external synchronization.
+  // Submits from other threads wait while a present blocks.
+  VkResult present(VkQueue queue, const VkPresentInfoKHR &present_info) {
+    std::lock_guard<std::mutex> lock(mutex);
+    return vkQueuePresentKHR(queue, &present_info);
+  }
+
+  // vkDeviceWaitIdle synchronizes every queue as well.
+  void wait_device_idle() {
+    std::lock_guard<std::mutex> lock(mutex);
+    vkDeviceWaitIdle(device);
+  }
+
+  uint64_t completed_value(TimelineQueue queue) {
+    uint64_t value = 0;
+    vkGetSemaphoreCounterValue(device, semaphores[queue], &value);
+    return value;
+  }
+
+  // Point of the latest submission to queue, 0 before the first.
+  TimelinePoint last_point(TimelineQueue queue) {
+    std::lock_guard<std::mutex> lock(mutex);
+    return {queue, last_submitted[queue]};
+  }
+
+  bool is_complete(TimelinePoint point) {
+    return point.value == 0 || completed_value(point.queue) >= point.value;
+  }
+
+  void wait(TimelinePoint point) {
+    if (point.value == 0) {
+      return;
+    }
+    VkSemaphoreWaitInfo wait_info{};
+    wait_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO;
+    wait_info.semaphoreCount = 1;
+    wait_info.pSemaphores = &semaphores[point.queue];
+    wait_info.pValues = &point.value;
+    if (vkWaitSemaphores(device, &wait_info, UINT64_MAX) != VK_SUCCESS) {
+      throw std::runtime_error("failed to wait for timeline semaphore");
+    }
+  }
+
+  // Waits for everything submitted through the scheduler.
+  void wait_idle() {
+    std::array<uint64_t, TIMELINE_QUEUE_COUNT> values;
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      values = last_submitted;
+    }
+    for (uint32_t queue = 0; queue < TIMELINE_QUEUE_COUNT; queue++) {
+      wait({(TimelineQueue)queue, values[queue]});
+    }
+  }
+
+  void destroy() {
+    for (auto &semaphore : semaphores) {
+      vkDestroySemaphore(device, semaphore, nullptr);
+      semaphore = VK_NULL_HANDLE;
+    }
+  }
+
+private:
+  VkDevice device = VK_NULL_HANDLE;
+  std::array<VkQueue, TIMELINE_QUEUE_COUNT> queues{};
+  std::array<VkSemaphore, TIMELINE_QUEUE_COUNT> semaphores{};
+  std::array<uint64_t, TIMELINE_QUEUE_COUNT> last_submitted{};
+  uint64_t counter = 0;
+  std::mutex mutex;
+  std::vector<VkSemaphore> wait_semaphores;
+  std::vector<uint64_t> wait_values;
+  std::vector<VkPipelineStageFlags> wait_stages;
+};
@@ -0,0 +1,157 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+
+#include <glm/glm.hpp>
+#include <vulkan/vulkan_core.h>
+
+// Packed attribute types. Each one is the exact memory image of its Vulkan
+// format, the shader sees the decoded value.
+
+// Two signed normalized 16 bit values, -1..1.
+struct Snorm16x2 {
+  int16_t x;
+  int16_t y;
+
+  static Snorm16x2 pack(glm::vec2 v) {
+    return {quantize(v.x), quantize(v.y)};
+  }
+
+  static int16_t quantize(float value) {
+    return (int16_t)std::lround(std::clamp(value, -1.0f, 1.0f) * 32767.0f);
+  }
+};
+
+struct Uint16x2 {
+  uint16_t x;
+  uint16_t y;
+};
+
+// RGBA8 in memory order, what VK_FORMAT_R8G8B8A8_UNORM reads.
+struct Unorm8x4 {
+  uint32_t packed;
+
+  static Unorm8x4 pack(glm::vec3 color, float alpha = 1.0f) {
+    return {quantize(color.x) | quantize(color.y) << 8 |
+            quantize(color.z) << 16 | quantize(alpha) << 24};
+  }
+
+  static uint32_t quantize(float value) {
+    return (uint32_t)std::lround(std::clamp(value, 0.0f, 1.0f) * 255.0f);
+  }
+};
+
+// 10 bits per color channel and 2 bits alpha, packed as
+// VK_FORMAT_A2B10G10R10_UNORM_PACK32 with red in the low bits.
+struct Unorm10x3A2 {
+  uint32_t packed;
+
+  static Unorm10x3A2 pack(glm::vec3 color, float alpha = 1.0f) {
+    return {quantize(color.x, 1023.0f) | quantize(color.y, 1023.0f) << 10 |
+            quantize(color.z, 1023.0f) << 20 | quantize(alpha, 3.0f) << 30};
+  }
+
+  static uint32_t quantize(float value, float max) {
+    return (uint32_t)std::lround(std::clamp(value, 0.0f, 1.0f) * max);
+  }
+};
+
+// Vulkan format of every attribute type. Types without a specialization can
+// not be used in a vertex layout.
+template <typename T> struct VertexFormat;
+
+template <> struct VertexFormat<float> {
+  static constexpr VkFormat format = VK_FORMAT_R32_SFLOAT;
+};
+template <> struct VertexFormat<glm::vec2> {
+  static constexpr VkFormat format = VK_FORMAT_R32G32_SFLOAT;
+};
+template <> struct VertexFormat<glm::vec3> {
+  static constexpr VkFormat format = VK_FORMAT_R32G32B32_SFLOAT;
+};
+template <> struct VertexFormat<glm::vec4> {
+  static constexpr VkFormat format = VK_FORMAT_R32G32B32A32_SFLOAT;
+};
+template <> struct VertexFormat<uint32_t> {
+  static constexpr VkFormat format = VK_FORMAT_R32_UINT;
+};
+template <> struct VertexFormat<Snorm16x2> {
+  static constexpr VkFormat format = VK_FORMAT_R16G16_SNORM;
+};
+template <> struct VertexFormat<Uint16x2> {
+  static constexpr VkFormat format = VK_FORMAT_R16G16_UINT;
+};
+template <> struct VertexFormat<Unorm8x4> {
+  static constexpr VkFormat format = VK_FORMAT_R8G8B8A8_UNORM;
+};
+template <> struct VertexFormat<Unorm10x3A2> {
+  static constexpr VkFormat format = VK_FORMAT_A2B10G10R10_UNORM_PACK32;
+};
+
+struct VertexAttribute {
+  uint32_t offset;
+  VkFormat format;
+  uint32_t size;
+};
+
+template <typename T> constexpr VertexAttribute vertex_attribute(size_t offset) {
+  return {static_cast<uint32_t>(offset), VertexFormat<T>::format,
+          static_cast<uint32_t>(sizeof(T))};
+}
+
+// Describes one member of a vertex struct, for use in a VertexLayout
+// specialization.
+#define VERTEX_ATTRIBUTE(type, member)                                         \
+  vertex_attribute<decltype(type::member)>(offsetof(type, member))
+
+// Specialized next to every vertex struct with its input rate and its
+// members in shader location order:
+//
+//   template <> struct VertexLayout<Vertex> {
+//     static constexpr VkVertexInputRate input_rate =
+//         VK_VERTEX_INPUT_RATE_VERTEX;
+//     static constexpr std::array<VertexAttribute, 2> attributes = {
+//         VERTEX_ATTRIBUTE(Vertex, pos), VERTEX_ATTRIBUTE(Vertex, color)};
+//   };
+template <typename V> struct VertexLayout;
+
+template <typename V> constexpr bool vertex_layout_fits() {
+  for (const auto &attribute : VertexLayout<V>::attributes) {
+    if (attribute.offset + attribute.size > sizeof(V)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+template <typename V>
+constexpr VkVertexInputBindingDescription vertex_binding(uint32_t binding) {
+  static_assert(vertex_layout_fits<V>(), "vertex attribute outside struct");
+  VkVertexInputBindingDescription description{};
+  description.binding = binding;
+  description.stride = sizeof(V);
+  description.inputRate = VertexLayout<V>::input_rate;
+  return description;
+}
+
+// Attributes of V read from binding, at consecutive locations starting with
+// first_location.
+template <typename V>
+constexpr std::array<VkVertexInputAttributeDescription,
+                     VertexLayout<V>::attributes.size()>
+vertex_attributes(uint32_t binding, uint32_t first_location) {
+  std::array<VkVertexInputAttributeDescription,
+             VertexLayout<V>::attributes.size()>
+      descriptions{};
+  for (size_t i = 0; i < descriptions.size(); i++) {
+    descriptions[i].location = first_location + static_cast<uint32_t>(i);
+    descriptions[i].binding = binding;
+    descriptions[i].format = VertexLayout<V>::attributes[i].format;
+    descriptions[i].offset = VertexLayout<V>::attributes[i].offset;
+  }
+  return descriptions;
+}
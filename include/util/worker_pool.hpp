@@ -0,0 +1,99 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fork-join pool: run() hands the same task to every worker, passing the
+// worker index, and returns once all of them finished. The calling thread
+// acts as worker 0, so a pool of size one spawns no threads at all.
+class WorkerPool {
+public:
+  void init(uint32_t worker_count) {
+    this->worker_count = worker_count;
+    for (uint32_t i = 1; i < worker_count; i++) {
+      threads.emplace_back(&WorkerPool::worker_main, this, i);
+    }
+  }
+
+  uint32_t size() const { return worker_count; }
+
+  void run(const std::function<void(uint32_t)> &task) {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      this->task = &task;
+      remaining = worker_count - 1;
+      error = nullptr;
+      generation++;
+    }
+    start_cv.notify_all();
+    try {
+      task(0);
+    } catch (...) {
+      std::lock_guard<std::mutex> lock(mutex);
+      error = std::current_exception();
+    }
+    std::unique_lock<std::mutex> lock(mutex);
+    done_cv.wait(lock, [this] { return remaining == 0; });
+    this->task = nullptr;
+    if (error) {
+      std::rethrow_exception(error);
+    }
+  }
+
+  void destroy() {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      stopping = true;
+    }
+    start_cv.notify_all();
+    for (auto &thread : threads) {
+      thread.join();
+    }
+    threads.clear();
+  }
+
+private:
+  void worker_main(uint32_t index) {
+    uint64_t seen = 0;
+    while (true) {
+      const std::function<void(uint32_t)> *current;
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        start_cv.wait(lock,
+                      [this, seen] { return stopping || generation != seen; });
+        if (stopping) {
+          return;
+        }
+        seen = generation;
+        current = task;
+      }
+      try {
+        (*current)(index);
+      } catch (...) {
+        std::lock_guard<std::mutex> lock(mutex);
+        error = std::current_exception();
+      }
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        remaining--;
+      }
+      done_cv.notify_one();
+    }
+  }
+
+  uint32_t worker_count = 1;
+  std::vector<std::thread> threads;
+  std::mutex mutex;
+  std::condition_variable start_cv;
+  std::condition_variable done_cv;
+  const std::function<void(uint32_t)> *task = nullptr;
+  uint64_t generation = 0;
+  uint32_t remaining = 0;
+  std::exception_ptr error;
+  bool stopping = false;
+};
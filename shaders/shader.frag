@@ -1,9 +1,49 @@
 #version 450
+#extension GL_EXT_nonuniform_qualifier : require
 
 layout(location = 0) in vec3 fragColor;
+layout(location = 1) in vec2 fragUv;
+layout(location = 2) flat in uint fragPage;
+layout(location = 3) in float fragDepth;
 
 layout(location = 0) out vec4 outColor;
 
+// Material features, constant_id is the TileFeature bit. Disabled features
+// are compiled out, see TilePermutation.
+layout(constant_id = 0) const bool ENABLE_TINT = true;
+layout(constant_id = 1) const bool ENABLE_LIGHTING = false;
+layout(constant_id = 2) const bool ENABLE_FOG = false;
+
+const vec3 LIGHT_DIR = vec3(-0.5, -0.5, 0.7071);
+const float LIGHT_AMBIENT = 0.6;
+// Height of the texture relief the lighting derives its normals from.
+const float LIGHT_RELIEF = 0.05;
+const vec3 FOG_COLOR = vec3(0.55, 0.6, 0.7);
+const float FOG_START = 0.4;
+
+layout(set = 1, binding = 0) uniform sampler texture_sampler;
+// Atlas pages, a draw may mix sprites from any of them.
+layout(set = 1, binding = 2) uniform texture2D textures[];
+
 void main() {
-    outColor = vec4(fragColor, 1.0);
+    vec4 texel = texture(
+        sampler2D(textures[nonuniformEXT(fragPage)], texture_sampler), fragUv);
+    vec3 color = texel.rgb;
+    if (ENABLE_TINT) {
+        color *= fragColor;
+    }
+    if (ENABLE_LIGHTING) {
+        // Texture brightness as a height field, its screen space slope
+        // gives the normal.
+        float height = dot(texel.rgb, vec3(0.299, 0.587, 0.114));
+        vec3 normal = normalize(vec3(-dFdx(height), -dFdy(height),
+                                     LIGHT_RELIEF));
+        float diffuse = max(dot(normal, LIGHT_DIR), 0.0);
+        color *= LIGHT_AMBIENT + (1.0 - LIGHT_AMBIENT) * diffuse;
+    }
+    if (ENABLE_FOG) {
+        float fog = smoothstep(FOG_START, 1.0, fragDepth);
+        color = mix(color, FOG_COLOR, fog);
+    }
+    outColor = vec4(color, texel.a);
 }
@@ -2,10 +2,54 @@
 
 layout(location = 0) in vec2 inPosition;
 layout(location = 1) in vec3 inColor;
+layout(location = 2) in uvec2 inGrid;
+layout(location = 3) in uint inTileType;
+layout(location = 4) in vec4 inTileColor;
 
 layout(location = 0) out vec3 fragColor;
+layout(location = 1) out vec2 fragUv;
+layout(location = 2) flat out uint fragPage;
+// 0 at the bottom of the screen, 1 at the top, which is the far end of the
+// isometric view.
+layout(location = 3) out float fragDepth;
+
+const uint TILE_WATER = 5;
+
+layout(set = 0, binding = 0) uniform Frame {
+    mat4 view_proj;
+    float time;
+    float delta_time;
+    uint frame;
+};
+
+struct Sprite {
+    vec4 uv_rect;
+    uint page;
+};
+
+// Tile types use the sprite of the same index.
+layout(std430, set = 1, binding = 1) readonly buffer Sprites {
+    Sprite sprites[];
+};
+
+layout(push_constant) uniform Push {
+    uint lod;
+};
 
 void main() {
-    gl_Position = vec4(inPosition, 0.0, 1.0);
-    fragColor = inColor;
+    // Project the tile quad onto the isometric diamond.
+    vec2 world = vec2(inGrid) + inPosition + 0.5;
+    gl_Position = view_proj * vec4(world, 0.0, 1.0);
+    fragDepth = 0.5 - 0.5 * gl_Position.y;
+    // Nearer the bottom of the screen is in front, see sort_visible_chunks().
+    gl_Position.z = fragDepth;
+    vec3 color = inColor * inTileColor.rgb;
+    // Water shimmers, the coarse LOD is too small on screen to show it.
+    if (lod == 0 && inTileType == TILE_WATER) {
+        color *= 0.9 + 0.1 * sin(time * 2.0 + (world.x + world.y) * 0.5);
+    }
+    fragColor = color;
+    Sprite sprite = sprites[inTileType];
+    fragUv = mix(sprite.uv_rect.xy, sprite.uv_rect.zw, inPosition + 0.5);
+    fragPage = sprite.page;
 }
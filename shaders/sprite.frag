@@ -0,0 +1,23 @@
+#version 450
+#extension GL_EXT_nonuniform_qualifier : require
+
+layout(location = 0) in vec4 fragColor;
+layout(location = 1) in vec2 fragUv;
+layout(location = 2) flat in uint fragPage;
+
+layout(location = 0) out vec4 outColor;
+
+const uint SPRITE_NO_TEXTURE = 0xffffffffu;
+
+layout(set = 1, binding = 0) uniform sampler texture_sampler;
+layout(set = 1, binding = 2) uniform texture2D textures[];
+
+void main() {
+    vec4 color = fragColor;
+    if (fragPage != SPRITE_NO_TEXTURE) {
+        color *= texture(
+            sampler2D(textures[nonuniformEXT(fragPage)], texture_sampler),
+            fragUv);
+    }
+    outColor = color;
+}
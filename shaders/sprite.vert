@@ -0,0 +1,39 @@
+#version 450
+
+layout(location = 0) in vec2 inPosition;
+layout(location = 1) in vec2 inUv;
+layout(location = 2) in vec4 inColor;
+layout(location = 3) in uint inPage;
+
+layout(location = 0) out vec4 fragColor;
+layout(location = 1) out vec2 fragUv;
+layout(location = 2) flat out uint fragPage;
+
+// SpriteSpace.
+const uint SPRITE_SPACE_SCREEN = 1;
+
+layout(set = 0, binding = 0) uniform Frame {
+    mat4 view_proj;
+    float time;
+    float delta_time;
+    uint frame;
+};
+
+layout(push_constant) uniform Push {
+    // Pixels to clip space, 2 / extent.
+    vec2 screen_scale;
+    uint space;
+};
+
+void main() {
+    if (space == SPRITE_SPACE_SCREEN) {
+        gl_Position = vec4(inPosition * screen_scale - 1.0, 0.0, 1.0);
+    } else {
+        gl_Position = view_proj * vec4(inPosition, 0.0, 1.0);
+    }
+    // Drawn over the tiles, without depth test.
+    gl_Position.z = 0.0;
+    fragColor = inColor;
+    fragUv = inUv;
+    fragPage = inPage;
+}
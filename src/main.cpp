@@ -1,14 +1,21 @@
 #include <algorithm>
 #include <array>
+#include <atomic>
+#include <chrono>
 #include <cstddef>
 #include <cstdint>
 #include <cstring>
+#include <exception>
 #include <glm/fwd.hpp>
 #include <limits>
 #include <math.h>
+#include <memory>
+#include <mutex>
 #include <optional>
 #include <ostream>
 #include <set>
+#include <string>
+#include <thread>
 #include <vector>
 
 #include <vulkan/vulkan_core.h>
@@ -17,7 +24,31 @@
 
 #include <glm/glm.hpp>
 
+#include <util/asset_archive.hpp>
+#include <util/chunk_culling.hpp>
+#include <util/deletion_queue.hpp>
+#include <util/device_selection.hpp>
+#include <util/draw_sort.hpp>
+#include <util/frame_arena.hpp>
+#include <util/frame_graph.hpp>
+#include <util/frame_uniforms.hpp>
+#include <util/gpu_allocator.hpp>
+#include <util/job_system.hpp>
+#include <util/micro_bench.hpp>
+#include <util/mesh_indices.hpp>
+#include <util/pipeline_cache.hpp>
+#include <util/pipeline_registry.hpp>
+#include <util/profiler.hpp>
+#include <util/shader_permutation.hpp>
+#include <util/shader_reloader.hpp>
 #include <util/shader_util.hpp>
+#include <util/simulation.hpp>
+#include <util/sprite_batch.hpp>
+#include <util/staging_uploader.hpp>
+#include <util/texture_atlas.hpp>
+#include <util/timeline_scheduler.hpp>
+#include <util/vertex_layout.hpp>
+#include <util/worker_pool.hpp>
 
 #include <cstdlib>
 #include <iostream>
@@ -25,13 +56,72 @@
 
 const uint32_t WIDTH = 800;
 const uint32_t HEIGHT = 600;
-const int MAX_FRAMES_IN_FLIGHT = 2;
+const uint32_t TILE_MAP_SIZE = 256;
+// Instance grid positions are 16 bit.
+const uint32_t TILE_MAP_MAX_SIZE = 65536;
+// Largest half extent of the default view, in iso units. Bigger maps start
+// zoomed in, so the visible area stays bounded.
+const float CAMERA_DEFAULT_EXTENT = 256.0f;
+const float CAMERA_MIN_EXTENT = 8.0f;
+// Pan speed in view extents per second, zoom factor per second.
+const float CAMERA_PAN_SPEED = 1.0f;
+const float CAMERA_ZOOM_SPEED = 2.0f;
+// Tiles narrower than this on screen drop their border, see tile_lods.
+const float TILE_LOD0_MIN_PIXELS = 16.0f;
+const float TILE_BORDER = 0.0625f;
+const float TILE_BORDER_SHADE = 0.35f;
+const uint32_t MAX_RECORD_THREADS = 16;
+const uint32_t PIPELINE_COMPILE_THREADS = 2;
+const uint32_t MAX_JOB_THREADS = 8;
+// Timestamp scopes, GPU_SCOPE_SLICE + worker is the draw group of a worker.
+const uint32_t GPU_SCOPE_TILE_COMPUTE = 0;
+const uint32_t GPU_SCOPE_RENDER_PASS = 1;
+const uint32_t GPU_SCOPE_SLICE = 2;
+// Set to a file name to write a Chrome trace of the recorded frames on exit.
+const char *PROFILER_TRACE_ENV = "ISOMETRIC_TRACE";
+// Device UUID to run on instead of the best scoring GPU, --device wins.
+const char *DEVICE_UUID_ENV = "ISOMETRIC_DEVICE";
+const char *PIPELINE_CACHE_FILE = "pipeline_cache.bin";
+// Built from the compiled shaders and the generated tile assets by
+// --pack-assets, see pack_assets().
+const char *ASSET_ARCHIVE_FILE = "assets.pak";
+// Upper bound for a single vkWaitForPresentKHR, a missed present must not
+// stall the frame loop.
+const uint64_t PRESENT_WAIT_TIMEOUT = 100000000;
+// Sources watched by --hot-reload.
+const char *SHADER_SOURCE_DIR = "shaders";
+// Seconds between checks for a restored window while minimized.
+const double MINIMIZED_WAIT_TIMEOUT = 0.1;
+// Seconds of world time one simulation tick advances.
+const double SIMULATION_TICK = 1.0 / 60.0;
+// Ticks a late simulation thread catches up on before it drops the rest.
+const uint32_t SIMULATION_MAX_CATCH_UP = 4;
+// Ticks read the latest input, sampling twice per tick is enough.
+const double INPUT_POLL_INTERVAL = SIMULATION_TICK * 0.5;
+// Scenes rendered by --headless when no --tiles are given.
+const std::vector<uint32_t> BENCHMARK_TILE_COUNTS = {10000, 100000, 1000000};
+const uint32_t BENCHMARK_FRAMES = 1000;
+// Frames rendered before measuring, they pay for pipeline and cache warmup.
+const uint32_t BENCHMARK_WARMUP_FRAMES = 16;
+// Upload sizes of --bench grow by 4x from the smallest to the largest.
+const VkDeviceSize MICRO_BENCH_UPLOAD_MIN = 4 * 1024;
+const VkDeviceSize MICRO_BENCH_UPLOAD_MAX = 256 * 1024 * 1024;
+const std::vector<uint32_t> MICRO_BENCH_DRAW_COUNTS = {1000, 10000, 100000};
+// Edge lengths in chunks of the grids --bench culls.
+const std::vector<uint32_t> MICRO_BENCH_CHUNK_GRIDS = {32, 128, 512};
 const std::vector<const char *> validation_layers = {
     "VK_LAYER_KHRONOS_validation",
 };
 const std::vector<const char *> device_extensions = {
     VK_KHR_SWAPCHAIN_EXTENSION_NAME,
 };
+// Used where available, every one raises the device score.
+const std::vector<const char *> optional_device_extensions = {
+    VK_KHR_DYNAMIC_RENDERING_EXTENSION_NAME,
+    VK_EXT_EXTERNAL_MEMORY_HOST_EXTENSION_NAME,
+    VK_KHR_PRESENT_WAIT_EXTENSION_NAME,
+    VK_KHR_SYNCHRONIZATION_2_EXTENSION_NAME,
+};
 
 #ifdef NDEBUG
 const bool enable_validation_layers = false;
@@ -39,9 +129,178 @@ const bool enable_validation_layers = false;
 const bool enable_validation_layers = true;
 #endif
 
+// Fragment shader features of the tile material, the bit index is the
+// constant_id in shader.frag.
+enum TileFeature : uint32_t {
+  TILE_FEATURE_TINT,
+  TILE_FEATURE_LIGHTING,
+  TILE_FEATURE_FOG,
+  TILE_FEATURE_COUNT,
+};
+
+typedef PermutationKey<TileFeature, TILE_FEATURE_COUNT> TilePermutation;
+
+// Compiled before the first frame, every other variant falls back to it.
+constexpr TilePermutation TILE_DEFAULT_PERMUTATION =
+    TilePermutation{}.with(TILE_FEATURE_TINT);
+
+enum LatencyMode {
+  LATENCY_LOW,
+  LATENCY_BALANCED,
+  LATENCY_THROUGHPUT,
+};
+
+struct LatencyProfile {
+  uint32_t frames_in_flight;
+  // Swap chain images requested on top of minImageCount.
+  uint32_t extra_images;
+  // Tried in order, FIFO is the fallback every device supports.
+  std::vector<VkPresentModeKHR> present_modes;
+  // Waits until the previous frame was presented before starting the next
+  // one, if VK_KHR_present_wait is available.
+  bool present_wait;
+};
+
+LatencyProfile latency_profile(LatencyMode mode) {
+  switch (mode) {
+  case LATENCY_LOW:
+    return {1,
+            0,
+            {VK_PRESENT_MODE_IMMEDIATE_KHR, VK_PRESENT_MODE_FIFO_RELAXED_KHR},
+            true};
+  case LATENCY_THROUGHPUT:
+    return {3, 2, {VK_PRESENT_MODE_FIFO_KHR}, false};
+  case LATENCY_BALANCED:
+  default:
+    return {2, 1, {VK_PRESENT_MODE_MAILBOX_KHR}, false};
+  }
+}
+
+struct AppOptions {
+  // Renders into offscreen images without a window or swap chain, then exits
+  // once every scene ran frame_count frames.
+  bool headless = false;
+  uint32_t frame_count = BENCHMARK_FRAMES;
+  std::vector<uint32_t> tile_counts;
+  LatencyMode latency = LATENCY_BALANCED;
+  // Writes the asset archive to this file and exits, without starting
+  // Vulkan.
+  std::string pack_assets;
+  // Records into a VkRenderPass with framebuffers even where
+  // VK_KHR_dynamic_rendering is available.
+  bool render_pass = false;
+  // Recompiles shaders when their sources change, see reload_shaders().
+  bool hot_reload = false;
+  TilePermutation tile_features = TILE_DEFAULT_PERMUTATION;
+  // Pins the physical device, see pick_physical_device().
+  std::optional<DeviceUuid> device_uuid;
+  // Culls on a compute only queue family where there is one.
+  bool async_compute = true;
+  // Runs the micro benchmarks instead of the scenes and writes their
+  // results to this file, see run_micro_benchmarks(). Implies headless.
+  std::string bench_output;
+};
+
+TileFeature parse_tile_feature(const std::string &name) {
+  if (name == "tint") {
+    return TILE_FEATURE_TINT;
+  } else if (name == "lighting") {
+    return TILE_FEATURE_LIGHTING;
+  } else if (name == "fog") {
+    return TILE_FEATURE_FOG;
+  }
+  throw std::runtime_error("unknown tile feature " + name);
+}
+
+AppOptions parse_options(int argc, char **argv) {
+  AppOptions options;
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    if (arg == "--headless") {
+      options.headless = true;
+    } else if (arg == "--frames" && i + 1 < argc) {
+      options.frame_count = std::stoul(argv[++i]);
+    } else if (arg == "--tiles" && i + 1 < argc) {
+      // Comma separated, every count is benchmarked as its own scene.
+      std::string list = argv[++i];
+      size_t start = 0;
+      while (start < list.size()) {
+        size_t end = std::min(list.find(',', start), list.size());
+        unsigned long count = std::stoul(list.substr(start, end - start));
+        // Scenes are square maps with a 16 bit grid and a buffer sized by
+        // their tiles, which needs at least one.
+        uint64_t max_count =
+            std::min((uint64_t)TILE_MAP_MAX_SIZE * TILE_MAP_MAX_SIZE,
+                     (uint64_t)std::numeric_limits<uint32_t>::max());
+        if (count == 0 || count > max_count) {
+          throw std::runtime_error("tile count must be between 1 and " +
+                                   std::to_string(max_count));
+        }
+        options.tile_counts.push_back((uint32_t)count);
+        start = end + 1;
+      }
+    } else if (arg == "--latency" && i + 1 < argc) {
+      std::string mode = argv[++i];
+      if (mode == "low") {
+        options.latency = LATENCY_LOW;
+      } else if (mode == "balanced") {
+        options.latency = LATENCY_BALANCED;
+      } else if (mode == "throughput") {
+        options.latency = LATENCY_THROUGHPUT;
+      } else {
+        throw std::runtime_error("unknown latency mode " + mode);
+      }
+    } else if (arg == "--pack-assets" && i + 1 < argc) {
+      options.pack_assets = argv[++i];
+    } else if (arg == "--render-pass") {
+      options.render_pass = true;
+    } else if (arg == "--hot-reload") {
+      options.hot_reload = true;
+    } else if (arg == "--bench" && i + 1 < argc) {
+      options.bench_output = argv[++i];
+      options.headless = true;
+    } else if (arg == "--no-async-compute") {
+      options.async_compute = false;
+    } else if (arg == "--device" && i + 1 < argc) {
+      options.device_uuid = parse_device_uuid(argv[++i]);
+    } else if (arg == "--features" && i + 1 < argc) {
+      // Comma separated, or none for the bare texture.
+      std::string list = argv[++i];
+      options.tile_features = TilePermutation{};
+      size_t start = 0;
+      while (list != "none" && start < list.size()) {
+        size_t end = std::min(list.find(',', start), list.size());
+        options.tile_features = options.tile_features.with(
+            parse_tile_feature(list.substr(start, end - start)));
+        start = end + 1;
+      }
+    } else {
+      throw std::runtime_error("unknown argument " + arg);
+    }
+  }
+  // Only read without --device, a malformed value must not stop a
+  // command line that overrides it.
+  const char *uuid = std::getenv(DEVICE_UUID_ENV);
+  if (!options.device_uuid && uuid) {
+    options.device_uuid = parse_device_uuid(uuid);
+  }
+  if (options.tile_counts.empty()) {
+    if (options.headless) {
+      options.tile_counts = BENCHMARK_TILE_COUNTS;
+    } else {
+      options.tile_counts = {TILE_MAP_SIZE * TILE_MAP_SIZE};
+    }
+  }
+  return options;
+}
+
 struct QueueFamilyIndices {
   std::optional<uint32_t> graphics_family;
   std::optional<uint32_t> present_family;
+  // Falls back to the graphics family without a dedicated transfer queue.
+  std::optional<uint32_t> transfer_family;
+  // Same for a compute queue.
+  std::optional<uint32_t> compute_family;
 
   bool is_complete() {
     return graphics_family.has_value() && present_family.has_value();
@@ -54,46 +313,310 @@ struct SwapChainSupportDetails {
   std::vector<VkPresentModeKHR> present_modes;
 };
 
+// Position in tile units relative to the tile center.
 struct Vertex {
-  glm::vec2 pos;
-  glm::vec3 color;
-
-  static VkVertexInputBindingDescription binding_description() {
-    VkVertexInputBindingDescription binding_description{};
-    binding_description.binding = 0;
-    binding_description.stride = sizeof(Vertex);
-    binding_description.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
-    return binding_description;
-  }
-
-  static std::array<VkVertexInputAttributeDescription, 2>
-  get_attribute_description() {
-    std::array<VkVertexInputAttributeDescription, 2> attribute_descriptions{};
-    attribute_descriptions[0].binding = 0;
-    attribute_descriptions[0].location = 0;
-    attribute_descriptions[0].format = VK_FORMAT_R32G32_SFLOAT;
-    attribute_descriptions[0].offset = offsetof(Vertex, pos);
-    attribute_descriptions[1].binding = 0;
-    attribute_descriptions[1].location = 1;
-    attribute_descriptions[1].format = VK_FORMAT_R32G32B32_SFLOAT;
-    attribute_descriptions[1].offset = offsetof(Vertex, color);
-    return attribute_descriptions;
+  Snorm16x2 pos;
+  Unorm10x3A2 color;
+};
+
+template <> struct VertexLayout<Vertex> {
+  static constexpr VkVertexInputRate input_rate = VK_VERTEX_INPUT_RATE_VERTEX;
+  static constexpr std::array<VertexAttribute, 2> attributes = {
+      VERTEX_ATTRIBUTE(Vertex, pos), VERTEX_ATTRIBUTE(Vertex, color)};
+};
+
+struct TilePushConstants {
+  IsoViewRect view;
+  uint32_t chunk_count;
+  // Every recording thread draws the tiles of one slice of the visible
+  // chunks.
+  uint32_t chunks_per_slice;
+  uint32_t slice_count;
+  // Screen pixels covered by one iso unit.
+  float pixels_per_unit;
+  float lod0_min_pixels;
+};
+
+// Per frame data of the tile shaders, one block of the frame uniform ring.
+struct FrameUniforms {
+  glm::mat4 view_proj;
+  // Seconds since start and since the previous frame.
+  float time;
+  float delta_time;
+  uint32_t frame;
+  uint32_t padding;
+};
+
+// Per draw data, everything shared by the frame lives in FrameUniforms.
+struct TileDrawPushConstants {
+  uint32_t lod;
+};
+
+// Per SpriteDraw, read by sprite.vert.
+struct SpritePushConstants {
+  // Pixels to clip space.
+  glm::vec2 screen_scale;
+  SpriteSpace space;
+};
+
+// Highlight of the tile under the cursor.
+const float CURSOR_HIGHLIGHT_ALPHA = 0.3f;
+
+// Orthographic isometric camera, extent is half the visible size in iso
+// units.
+struct Camera {
+  glm::vec2 center = glm::vec2(0.0f, 0.0f);
+  float extent = CAMERA_DEFAULT_EXTENT;
+
+  IsoViewRect view() const {
+    float iso_x = center.x - center.y;
+    float iso_y = center.x + center.y;
+    return {iso_x - extent, iso_y - extent, iso_x + extent, iso_y + extent};
+  }
+
+  // Depth of a world position, 0 nearest. Same as fragDepth in shader.vert.
+  float depth(glm::vec2 position) const {
+    float iso_y = position.x + position.y;
+    return 0.5f - 0.5f * (iso_y - (center.x + center.y)) / extent;
   }
 };
 
-const std::vector<Vertex> vertices = {{{-0.5f, -0.5f}, {1.0f, 0.0f, 0.0f}},
-                                      {{0.5f, -0.5f}, {0.0f, 1.0f, 0.0f}},
-                                      {{0.5f, 0.5f}, {0.0f, 0.0f, 1.0f}},
-                                      {{-0.5f, 0.5f}, {1.0f, 1.0f, 1.0f}}};
+// What the simulation reads of the input, sampled on the main thread.
+struct InputState {
+  // Screen directions in iso space, y points down.
+  glm::vec2 pan = glm::vec2(0.0f, 0.0f);
+  // Above 0 zooms out, below 0 zooms in.
+  float zoom = 0.0f;
+  // Cursor over the window size, negative outside of the window.
+  glm::vec2 cursor = glm::vec2(-1.0f, -1.0f);
+};
+
+// Everything the simulation owns, advanced once per tick by step_world().
+struct WorldState {
+  Camera camera{};
+};
+
+static WorldState interpolate_world(const WorldState &from,
+                                    const WorldState &to, float t) {
+  WorldState world = to;
+  world.camera.center = glm::mix(from.camera.center, to.camera.center, t);
+  world.camera.extent =
+      from.camera.extent + (to.camera.extent - from.camera.extent) * t;
+  return world;
+}
+
+// Published by the simulation once per tick and never written again while
+// the render thread holds it.
+struct WorldSnapshot {
+  // The last two ticks, frames show the world between them.
+  WorldState previous;
+  WorldState current;
+  // Of the current tick, on the SimulationThread clock.
+  double time = 0.0;
+  // Of the last world reset the tick had seen.
+  uint32_t generation = 0;
+  // Of the input the tick consumed.
+  glm::vec2 cursor = glm::vec2(-1.0f, -1.0f);
+};
+
+// Secondary command buffer recorded by one worker for one frame in flight.
+struct RecordContext {
+  VkCommandPool command_pool;
+  VkCommandBuffer command_buffer;
+};
+
+// What the drawing pass of a frame graph records with, see
+// build_frame_graph().
+struct DrawPassParams {
+  uint32_t image_index = 0;
+  uint32_t current_frame = 0;
+  bool draw_tiles = false;
+  bool draw_sprites = false;
+  // The frame graph's depth image with dynamic rendering.
+  uint32_t depth = 0;
+};
+
+// Also read by tile_indirect.comp, keep both in sync.
+struct TileInstance {
+  Uint16x2 grid;
+  // Type 0 is an empty tile and never drawn.
+  uint32_t tile_type;
+  Unorm8x4 color;
+};
+
+template <> struct VertexLayout<TileInstance> {
+  static constexpr VkVertexInputRate input_rate =
+      VK_VERTEX_INPUT_RATE_INSTANCE;
+  static constexpr std::array<VertexAttribute, 3> attributes = {
+      VERTEX_ATTRIBUTE(TileInstance, grid),
+      VERTEX_ATTRIBUTE(TileInstance, tile_type),
+      VERTEX_ATTRIBUTE(TileInstance, color)};
+};
+
+// Size of the bindless texture array, atlas pages are indexed into it.
+const uint32_t MAX_BINDLESS_TEXTURES = 1024;
+const uint32_t TILE_TYPE_COUNT = 8;
+const uint32_t TILE_TEXTURE_SIZE = 32;
 
-const std::vector<uint16_t> indices = {0, 1, 2, 2, 3, 0};
+// Where a sprite lives in the atlas, read by the vertex shader. Tile types
+// use the sprite of the same index.
+struct SpriteRecord {
+  // min uv, max uv
+  glm::vec4 uv_rect;
+  uint32_t page;
+  uint32_t padding[3];
+};
+
+// Tile map and the buffers built from it. Loaded on the job system and
+// installed on the render thread as a whole.
+struct TileScene {
+  uint32_t map_size = 0;
+  ChunkBounds chunk_bounds;
+  // Visible chunk lists, one range of visible_chunk_stride per frame in
+  // flight.
+  VkBuffer visible_chunk_buffer = VK_NULL_HANDLE;
+  GpuAllocation visible_chunk_allocation;
+  VkDeviceSize visible_chunk_stride = 0;
+  std::vector<VkDrawIndexedIndirectCommand> indirect_commands;
+  VkBuffer tile_buffer = VK_NULL_HANDLE;
+  GpuAllocation tile_buffer_allocation;
+  // Written by the compute queue and drawn by the graphics queue, so they
+  // have one range per frame in flight too: culling the next frame never
+  // waits for the current one to finish drawing.
+  VkBuffer visible_tile_buffer = VK_NULL_HANDLE;
+  GpuAllocation visible_tile_buffer_allocation;
+  VkDeviceSize visible_tile_stride = 0;
+  VkBuffer indirect_buffer = VK_NULL_HANDLE;
+  GpuAllocation indirect_buffer_allocation;
+  VkDeviceSize indirect_stride = 0;
+  // Upload of the tile buffer.
+  TimelinePoint upload_point;
+  // Binds the buffers above for culling. The pool is the scene's own, a
+  // replaced scene is retired together with its set.
+  VkDescriptorPool descriptor_pool = VK_NULL_HANDLE;
+  VkDescriptorSet descriptor_set = VK_NULL_HANDLE;
+};
+
+struct TexturePage {
+  VkImage image;
+  VkImageView view;
+  GpuAllocation allocation;
+};
+
+struct TileLod {
+  uint32_t first_index;
+  uint32_t index_count;
+};
+
+// LOD 0 is an inset quad inside a darker border ring, LOD 1 the plain quad
+// for tiles too small on screen for the border to show.
+const uint32_t TILE_LOD_COUNT = 2;
+const std::array<TileLod, TILE_LOD_COUNT> tile_lods = {{{0, 30}, {30, 6}}};
+
+std::vector<Vertex> tile_mesh_vertices() {
+  struct Corner {
+    glm::vec2 pos;
+    glm::vec3 color;
+  };
+  const Corner quad[] = {{{-0.5f, -0.5f}, {1.0f, 0.0f, 0.0f}},
+                         {{0.5f, -0.5f}, {0.0f, 1.0f, 0.0f}},
+                         {{0.5f, 0.5f}, {0.0f, 0.0f, 1.0f}},
+                         {{-0.5f, 0.5f}, {1.0f, 1.0f, 1.0f}}};
+  float inset = 1.0f - 2.0f * TILE_BORDER;
+  // 0-3 plain quad, 4-7 inner quad, 8-15 outer and inner border ring.
+  const float scales[][2] = {{1.0f, 1.0f},
+                             {inset, 1.0f},
+                             {1.0f, TILE_BORDER_SHADE},
+                             {inset, TILE_BORDER_SHADE}};
+  std::vector<Vertex> vertices;
+  for (const auto &scale : scales) {
+    for (const auto &corner : quad) {
+      vertices.push_back({Snorm16x2::pack(corner.pos * scale[0]),
+                          Unorm10x3A2::pack(corner.color * scale[1])});
+    }
+  }
+  return vertices;
+}
+
+// Every LOD is cache optimized on its own, a draw only ever covers one.
+MeshIndexData tile_mesh_indices() {
+  std::vector<uint32_t> indices = {4, 5, 6, 6, 7, 4};
+  for (uint32_t i = 0; i < 4; i++) {
+    uint32_t j = (i + 1) % 4;
+    indices.insert(indices.end(), {8 + i, 8 + j, 12 + j, 12 + j, 12 + i, 8 + i});
+  }
+  indices.insert(indices.end(), {0, 1, 2, 2, 3, 0});
+  for (const auto &lod : tile_lods) {
+    optimize_vertex_cache(indices, lod.first_index, lod.index_count);
+  }
+  return pack_mesh_indices(indices);
+}
+
+// Procedural stand-in until there are image assets: grey value noise,
+// tinted by the tile color in the shader.
+std::vector<uint32_t> generate_tile_texture(uint32_t tile_type) {
+  std::vector<uint32_t> pixels(TILE_TEXTURE_SIZE * TILE_TEXTURE_SIZE);
+  for (uint32_t y = 0; y < TILE_TEXTURE_SIZE; y++) {
+    for (uint32_t x = 0; x < TILE_TEXTURE_SIZE; x++) {
+      uint32_t hash =
+          (x * 73856093u) ^ (y * 19349663u) ^ (tile_type * 83492791u);
+      hash ^= hash >> 13;
+      hash *= 0x5bd1e995u;
+      hash ^= hash >> 15;
+      uint32_t value = 192 + (hash & 63);
+      pixels[y * TILE_TEXTURE_SIZE + x] =
+          0xff000000 | value << 16 | value << 8 | value;
+    }
+  }
+  return pixels;
+}
+
+std::string tile_texture_asset(uint32_t tile_type) {
+  return "tile_texture." + std::to_string(tile_type);
+}
+
+// Bakes the tile mesh, the tile textures and the compiled shaders into one
+// archive, which is all the renderer loads at runtime.
+void pack_assets(const std::string &filename) {
+  AssetArchiveWriter writer;
+  std::vector<Vertex> vertices = tile_mesh_vertices();
+  writer.add("tile_mesh.vertices", ASSET_VERTICES, vertices.data(),
+             sizeof(Vertex) * vertices.size());
+  MeshIndexData indices = tile_mesh_indices();
+  writer.add("tile_mesh.indices", ASSET_INDICES, indices.bytes.data(),
+             indices.size(), indices.type, indices.count);
+  for (uint32_t type = 0; type < TILE_TYPE_COUNT; type++) {
+    std::vector<uint32_t> pixels = generate_tile_texture(type);
+    writer.add(tile_texture_asset(type), ASSET_TEXTURE, pixels.data(),
+               sizeof(uint32_t) * pixels.size(), VK_FORMAT_R8G8B8A8_UNORM,
+               TILE_TEXTURE_SIZE, TILE_TEXTURE_SIZE);
+  }
+  for (const char *shader : {"vert.spv", "frag.spv", "tile_indirect.spv",
+                             "sprite_vert.spv", "sprite_frag.spv"}) {
+    std::vector<char> code = read_file(shader);
+    writer.add(shader, ASSET_SPIRV, code.data(), code.size());
+  }
+  writer.write(filename);
+}
 
 class HelloTriangleApplication {
 public:
-  void run() {
-    init_window();
+  void run(const AppOptions &options) {
+    this->options = options;
+    latency = latency_profile(options.latency);
+    start_time = std::chrono::steady_clock::now();
+    last_frame_time = start_time;
+    if (!options.headless) {
+      init_window();
+    }
     init_vulkan();
-    main_loop();
+    if (!options.bench_output.empty()) {
+      run_micro_benchmarks();
+    } else if (options.headless) {
+      run_benchmark();
+    } else {
+      main_loop();
+    }
     cleanup();
   }
 
@@ -105,30 +628,112 @@ private:
     window = glfwCreateWindow(WIDTH, HEIGHT, "Vulkan", nullptr, nullptr);
     glfwSetWindowUserPointer(window, this);
     glfwSetFramebufferSizeCallback(window, framebuffer_resize_callback);
+    glfwSetKeyCallback(window, key_callback);
+    int width, height;
+    glfwGetFramebufferSize(window, &width, &height);
+    framebuffer_width = width;
+    framebuffer_height = height;
+  }
+
+  // T, L and F toggle tint, lighting and fog. The render thread applies
+  // the toggles before its next frame.
+  static void key_callback(GLFWwindow *window, int key, int scancode,
+                           int action, int mods) {
+    auto app = reinterpret_cast<HelloTriangleApplication *>(
+        glfwGetWindowUserPointer(window));
+    if (action != GLFW_PRESS) {
+      return;
+    }
+    if (key == GLFW_KEY_T) {
+      app->feature_toggles.fetch_xor(1u << TILE_FEATURE_TINT);
+    } else if (key == GLFW_KEY_L) {
+      app->feature_toggles.fetch_xor(1u << TILE_FEATURE_LIGHTING);
+    } else if (key == GLFW_KEY_F) {
+      app->feature_toggles.fetch_xor(1u << TILE_FEATURE_FOG);
+    }
   }
 
   static void framebuffer_resize_callback(GLFWwindow *window, int width,
                                           int height) {
     auto app = reinterpret_cast<HelloTriangleApplication *>(
         glfwGetWindowUserPointer(window));
+    app->framebuffer_width = width;
+    app->framebuffer_height = height;
     app->frame_buffer_resized = true;
   }
 
   void init_vulkan() {
+    assets.open(ASSET_ARCHIVE_FILE);
     create_instance();
-    create_surface();
+    if (!options.headless) {
+      create_surface();
+    }
     pick_physical_device();
     create_logical_device();
-    create_swap_chain();
+    timeline.init(device, graphics_queue, compute_queue, transfer_queue);
+    deletions.init(timeline);
+    allocator.init(physical_device, device);
+    frame_graph.init(device, timeline, deletions, allocator,
+                     {queue_indices.graphics_family.value(),
+                      queue_indices.compute_family.value(),
+                      queue_indices.transfer_family.value()},
+                     pipeline_barrier2);
+    if (options.headless) {
+      create_offscreen_targets();
+    } else {
+      create_swap_chain();
+    }
     create_image_views();
-    create_render_pass();
+    depth_format = find_depth_format();
+    // Dynamic rendering draws straight into the image views, without a
+    // render pass or framebuffers, and the depth buffer is a transient
+    // image of the frame graph.
+    if (!dynamic_rendering_enabled) {
+      create_depth_resources();
+      create_render_pass();
+    }
+    create_descriptor_set_layout();
+    create_frame_set_layout();
+    create_texture_set_layout();
+    pipeline_cache =
+        load_pipeline_cache(physical_device, device, PIPELINE_CACHE_FILE);
+    pipelines.init(device, pipeline_cache, assets, PIPELINE_COMPILE_THREADS);
     create_graphics_pipeline();
-    create_framebuffers();
+    create_sprite_pipeline();
+    create_compute_pipeline();
+    if (!dynamic_rendering_enabled) {
+      create_framebuffers();
+    }
     create_command_pool();
+    create_record_contexts();
+    create_profiler();
+    create_uploader();
+    import_asset_archive();
+    create_frame_uniforms();
+    create_sprite_batch();
     create_vertex_buffer();
     create_index_buffer();
+    upload_point = uploader.flush();
+    create_descriptor_pool();
+    create_descriptor_sets();
     create_command_buffers();
     create_sync_objects();
+    // Frames only clear the screen until these arrive.
+    jobs.init(std::clamp(std::thread::hardware_concurrency() / 2, 1u,
+                         MAX_JOB_THREADS));
+    load_tile_textures();
+    load_tile_scene(options.tile_counts[0]);
+    if (options.hot_reload) {
+      shader_reloader.init(SHADER_SOURCE_DIR);
+      shader_reloader.watch("shader.vert", "vert.spv");
+      shader_reloader.watch("shader.frag", "frag.spv");
+      shader_reloader.watch("tile_indirect.comp", "tile_indirect.spv");
+      shader_reloader.watch("sprite.vert", "sprite_vert.spv");
+      shader_reloader.watch("sprite.frag", "sprite_frag.spv");
+    }
+    if (enable_validation_layers) {
+      allocator.print_stats(std::cout);
+    }
   }
 
   void create_instance() {
@@ -142,13 +747,16 @@ private:
     app_info.applicationVersion = VK_MAKE_VERSION(1, 0, 0);
     app_info.pEngineName = "No Engine";
     app_info.engineVersion = VK_MAKE_VERSION(1, 0, 0);
-    app_info.apiVersion = VK_API_VERSION_1_0;
+    app_info.apiVersion = VK_API_VERSION_1_2;
     VkInstanceCreateInfo create_info{};
     create_info.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
     create_info.pApplicationInfo = &app_info;
     uint32_t glfw_extension_count = 0;
-    const char **glfw_extensions;
-    glfw_extensions = glfwGetRequiredInstanceExtensions(&glfw_extension_count);
+    const char **glfw_extensions = nullptr;
+    if (!options.headless) {
+      glfw_extensions =
+          glfwGetRequiredInstanceExtensions(&glfw_extension_count);
+    }
     create_info.enabledExtensionCount = glfw_extension_count;
     create_info.ppEnabledExtensionNames = glfw_extensions;
     create_info.enabledLayerCount = 0;
@@ -181,15 +789,23 @@ private:
     }
     std::vector<VkPhysicalDevice> devices(device_count);
     vkEnumeratePhysicalDevices(instance, &device_count, devices.data());
+    // Dual GPU systems often enumerate the integrated GPU first, so every
+    // suitable device is scored rather than taking the first one.
+    std::vector<DeviceCandidate> candidates;
     for (const auto &device : devices) {
       if (is_device_suitable(device)) {
-        physical_device = device;
-        break;
+        candidates.push_back(
+            score_device(device, optional_device_extensions));
       }
     }
-    if (physical_device == VK_NULL_HANDLE) {
-      throw new std::runtime_error("failed to find a suitable GPU");
+    const DeviceCandidate &selected = select_device(
+        candidates, options.device_uuid ? &*options.device_uuid : nullptr);
+    if (enable_validation_layers) {
+      print_device_candidates(std::cout, candidates, selected);
     }
+    physical_device = selected.device;
+    // is_device_suitable() left the queues of the last device checked.
+    queue_indices = find_queue_families(physical_device);
     return physical_device;
   }
 
@@ -198,6 +814,8 @@ private:
     std::set<uint32_t> unique_queue_families = {
         queue_indices.graphics_family.value(),
         queue_indices.present_family.value(),
+        queue_indices.transfer_family.value(),
+        queue_indices.compute_family.value(),
     };
     float queue_proiority = 1.0f;
     for (uint32_t queue_family : unique_queue_families) {
@@ -209,16 +827,81 @@ private:
       queue_create_info.pQueuePriorities = &queue_proiority;
       queue_create_infos.push_back(queue_create_info);
     }
+    VkPhysicalDeviceFeatures supported_features;
+    vkGetPhysicalDeviceFeatures(physical_device, &supported_features);
+    // The tile slices are secondary command buffers, they have to inherit
+    // the overdraw query of the primary.
+    fragment_statistics_supported =
+        supported_features.pipelineStatisticsQuery &&
+        supported_features.inheritedQueries;
     VkPhysicalDeviceFeatures device_features{};
+    device_features.pipelineStatisticsQuery = fragment_statistics_supported;
+    device_features.inheritedQueries = fragment_statistics_supported;
     VkDeviceCreateInfo create_info{};
     create_info.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
     create_info.queueCreateInfoCount =
         static_cast<uint32_t>(queue_create_infos.size());
     create_info.pQueueCreateInfos = queue_create_infos.data();
     create_info.pEnabledFeatures = &device_features;
+    std::vector<const char *> extensions = required_device_extensions();
+    present_wait_enabled =
+        latency.present_wait && !options.headless && supports_present_wait();
+    VkPhysicalDevicePresentIdFeaturesKHR present_id_features{};
+    present_id_features.sType =
+        VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PRESENT_ID_FEATURES_KHR;
+    present_id_features.presentId = VK_TRUE;
+    VkPhysicalDevicePresentWaitFeaturesKHR present_wait_features{};
+    present_wait_features.sType =
+        VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PRESENT_WAIT_FEATURES_KHR;
+    present_wait_features.pNext = &present_id_features;
+    present_wait_features.presentWait = VK_TRUE;
+    VkPhysicalDeviceTimelineSemaphoreFeatures timeline_features{};
+    timeline_features.sType =
+        VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES;
+    timeline_features.timelineSemaphore = VK_TRUE;
+    VkPhysicalDeviceDescriptorIndexingFeatures indexing_features{};
+    indexing_features.sType =
+        VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES;
+    indexing_features.runtimeDescriptorArray = VK_TRUE;
+    indexing_features.shaderSampledImageArrayNonUniformIndexing = VK_TRUE;
+    indexing_features.descriptorBindingPartiallyBound = VK_TRUE;
+    indexing_features.descriptorBindingSampledImageUpdateAfterBind = VK_TRUE;
+    timeline_features.pNext = &indexing_features;
+    create_info.pNext = &timeline_features;
+    external_memory_host_enabled =
+        supports_device_extension(VK_EXT_EXTERNAL_MEMORY_HOST_EXTENSION_NAME);
+    if (external_memory_host_enabled) {
+      extensions.push_back(VK_EXT_EXTERNAL_MEMORY_HOST_EXTENSION_NAME);
+    }
+    dynamic_rendering_enabled =
+        !options.render_pass && supports_dynamic_rendering();
+    VkPhysicalDeviceDynamicRenderingFeaturesKHR dynamic_rendering_features{};
+    dynamic_rendering_features.sType =
+        VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DYNAMIC_RENDERING_FEATURES_KHR;
+    dynamic_rendering_features.dynamicRendering = VK_TRUE;
+    if (dynamic_rendering_enabled) {
+      extensions.push_back(VK_KHR_DYNAMIC_RENDERING_EXTENSION_NAME);
+      dynamic_rendering_features.pNext = create_info.pNext;
+      create_info.pNext = &dynamic_rendering_features;
+    }
+    bool synchronization2_enabled = supports_synchronization2();
+    VkPhysicalDeviceSynchronization2FeaturesKHR synchronization2_features{};
+    synchronization2_features.sType =
+        VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SYNCHRONIZATION_2_FEATURES_KHR;
+    synchronization2_features.synchronization2 = VK_TRUE;
+    if (synchronization2_enabled) {
+      extensions.push_back(VK_KHR_SYNCHRONIZATION_2_EXTENSION_NAME);
+      synchronization2_features.pNext = create_info.pNext;
+      create_info.pNext = &synchronization2_features;
+    }
+    if (present_wait_enabled) {
+      extensions.push_back(VK_KHR_PRESENT_ID_EXTENSION_NAME);
+      extensions.push_back(VK_KHR_PRESENT_WAIT_EXTENSION_NAME);
+      indexing_features.pNext = &present_wait_features;
+    }
     create_info.enabledExtensionCount =
-        static_cast<uint32_t>(device_extensions.size());
-    create_info.ppEnabledExtensionNames = device_extensions.data();
+        static_cast<uint32_t>(extensions.size());
+    create_info.ppEnabledExtensionNames = extensions.data();
     if (enable_validation_layers) {
       create_info.enabledLayerCount =
           static_cast<uint32_t>(validation_layers.size());
@@ -233,9 +916,103 @@ private:
                      &graphics_queue);
     vkGetDeviceQueue(device, queue_indices.present_family.value(), 0,
                      &present_queue);
+    vkGetDeviceQueue(device, queue_indices.transfer_family.value(), 0,
+                     &transfer_queue);
+    vkGetDeviceQueue(device, queue_indices.compute_family.value(), 0,
+                     &compute_queue);
+    if (present_wait_enabled) {
+      wait_for_present = reinterpret_cast<PFN_vkWaitForPresentKHR>(
+          vkGetDeviceProcAddr(device, "vkWaitForPresentKHR"));
+    }
+    if (dynamic_rendering_enabled) {
+      begin_rendering = reinterpret_cast<PFN_vkCmdBeginRenderingKHR>(
+          vkGetDeviceProcAddr(device, "vkCmdBeginRenderingKHR"));
+      end_rendering = reinterpret_cast<PFN_vkCmdEndRenderingKHR>(
+          vkGetDeviceProcAddr(device, "vkCmdEndRenderingKHR"));
+    }
+    if (synchronization2_enabled) {
+      pipeline_barrier2 = reinterpret_cast<PFN_vkCmdPipelineBarrier2>(
+          vkGetDeviceProcAddr(device, "vkCmdPipelineBarrier2KHR"));
+    }
+  }
+
+  bool supports_synchronization2() {
+    if (!supports_device_extension(VK_KHR_SYNCHRONIZATION_2_EXTENSION_NAME)) {
+      return false;
+    }
+    VkPhysicalDeviceSynchronization2FeaturesKHR synchronization2_features{};
+    synchronization2_features.sType =
+        VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SYNCHRONIZATION_2_FEATURES_KHR;
+    VkPhysicalDeviceFeatures2 features{};
+    features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+    features.pNext = &synchronization2_features;
+    vkGetPhysicalDeviceFeatures2(physical_device, &features);
+    return synchronization2_features.synchronization2;
+  }
+
+  bool supports_dynamic_rendering() {
+    if (!supports_device_extension(VK_KHR_DYNAMIC_RENDERING_EXTENSION_NAME)) {
+      return false;
+    }
+    VkPhysicalDeviceDynamicRenderingFeaturesKHR dynamic_rendering_features{};
+    dynamic_rendering_features.sType =
+        VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DYNAMIC_RENDERING_FEATURES_KHR;
+    VkPhysicalDeviceFeatures2 features{};
+    features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+    features.pNext = &dynamic_rendering_features;
+    vkGetPhysicalDeviceFeatures2(physical_device, &features);
+    return dynamic_rendering_features.dynamicRendering;
+  }
+
+  bool supports_device_extension(const char *name) {
+    uint32_t extension_count;
+    vkEnumerateDeviceExtensionProperties(physical_device, nullptr,
+                                         &extension_count, nullptr);
+    std::vector<VkExtensionProperties> available_extensions(extension_count);
+    vkEnumerateDeviceExtensionProperties(physical_device, nullptr,
+                                         &extension_count,
+                                         available_extensions.data());
+    for (const auto &extension : available_extensions) {
+      if (strcmp(extension.extensionName, name) == 0) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  bool supports_present_wait() {
+    uint32_t extension_count;
+    vkEnumerateDeviceExtensionProperties(physical_device, nullptr,
+                                         &extension_count, nullptr);
+    std::vector<VkExtensionProperties> available_extensions(extension_count);
+    vkEnumerateDeviceExtensionProperties(physical_device, nullptr,
+                                         &extension_count,
+                                         available_extensions.data());
+    std::set<std::string> required_extensions = {
+        VK_KHR_PRESENT_ID_EXTENSION_NAME, VK_KHR_PRESENT_WAIT_EXTENSION_NAME};
+    for (const auto &extension : available_extensions) {
+      required_extensions.erase(extension.extensionName);
+    }
+    if (!required_extensions.empty()) {
+      return false;
+    }
+    VkPhysicalDevicePresentIdFeaturesKHR present_id_features{};
+    present_id_features.sType =
+        VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PRESENT_ID_FEATURES_KHR;
+    VkPhysicalDevicePresentWaitFeaturesKHR present_wait_features{};
+    present_wait_features.sType =
+        VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PRESENT_WAIT_FEATURES_KHR;
+    present_wait_features.pNext = &present_id_features;
+    VkPhysicalDeviceFeatures2 features{};
+    features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+    features.pNext = &present_wait_features;
+    vkGetPhysicalDeviceFeatures2(physical_device, &features);
+    return present_id_features.presentId && present_wait_features.presentWait;
   }
 
-  void create_swap_chain() {
+  // old_swap_chain is retired by the new one, frames in flight can still
+  // present its acquired images.
+  void create_swap_chain(VkSwapchainKHR old_swap_chain = VK_NULL_HANDLE) {
     SwapChainSupportDetails swap_chain_support =
         query_swap_chain_support(physical_device);
     VkSurfaceFormatKHR surface_format =
@@ -243,7 +1020,8 @@ private:
     VkPresentModeKHR present_mode =
         choose_swap_present_mode(swap_chain_support.present_modes);
     VkExtent2D extent = choose_swap_extent(swap_chain_support.capabilities);
-    uint32_t image_count = swap_chain_support.capabilities.minImageCount + 1;
+    uint32_t image_count =
+        swap_chain_support.capabilities.minImageCount + latency.extra_images;
     if (swap_chain_support.capabilities.maxImageCount > 0 &&
         image_count > swap_chain_support.capabilities.maxImageCount) {
       image_count = swap_chain_support.capabilities.maxImageCount;
@@ -272,7 +1050,7 @@ private:
     create_info.compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR;
     create_info.presentMode = present_mode;
     create_info.clipped = VK_TRUE;
-    create_info.oldSwapchain = VK_NULL_HANDLE;
+    create_info.oldSwapchain = old_swap_chain;
     if (vkCreateSwapchainKHR(device, &create_info, nullptr, &swap_chain) !=
         VK_SUCCESS) {
       throw std::runtime_error("failed to create swap chain!");
@@ -281,22 +1059,68 @@ private:
     swap_chain_images.resize(image_count);
     vkGetSwapchainImagesKHR(device, swap_chain, &image_count,
                             swap_chain_images.data());
+    // Present ids only have to increase per swap chain.
+    present_id = 0;
     swap_chain_image_format = surface_format.format;
     swap_chain_extent = extent;
   }
 
+  // Headless stand-in for the swap chain, one color target per frame in
+  // flight so a frame never waits on another frame's attachment.
+  void create_offscreen_targets() {
+    swap_chain_image_format = VK_FORMAT_B8G8R8A8_UNORM;
+    swap_chain_extent = {WIDTH, HEIGHT};
+    swap_chain_images.resize(latency.frames_in_flight);
+    offscreen_allocations.resize(latency.frames_in_flight);
+    for (size_t i = 0; i < swap_chain_images.size(); i++) {
+      VkImageCreateInfo image_info{};
+      image_info.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+      image_info.imageType = VK_IMAGE_TYPE_2D;
+      image_info.format = swap_chain_image_format;
+      image_info.extent = {WIDTH, HEIGHT, 1};
+      image_info.mipLevels = 1;
+      image_info.arrayLayers = 1;
+      image_info.samples = VK_SAMPLE_COUNT_1_BIT;
+      image_info.tiling = VK_IMAGE_TILING_OPTIMAL;
+      image_info.usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT |
+                         VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+      image_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+      image_info.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+      if (vkCreateImage(device, &image_info, nullptr, &swap_chain_images[i]) !=
+          VK_SUCCESS) {
+        throw std::runtime_error("failed to create offscreen image");
+      }
+      VkMemoryRequirements mem_requirements;
+      vkGetImageMemoryRequirements(device, swap_chain_images[i],
+                                   &mem_requirements);
+      offscreen_allocations[i] = allocator.allocate(
+          mem_requirements,
+          find_memory_type(mem_requirements.memoryTypeBits,
+                           VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT),
+          false);
+      vkBindImageMemory(device, swap_chain_images[i],
+                        offscreen_allocations[i].memory,
+                        offscreen_allocations[i].offset);
+    }
+  }
+
+  // Builds the new swap chain next to the old one without waiting for the
+  // device. The old swap chain, its views and framebuffers are retired to
+  // the deletion queue and go away once the frames using them completed.
   void recreate_swap_chain() {
-    int width = 0, height = 0;
-    glfwGetFramebufferSize(window, &width, &height);
-    while (width == 0 || height == 0) {
-      glfwGetFramebufferSize(window, &width, &height);
-      glfwWaitEvents();
+    swap_chain_stale = framebuffer_width == 0 || framebuffer_height == 0;
+    if (swap_chain_stale) {
+      // Minimized, main_loop() retries once the window has a size again.
+      return;
     }
-    vkDeviceWaitIdle(device);
-    cleanup_swapchain();
-    create_swap_chain();
+    VkSwapchainKHR old_swap_chain = swap_chain;
+    retire_swap_chain();
+    create_swap_chain(old_swap_chain);
     create_image_views();
-    create_framebuffers();
+    if (!dynamic_rendering_enabled) {
+      create_depth_resources();
+      create_framebuffers();
+    }
   }
 
   void create_image_views() {
@@ -323,132 +1147,287 @@ private:
     }
   }
 
+  // D16 is the one depth format every device supports as an attachment.
+  VkFormat find_depth_format() {
+    for (VkFormat format : {VK_FORMAT_D32_SFLOAT, VK_FORMAT_D16_UNORM}) {
+      VkFormatProperties properties;
+      vkGetPhysicalDeviceFormatProperties(physical_device, format,
+                                          &properties);
+      if (properties.optimalTilingFeatures &
+          VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT) {
+        return format;
+      }
+    }
+    throw std::runtime_error("failed to find a depth format");
+  }
+
+  // One depth buffer for every frame in flight, frames clear it on load and
+  // the GPU runs their passes in order anyway. Only the render pass uses
+  // it, with dynamic rendering the frame graph owns the depth buffer.
+  void create_depth_resources() {
+    VkImageCreateInfo image_info{};
+    image_info.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+    image_info.imageType = VK_IMAGE_TYPE_2D;
+    image_info.format = depth_format;
+    image_info.extent = {swap_chain_extent.width, swap_chain_extent.height, 1};
+    image_info.mipLevels = 1;
+    image_info.arrayLayers = 1;
+    image_info.samples = VK_SAMPLE_COUNT_1_BIT;
+    image_info.tiling = VK_IMAGE_TILING_OPTIMAL;
+    image_info.usage = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT;
+    image_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    image_info.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    if (vkCreateImage(device, &image_info, nullptr, &depth_image) !=
+        VK_SUCCESS) {
+      throw std::runtime_error("failed to create depth image");
+    }
+    VkMemoryRequirements mem_requirements;
+    vkGetImageMemoryRequirements(device, depth_image, &mem_requirements);
+    depth_allocation = allocator.allocate(
+        mem_requirements,
+        find_memory_type(mem_requirements.memoryTypeBits,
+                         VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT),
+        false);
+    vkBindImageMemory(device, depth_image, depth_allocation.memory,
+                      depth_allocation.offset);
+    VkImageViewCreateInfo view_info{};
+    view_info.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+    view_info.image = depth_image;
+    view_info.viewType = VK_IMAGE_VIEW_TYPE_2D;
+    view_info.format = depth_format;
+    view_info.subresourceRange.aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT;
+    view_info.subresourceRange.levelCount = 1;
+    view_info.subresourceRange.layerCount = 1;
+    if (vkCreateImageView(device, &view_info, nullptr, &depth_image_view) !=
+        VK_SUCCESS) {
+      throw std::runtime_error("failed to create depth image view");
+    }
+  }
+
+  void destroy_depth_resources() {
+    vkDestroyImageView(device, depth_image_view, nullptr);
+    vkDestroyImage(device, depth_image, nullptr);
+    allocator.free(depth_allocation);
+  }
+
   void create_graphics_pipeline() {
-    auto vert_shader_code = read_file("vert.spv");
-    auto frag_shader_code = read_file("frag.spv");
-    VkShaderModule vert_shader = create_shader_module(vert_shader_code);
-    VkShaderModule frag_shader = create_shader_module(frag_shader_code);
-    VkPipelineShaderStageCreateInfo vert_create_info{};
-    vert_create_info.sType =
-        VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-    vert_create_info.stage = VK_SHADER_STAGE_VERTEX_BIT;
-    vert_create_info.module = vert_shader;
-    vert_create_info.pName = "main";
-    VkPipelineShaderStageCreateInfo frag_create_info{};
-    frag_create_info.sType =
-        VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-    frag_create_info.stage = VK_SHADER_STAGE_FRAGMENT_BIT;
-    frag_create_info.module = frag_shader;
-    frag_create_info.pName = "main";
-    VkPipelineShaderStageCreateInfo shader_stages[] = {vert_create_info,
-                                                       frag_create_info};
-    std::vector<VkDynamicState> dynamic_states = {
-        // Enable this for dyniamiclly changing viewport / scissors
-        //
-        // VK_DYNAMIC_STATE_VIEWPORT,
-        // VK_DYNAMIC_STATE_SCISSOR,
-    };
-    VkPipelineDynamicStateCreateInfo dynamic_state{};
-    dynamic_state.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
-    dynamic_state.dynamicStateCount =
-        static_cast<uint32_t>(dynamic_states.size());
-    dynamic_state.pDynamicStates = dynamic_states.data();
-    auto binding_description = Vertex::binding_description();
-    auto attribute_description = Vertex::get_attribute_description();
-    VkPipelineVertexInputStateCreateInfo vertex_input_info{};
-    vertex_input_info.sType =
-        VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
-    vertex_input_info.vertexBindingDescriptionCount = 1;
-    vertex_input_info.pVertexBindingDescriptions = &binding_description;
-    vertex_input_info.vertexAttributeDescriptionCount =
-        static_cast<uint32_t>(attribute_description.size());
-    vertex_input_info.pVertexAttributeDescriptions =
-        attribute_description.data();
-    VkPipelineInputAssemblyStateCreateInfo input_assembly{};
-    input_assembly.sType =
-        VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
-    input_assembly.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
-    input_assembly.primitiveRestartEnable = VK_FALSE;
-    VkViewport viewport{};
-    viewport.x = 0.0f;
-    viewport.y = 0.0f;
-    viewport.width = (float)swap_chain_extent.width;
-    viewport.height = (float)swap_chain_extent.height;
-    viewport.minDepth = 0.0f;
-    viewport.maxDepth = 1.0f;
-    VkRect2D scissors{};
-    scissors.offset = {0, 0};
-    scissors.extent = swap_chain_extent;
-    VkPipelineViewportStateCreateInfo viewport_state{};
-    viewport_state.sType =
-        VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
-    viewport_state.viewportCount = 1;
-    viewport_state.scissorCount = 1;
-    viewport_state.pViewports = &viewport;
-    viewport_state.pScissors = &scissors;
-    VkPipelineRasterizationStateCreateInfo rasterizer{};
-    rasterizer.sType =
-        VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
-    rasterizer.depthClampEnable = VK_FALSE;
-    rasterizer.rasterizerDiscardEnable = VK_FALSE;
-    rasterizer.polygonMode = VK_POLYGON_MODE_FILL;
-    rasterizer.lineWidth = 1.0f;
-    rasterizer.cullMode = VK_CULL_MODE_BACK_BIT;
-    rasterizer.frontFace = VK_FRONT_FACE_CLOCKWISE;
-    rasterizer.depthBiasEnable = VK_FALSE;
-    VkPipelineMultisampleStateCreateInfo multisampling{};
-    multisampling.sType =
-        VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
-    multisampling.sampleShadingEnable = VK_FALSE;
-    multisampling.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
-    VkPipelineColorBlendAttachmentState color_blend_attachment{};
-    color_blend_attachment.colorWriteMask =
-        VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT |
-        VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
-    color_blend_attachment.blendEnable = false;
-    VkPipelineColorBlendStateCreateInfo color_blending{};
-    color_blending.sType =
-        VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
-    color_blending.logicOpEnable = VK_FALSE;
-    color_blending.attachmentCount = 1;
-    color_blending.pAttachments = &color_blend_attachment;
+    VkPushConstantRange push_constant{};
+    push_constant.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+    push_constant.offset = 0;
+    push_constant.size = sizeof(TileDrawPushConstants);
     VkPipelineLayoutCreateInfo pipeline_layout_info{};
     pipeline_layout_info.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+    VkDescriptorSetLayout set_layouts[] = {frame_set_layout,
+                                           texture_set_layout};
+    pipeline_layout_info.setLayoutCount = 2;
+    pipeline_layout_info.pSetLayouts = set_layouts;
+    pipeline_layout_info.pushConstantRangeCount = 1;
+    pipeline_layout_info.pPushConstantRanges = &push_constant;
     if (vkCreatePipelineLayout(device, &pipeline_layout_info, nullptr,
                                &pipeline_layout) != VK_SUCCESS) {
       throw std::runtime_error("failed to create pipeline layout");
     }
-    VkGraphicsPipelineCreateInfo pipeline_info{};
-    pipeline_info.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
-    pipeline_info.stageCount = 2;
-    pipeline_info.pStages = shader_stages;
-    pipeline_info.pVertexInputState = &vertex_input_info;
-    pipeline_info.pInputAssemblyState = &input_assembly;
-    pipeline_info.pViewportState = &viewport_state;
-    pipeline_info.pRasterizationState = &rasterizer;
-    pipeline_info.pMultisampleState = &multisampling;
-    pipeline_info.pDepthStencilState = nullptr;
-    pipeline_info.pColorBlendState = &color_blending;
-    pipeline_info.pDynamicState = &dynamic_state;
-    pipeline_info.layout = pipeline_layout;
-    pipeline_info.renderPass = render_pass;
-    pipeline_info.subpass = 0;
-    pipeline_info.basePipelineHandle = VK_NULL_HANDLE;
-    pipeline_info.basePipelineIndex = -1;
-    if (vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, 1, &pipeline_info,
-                                  nullptr, &graphics_pipeline) != VK_SUCCESS) {
-      throw std::runtime_error("failed to create graphics pipeline");
-    }
-
-    vkDestroyShaderModule(device, vert_shader, nullptr);
-    vkDestroyShaderModule(device, frag_shader, nullptr);
-  }
-
-  VkShaderModule create_shader_module(const std::vector<char> &code) {
+    // Material variants fall back to this pipeline while they compile, so it
+    // has to be ready up front.
+    tile_pipeline = pipelines.request_blocking(
+        tile_pipeline_desc(TILE_DEFAULT_PERMUTATION));
+    set_tile_features(options.tile_features);
+  }
+
+  GraphicsPipelineDesc tile_pipeline_desc(TilePermutation features) {
+    GraphicsPipelineDesc desc{};
+    desc.vert_shader = "vert.spv";
+    desc.frag_shader = "frag.spv";
+    desc.frag_specialization = features.specialization();
+    desc.bindings = {vertex_binding<Vertex>(0),
+                     vertex_binding<TileInstance>(1)};
+    auto vertex_inputs = vertex_attributes<Vertex>(0, 0);
+    auto instance_inputs = vertex_attributes<TileInstance>(1, 2);
+    desc.attributes.assign(vertex_inputs.begin(), vertex_inputs.end());
+    desc.attributes.insert(desc.attributes.end(), instance_inputs.begin(),
+                           instance_inputs.end());
+    desc.layout = pipeline_layout;
+    desc.render_pass = render_pass;
+    desc.subpass = 0;
+    desc.color_format = swap_chain_image_format;
+    // Only what is in front of the closest tile so far gets shaded, see
+    // sort_visible_chunks().
+    desc.depth_test = true;
+    desc.depth_write = true;
+    desc.depth_format = depth_format;
+    return desc;
+  }
+
+  // Draws with the variant of features from now on, the default pipeline
+  // stands in until it compiled.
+  void set_tile_features(TilePermutation features) {
+    tile_features = features;
+    tile_variant = features == TILE_DEFAULT_PERMUTATION
+                       ? tile_pipeline
+                       : pipelines.request(tile_pipeline_desc(features),
+                                           tile_pipeline);
+  }
+
+  // Same sets as the tiles, so both draw with the sets bound once.
+  void create_sprite_pipeline() {
+    VkPushConstantRange push_constant{};
+    push_constant.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+    push_constant.offset = 0;
+    push_constant.size = sizeof(SpritePushConstants);
+    VkPipelineLayoutCreateInfo pipeline_layout_info{};
+    pipeline_layout_info.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+    VkDescriptorSetLayout set_layouts[] = {frame_set_layout,
+                                           texture_set_layout};
+    pipeline_layout_info.setLayoutCount = 2;
+    pipeline_layout_info.pSetLayouts = set_layouts;
+    pipeline_layout_info.pushConstantRangeCount = 1;
+    pipeline_layout_info.pPushConstantRanges = &push_constant;
+    if (vkCreatePipelineLayout(device, &pipeline_layout_info, nullptr,
+                               &sprite_pipeline_layout) != VK_SUCCESS) {
+      throw std::runtime_error("failed to create pipeline layout");
+    }
+    GraphicsPipelineDesc desc{};
+    desc.vert_shader = "sprite_vert.spv";
+    desc.frag_shader = "sprite_frag.spv";
+    desc.bindings = {vertex_binding<SpriteVertex>(0)};
+    auto inputs = vertex_attributes<SpriteVertex>(0, 0);
+    desc.attributes.assign(inputs.begin(), inputs.end());
+    // Quads come in either winding.
+    desc.cull_mode = VK_CULL_MODE_NONE;
+    desc.blend_enable = true;
+    desc.layout = sprite_pipeline_layout;
+    desc.render_pass = render_pass;
+    desc.subpass = 0;
+    desc.color_format = swap_chain_image_format;
+    // Drawn over the tiles, the depth buffer is only there for them.
+    desc.depth_format = depth_format;
+    sprite_pipeline = pipelines.request_blocking(desc);
+  }
+
+  void create_descriptor_set_layout() {
+    std::array<VkDescriptorSetLayoutBinding, 4> bindings{};
+    for (uint32_t i = 0; i < bindings.size(); i++) {
+      bindings[i].binding = i;
+      bindings[i].descriptorType = tile_descriptor_type(i);
+      bindings[i].descriptorCount = 1;
+      bindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    }
+    VkDescriptorSetLayoutCreateInfo layout_info{};
+    layout_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+    layout_info.bindingCount = static_cast<uint32_t>(bindings.size());
+    layout_info.pBindings = bindings.data();
+    if (vkCreateDescriptorSetLayout(device, &layout_info, nullptr,
+                                    &tile_set_layout) != VK_SUCCESS) {
+      throw std::runtime_error("failed to create descriptor set layout");
+    }
+  }
+
+  void create_frame_set_layout() {
+    VkDescriptorSetLayoutBinding binding{};
+    binding.binding = 0;
+    binding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+    binding.descriptorCount = 1;
+    binding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+    VkDescriptorSetLayoutCreateInfo layout_info{};
+    layout_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+    layout_info.bindingCount = 1;
+    layout_info.pBindings = &binding;
+    if (vkCreateDescriptorSetLayout(device, &layout_info, nullptr,
+                                    &frame_set_layout) != VK_SUCCESS) {
+      throw std::runtime_error("failed to create descriptor set layout");
+    }
+  }
+
+  // Sampler, sprite table and the bindless page array. Pages may be added
+  // while frames using the set are in flight, unwritten slots are never
+  // read.
+  void create_texture_set_layout() {
+    std::array<VkDescriptorSetLayoutBinding, 3> bindings{};
+    bindings[0].binding = 0;
+    bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_SAMPLER;
+    bindings[0].descriptorCount = 1;
+    bindings[0].stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+    bindings[1].binding = 1;
+    bindings[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    bindings[1].descriptorCount = 1;
+    bindings[1].stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+    bindings[2].binding = 2;
+    bindings[2].descriptorType = VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE;
+    bindings[2].descriptorCount = MAX_BINDLESS_TEXTURES;
+    bindings[2].stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+    std::array<VkDescriptorBindingFlags, 3> binding_flags = {
+        0, 0,
+        VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT |
+            VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT};
+    VkDescriptorSetLayoutBindingFlagsCreateInfo flags_info{};
+    flags_info.sType =
+        VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO;
+    flags_info.bindingCount = static_cast<uint32_t>(binding_flags.size());
+    flags_info.pBindingFlags = binding_flags.data();
+    VkDescriptorSetLayoutCreateInfo layout_info{};
+    layout_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+    layout_info.pNext = &flags_info;
+    layout_info.flags =
+        VK_DESCRIPTOR_SET_LAYOUT_CREATE_UPDATE_AFTER_BIND_POOL_BIT;
+    layout_info.bindingCount = static_cast<uint32_t>(bindings.size());
+    layout_info.pBindings = bindings.data();
+    if (vkCreateDescriptorSetLayout(device, &layout_info, nullptr,
+                                    &texture_set_layout) != VK_SUCCESS) {
+      throw std::runtime_error("failed to create descriptor set layout");
+    }
+  }
+
+  // Everything but the tile map has one range per frame in flight, bound
+  // with a dynamic offset.
+  static VkDescriptorType tile_descriptor_type(uint32_t binding) {
+    return binding == 0 ? VK_DESCRIPTOR_TYPE_STORAGE_BUFFER
+                        : VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC;
+  }
+
+  void create_compute_pipeline() {
+    VkPushConstantRange push_constant{};
+    push_constant.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    push_constant.offset = 0;
+    push_constant.size = sizeof(TilePushConstants);
+    VkPipelineLayoutCreateInfo pipeline_layout_info{};
+    pipeline_layout_info.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+    pipeline_layout_info.setLayoutCount = 1;
+    pipeline_layout_info.pSetLayouts = &tile_set_layout;
+    pipeline_layout_info.pushConstantRangeCount = 1;
+    pipeline_layout_info.pPushConstantRanges = &push_constant;
+    if (vkCreatePipelineLayout(device, &pipeline_layout_info, nullptr,
+                               &compute_pipeline_layout) != VK_SUCCESS) {
+      throw std::runtime_error("failed to create compute pipeline layout");
+    }
+    AssetBlob code = assets.find("tile_indirect.spv", ASSET_SPIRV);
+    tile_compute_pipeline = build_tile_compute_pipeline(code.data, code.size);
+  }
+
+  VkPipeline build_tile_compute_pipeline(const void *code, size_t size) {
+    VkShaderModule comp_shader = create_shader_module(code, size);
+    VkComputePipelineCreateInfo pipeline_info{};
+    pipeline_info.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+    pipeline_info.stage.sType =
+        VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    pipeline_info.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+    pipeline_info.stage.module = comp_shader;
+    pipeline_info.stage.pName = "main";
+    pipeline_info.layout = compute_pipeline_layout;
+    VkPipeline pipeline;
+    VkResult result = vkCreateComputePipelines(
+        device, pipeline_cache, 1, &pipeline_info, nullptr, &pipeline);
+    vkDestroyShaderModule(device, comp_shader, nullptr);
+    if (result != VK_SUCCESS) {
+      throw std::runtime_error("failed to create compute pipeline");
+    }
+    return pipeline;
+  }
+
+  VkShaderModule create_shader_module(const void *code, size_t size) {
     VkShaderModuleCreateInfo create_info{};
     create_info.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
-    create_info.codeSize = code.size();
-    create_info.pCode = reinterpret_cast<const uint32_t *>(code.data());
+    create_info.codeSize = size;
+    create_info.pCode = reinterpret_cast<const uint32_t *>(code);
     VkShaderModule shader_module;
     if (vkCreateShaderModule(device, &create_info, nullptr, &shader_module) !=
         VK_SUCCESS) {
@@ -466,27 +1445,52 @@ private:
     color_attachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
     color_attachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
     color_attachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-    color_attachment.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+    color_attachment.finalLayout =
+        options.headless ? VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL
+                         : VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+    // Depth is only needed inside the pass.
+    VkAttachmentDescription depth_attachment{};
+    depth_attachment.format = depth_format;
+    depth_attachment.samples = VK_SAMPLE_COUNT_1_BIT;
+    depth_attachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+    depth_attachment.storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+    depth_attachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+    depth_attachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+    depth_attachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    depth_attachment.finalLayout =
+        VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
     VkAttachmentReference color_attachment_ref{};
     color_attachment_ref.attachment = 0;
     color_attachment_ref.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+    VkAttachmentReference depth_attachment_ref{};
+    depth_attachment_ref.attachment = 1;
+    depth_attachment_ref.layout =
+        VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
     VkSubpassDescription subpass{};
     subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
     subpass.colorAttachmentCount = 1;
     subpass.pColorAttachments = &color_attachment_ref;
+    subpass.pDepthStencilAttachment = &depth_attachment_ref;
+    VkAttachmentDescription attachments[] = {color_attachment,
+                                             depth_attachment};
     VkRenderPassCreateInfo render_pass_info{};
     render_pass_info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
-    render_pass_info.attachmentCount = 1;
-    render_pass_info.pAttachments = &color_attachment;
+    render_pass_info.attachmentCount = 2;
+    render_pass_info.pAttachments = attachments;
     render_pass_info.subpassCount = 1;
     render_pass_info.pSubpasses = &subpass;
     VkSubpassDependency dependency{};
     dependency.srcSubpass = VK_SUBPASS_EXTERNAL;
     dependency.dstSubpass = 0;
-    dependency.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-    dependency.srcAccessMask = 0;
-    dependency.dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-    dependency.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+    // The previous frame's depth tests finish before this frame clears the
+    // shared depth buffer.
+    dependency.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT |
+                              VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+    dependency.srcAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+    dependency.dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT |
+                              VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT;
+    dependency.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT |
+                               VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
     render_pass_info.dependencyCount = 1;
     render_pass_info.pDependencies = &dependency;
     if (vkCreateRenderPass(device, &render_pass_info, nullptr, &render_pass) !=
@@ -500,11 +1504,12 @@ private:
     for (size_t i = 0; i < swap_chain_image_views.size(); i++) {
       VkImageView attachments[] = {
           swap_chain_image_views[i],
+          depth_image_view,
       };
       VkFramebufferCreateInfo framebuffer_info{};
       framebuffer_info.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
       framebuffer_info.renderPass = render_pass;
-      framebuffer_info.attachmentCount = 1;
+      framebuffer_info.attachmentCount = 2;
       framebuffer_info.pAttachments = attachments;
       framebuffer_info.width = swap_chain_extent.width;
       framebuffer_info.height = swap_chain_extent.height;
@@ -525,102 +1530,662 @@ private:
         VK_SUCCESS) {
       throw std::runtime_error("failed to create command pool");
     }
+    pool_info.queueFamilyIndex = queue_indices.compute_family.value();
+    if (vkCreateCommandPool(device, &pool_info, nullptr,
+                            &compute_command_pool) != VK_SUCCESS) {
+      throw std::runtime_error("failed to create command pool");
+    }
+  }
+
+  void create_record_contexts() {
+    workers.init(std::clamp(std::thread::hardware_concurrency(), 1u,
+                            MAX_RECORD_THREADS));
+    record_contexts.resize(latency.frames_in_flight * workers.size());
+    secondary_buffers.resize(workers.size());
+    for (auto &context : record_contexts) {
+      create_record_context(context);
+    }
+    sprite_contexts.resize(latency.frames_in_flight);
+    for (auto &context : sprite_contexts) {
+      create_record_context(context);
+    }
+  }
+
+  void create_record_context(RecordContext &context) {
+    VkCommandPoolCreateInfo pool_info{};
+    pool_info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    pool_info.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+    pool_info.queueFamilyIndex = queue_indices.graphics_family.value();
+    if (vkCreateCommandPool(device, &pool_info, nullptr,
+                            &context.command_pool) != VK_SUCCESS) {
+      throw std::runtime_error("failed to create command pool");
+    }
+    VkCommandBufferAllocateInfo alloc_info{};
+    alloc_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    alloc_info.commandPool = context.command_pool;
+    alloc_info.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+    alloc_info.commandBufferCount = 1;
+    if (vkAllocateCommandBuffers(device, &alloc_info,
+                                 &context.command_buffer) != VK_SUCCESS) {
+      throw std::runtime_error("failed to allocate command buffers");
+    }
   }
 
+  void create_profiler() {
+    uint32_t count = 0;
+    vkGetPhysicalDeviceQueueFamilyProperties(physical_device, &count, nullptr);
+    std::vector<VkQueueFamilyProperties> families(count);
+    vkGetPhysicalDeviceQueueFamilyProperties(physical_device, &count,
+                                             families.data());
+    std::vector<std::string> scopes = {"tile compute", "render pass"};
+    for (uint32_t i = 0; i < workers.size(); i++) {
+      scopes.push_back("slice " + std::to_string(i));
+    }
+    profiler.init(
+        physical_device, device,
+        families[queue_indices.graphics_family.value()].timestampValidBits,
+        latency.frames_in_flight, scopes, fragment_statistics_supported);
+  }
+
+  // Buffers are shared by every queue family unless exclusive, then the
+  // frame graph transfers them between families.
   void create_buffer(VkDeviceSize size, VkBufferUsageFlags usage,
                      VkMemoryPropertyFlags properties, VkBuffer &buffer,
-                     VkDeviceMemory &buffer_memory) {
+                     GpuAllocation &allocation, bool exclusive = false) {
     VkBufferCreateInfo buffer_info{};
     buffer_info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
     buffer_info.size = size;
     buffer_info.usage = usage;
-    buffer_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    std::set<uint32_t> families = {queue_indices.graphics_family.value(),
+                                   queue_indices.transfer_family.value(),
+                                   queue_indices.compute_family.value()};
+    std::vector<uint32_t> queue_family_indices(families.begin(),
+                                               families.end());
+    if (queue_family_indices.size() > 1 && !exclusive) {
+      buffer_info.sharingMode = VK_SHARING_MODE_CONCURRENT;
+      buffer_info.queueFamilyIndexCount =
+          static_cast<uint32_t>(queue_family_indices.size());
+      buffer_info.pQueueFamilyIndices = queue_family_indices.data();
+    } else {
+      buffer_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    }
     if (vkCreateBuffer(device, &buffer_info, nullptr, &buffer) != VK_SUCCESS) {
       throw std::runtime_error("failed to create vertex buffer");
     }
     VkMemoryRequirements mem_requirements;
     vkGetBufferMemoryRequirements(device, buffer, &mem_requirements);
-    VkMemoryAllocateInfo alloc_info{};
-    alloc_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-    alloc_info.allocationSize = mem_requirements.size;
-    alloc_info.memoryTypeIndex =
-        find_memory_type(mem_requirements.memoryTypeBits, properties);
-    if (vkAllocateMemory(device, &alloc_info, nullptr, &buffer_memory) !=
-        VK_SUCCESS) {
-      throw std::runtime_error("failed to allocate vertex buffer memory");
-    }
-    vkBindBufferMemory(device, buffer, buffer_memory, 0);
+    allocation = allocator.allocate(
+        mem_requirements,
+        find_memory_type(mem_requirements.memoryTypeBits, properties));
+    vkBindBufferMemory(device, buffer, allocation.memory, allocation.offset);
   }
 
-  void create_vertex_buffer() {
-    VkDeviceSize buffer_size = sizeof(Vertex) * vertices.size();
-    VkBuffer staging_buffer;
-    VkDeviceMemory staging_buffer_memory;
-    create_buffer(buffer_size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-                  VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
-                      VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-                  staging_buffer, staging_buffer_memory);
-    void *data;
-    vkMapMemory(device, staging_buffer_memory, 0, buffer_size, 0, &data);
-    memcpy(data, vertices.data(), buffer_size);
-    vkUnmapMemory(device, staging_buffer_memory);
-    create_buffer(buffer_size,
-                  VK_BUFFER_USAGE_TRANSFER_DST_BIT |
-                      VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
-                  VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, vertex_buffer,
-                  vertex_buffer_memory);
-    copy_buffer(staging_buffer, vertex_buffer, buffer_size);
-    vkDestroyBuffer(device, staging_buffer, nullptr);
-    vkFreeMemory(device, staging_buffer_memory, nullptr);
+  void destroy_buffer(VkBuffer buffer, GpuAllocation &allocation) {
+    vkDestroyBuffer(device, buffer, nullptr);
+    allocator.free(allocation);
   }
 
-  void create_index_buffer() {
-    VkDeviceSize buffer_size = sizeof(indices[0]) * indices.size();
-    VkBuffer staging_buffer;
-    VkDeviceMemory staging_buffer_memory;
-    create_buffer(buffer_size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+  void create_uploader() {
+    create_buffer(STAGING_RING_SIZE, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
                   VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
                       VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-                  staging_buffer, staging_buffer_memory);
-    void *data;
-    vkMapMemory(device, staging_buffer_memory, 0, buffer_size, 0, &data);
-    memcpy(data, indices.data(), (size_t) buffer_size);
-    vkUnmapMemory(device, staging_buffer_memory);
-    create_buffer(
-        buffer_size,
-        VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
-        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, index_buffer, index_buffer_memory);
-    copy_buffer(staging_buffer, index_buffer, buffer_size);
-    vkDestroyBuffer(device, staging_buffer, nullptr);
-    vkFreeMemory(device, staging_buffer_memory, nullptr);
+                  staging_ring_buffer, staging_ring_allocation);
+    uploader.init(device, queue_indices.transfer_family.value(), timeline,
+                  staging_ring_buffer,
+                  staging_ring_allocation.mapped, STAGING_RING_SIZE);
   }
 
-  void copy_buffer(VkBuffer src_buffer, VkBuffer dst_buffer,
-                   VkDeviceSize size) {
-    VkCommandBufferAllocateInfo alloc_info{};
-    alloc_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-    alloc_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-    alloc_info.commandPool = command_pool;
-    alloc_info.commandBufferCount = 1;
-    VkCommandBuffer command_buffer;
-    vkAllocateCommandBuffers(device, &alloc_info, &command_buffer);
-    VkCommandBufferBeginInfo begin_info{};
-    begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-    begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
-    vkBeginCommandBuffer(command_buffer, &begin_info);
-    VkBufferCopy copy_region{};
-    copy_region.srcOffset = 0;
-    copy_region.dstOffset = 0;
-    copy_region.size = size;
-    vkCmdCopyBuffer(command_buffer, src_buffer, dst_buffer, 1, &copy_region);
-    vkEndCommandBuffer(command_buffer);
-    VkSubmitInfo submit_info{};
-    submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-    submit_info.commandBufferCount = 1;
-    submit_info.pCommandBuffers = &command_buffer;
-    vkQueueSubmit(graphics_queue, 1, &submit_info, VK_NULL_HANDLE);
-    vkQueueWaitIdle(graphics_queue);
-    vkFreeCommandBuffers(device, command_pool, 1, &command_buffer);
+  // Lets the transfer queue read blobs straight out of the mapped archive
+  // with VK_EXT_external_memory_host, so uploads skip the staging ring.
+  // Drivers are free to refuse file backed pages, uploads then copy from the
+  // mapping into the ring instead, see upload_asset().
+  void import_asset_archive() {
+    if (!external_memory_host_enabled) {
+      return;
+    }
+    VkPhysicalDeviceExternalMemoryHostPropertiesEXT host_properties{};
+    host_properties.sType =
+        VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_EXTERNAL_MEMORY_HOST_PROPERTIES_EXT;
+    VkPhysicalDeviceProperties2 properties{};
+    properties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+    properties.pNext = &host_properties;
+    vkGetPhysicalDeviceProperties2(physical_device, &properties);
+    VkDeviceSize alignment = host_properties.minImportedHostPointerAlignment;
+    if ((uintptr_t)assets.data() % alignment != 0 ||
+        assets.size() % alignment != 0) {
+      return;
+    }
+    auto get_host_pointer_properties =
+        reinterpret_cast<PFN_vkGetMemoryHostPointerPropertiesEXT>(
+            vkGetDeviceProcAddr(device, "vkGetMemoryHostPointerPropertiesEXT"));
+    VkMemoryHostPointerPropertiesEXT pointer_properties{};
+    pointer_properties.sType =
+        VK_STRUCTURE_TYPE_MEMORY_HOST_POINTER_PROPERTIES_EXT;
+    if (get_host_pointer_properties(
+            device, VK_EXTERNAL_MEMORY_HANDLE_TYPE_HOST_ALLOCATION_BIT_EXT,
+            assets.data(), &pointer_properties) != VK_SUCCESS) {
+      return;
+    }
+    VkExternalMemoryBufferCreateInfo external_info{};
+    external_info.sType = VK_STRUCTURE_TYPE_EXTERNAL_MEMORY_BUFFER_CREATE_INFO;
+    external_info.handleTypes =
+        VK_EXTERNAL_MEMORY_HANDLE_TYPE_HOST_ALLOCATION_BIT_EXT;
+    VkBufferCreateInfo buffer_info{};
+    buffer_info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    buffer_info.pNext = &external_info;
+    buffer_info.size = assets.size();
+    buffer_info.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+    // Only ever read by the transfer queue.
+    buffer_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    if (vkCreateBuffer(device, &buffer_info, nullptr, &asset_buffer) !=
+        VK_SUCCESS) {
+      throw std::runtime_error("failed to create asset buffer");
+    }
+    VkMemoryRequirements mem_requirements;
+    vkGetBufferMemoryRequirements(device, asset_buffer, &mem_requirements);
+    uint32_t memory_types =
+        mem_requirements.memoryTypeBits & pointer_properties.memoryTypeBits;
+    if (memory_types == 0) {
+      vkDestroyBuffer(device, asset_buffer, nullptr);
+      asset_buffer = VK_NULL_HANDLE;
+      return;
+    }
+    VkImportMemoryHostPointerInfoEXT import_info{};
+    import_info.sType = VK_STRUCTURE_TYPE_IMPORT_MEMORY_HOST_POINTER_INFO_EXT;
+    import_info.handleType =
+        VK_EXTERNAL_MEMORY_HANDLE_TYPE_HOST_ALLOCATION_BIT_EXT;
+    import_info.pHostPointer = const_cast<void *>(assets.data());
+    VkMemoryAllocateInfo alloc_info{};
+    alloc_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+    alloc_info.pNext = &import_info;
+    alloc_info.allocationSize = assets.size();
+    alloc_info.memoryTypeIndex = find_memory_type(memory_types, 0);
+    if (vkAllocateMemory(device, &alloc_info, nullptr, &asset_memory) !=
+        VK_SUCCESS) {
+      vkDestroyBuffer(device, asset_buffer, nullptr);
+      asset_buffer = VK_NULL_HANDLE;
+      return;
+    }
+    vkBindBufferMemory(device, asset_buffer, asset_memory, 0);
+  }
+
+  // Queues a copy of blob into dst, from the imported archive if there is
+  // one and through the staging ring otherwise.
+  void upload_asset(VkBuffer dst, const AssetBlob &blob) {
+    if (asset_buffer != VK_NULL_HANDLE) {
+      uploader.copy(asset_buffer, blob.entry->offset, dst, 0, blob.size);
+    } else {
+      uploader.upload(dst, 0, blob.data, blob.size);
+    }
+  }
+
+  void create_frame_uniforms() {
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(physical_device, &properties);
+    create_buffer(FRAME_UNIFORM_RING_SIZE * latency.frames_in_flight,
+                  VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
+                  VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                      VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                  frame_uniform_buffer, frame_uniform_allocation);
+    frame_uniforms.init(frame_uniform_buffer, frame_uniform_allocation.mapped,
+                        FRAME_UNIFORM_RING_SIZE, latency.frames_in_flight,
+                        properties.limits.minUniformBufferOffsetAlignment);
+  }
+
+  void create_sprite_batch() {
+    create_buffer(SpriteBatch::buffer_size(latency.frames_in_flight),
+                  VK_BUFFER_USAGE_VERTEX_BUFFER_BIT |
+                      VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
+                  VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                      VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                  sprite_batch_buffer, sprite_batch_allocation);
+    sprite_batch.init(sprite_batch_buffer, sprite_batch_allocation.mapped,
+                      latency.frames_in_flight);
+  }
+
+  void create_vertex_buffer() {
+    AssetBlob blob = assets.find("tile_mesh.vertices", ASSET_VERTICES);
+    create_buffer(blob.size,
+                  VK_BUFFER_USAGE_TRANSFER_DST_BIT |
+                      VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+                  VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, vertex_buffer,
+                  vertex_buffer_allocation);
+    upload_asset(vertex_buffer, blob);
+  }
+
+  void create_index_buffer() {
+    AssetBlob blob = assets.find("tile_mesh.indices", ASSET_INDICES);
+    index_type = static_cast<VkIndexType>(blob.entry->format);
+    create_buffer(
+        blob.size,
+        VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
+        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, index_buffer,
+        index_buffer_allocation);
+    upload_asset(index_buffer, blob);
+  }
+
+  void create_texture_image(uint32_t size, VkImage &image,
+                            GpuAllocation &allocation) {
+    VkImageCreateInfo image_info{};
+    image_info.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+    image_info.imageType = VK_IMAGE_TYPE_2D;
+    image_info.format = VK_FORMAT_R8G8B8A8_UNORM;
+    image_info.extent = {size, size, 1};
+    image_info.mipLevels = 1;
+    image_info.arrayLayers = 1;
+    image_info.samples = VK_SAMPLE_COUNT_1_BIT;
+    image_info.tiling = VK_IMAGE_TILING_OPTIMAL;
+    image_info.usage =
+        VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+    // Written on the transfer queue and sampled on graphics, like the
+    // buffers in create_buffer().
+    uint32_t queue_family_indices[] = {queue_indices.graphics_family.value(),
+                                       queue_indices.transfer_family.value()};
+    if (queue_indices.transfer_family != queue_indices.graphics_family) {
+      image_info.sharingMode = VK_SHARING_MODE_CONCURRENT;
+      image_info.queueFamilyIndexCount = 2;
+      image_info.pQueueFamilyIndices = queue_family_indices;
+    } else {
+      image_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    }
+    image_info.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    if (vkCreateImage(device, &image_info, nullptr, &image) != VK_SUCCESS) {
+      throw std::runtime_error("failed to create texture image");
+    }
+    VkMemoryRequirements mem_requirements;
+    vkGetImageMemoryRequirements(device, image, &mem_requirements);
+    allocation = allocator.allocate(
+        mem_requirements,
+        find_memory_type(mem_requirements.memoryTypeBits,
+                         VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT),
+        false);
+    vkBindImageMemory(device, image, allocation.memory, allocation.offset);
+  }
+
+  // Packs one sprite per tile type into the atlas and uploads its pages and
+  // the sprite table.
+  void create_tile_textures() {
+    TextureAtlas atlas;
+    for (uint32_t type = 0; type < TILE_TYPE_COUNT; type++) {
+      // Packed straight from the mapped pages.
+      AssetBlob blob = assets.find(tile_texture_asset(type), ASSET_TEXTURE);
+      const AssetEntry &entry = *blob.entry;
+      if (entry.format != VK_FORMAT_R8G8B8A8_UNORM ||
+          blob.size != sizeof(uint32_t) * entry.width * entry.height) {
+        throw std::runtime_error("unsupported tile texture format");
+      }
+      atlas.add(entry.width, entry.height, (const uint32_t *)blob.data);
+    }
+    if (atlas.page_count() > MAX_BINDLESS_TEXTURES) {
+      throw std::runtime_error("too many atlas pages");
+    }
+    uint32_t page_size = atlas.get_page_size();
+    texture_pages.resize(atlas.page_count());
+    for (uint32_t i = 0; i < atlas.page_count(); i++) {
+      TexturePage &page = texture_pages[i];
+      create_texture_image(page_size, page.image, page.allocation);
+      const std::vector<uint32_t> &pixels = atlas.page_pixels(i);
+      uploader.upload_image(page.image, {page_size, page_size, 1},
+                            pixels.data(), sizeof(uint32_t) * pixels.size());
+      VkImageViewCreateInfo view_info{};
+      view_info.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+      view_info.image = page.image;
+      view_info.viewType = VK_IMAGE_VIEW_TYPE_2D;
+      view_info.format = VK_FORMAT_R8G8B8A8_UNORM;
+      view_info.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+      view_info.subresourceRange.levelCount = 1;
+      view_info.subresourceRange.layerCount = 1;
+      if (vkCreateImageView(device, &view_info, nullptr, &page.view) !=
+          VK_SUCCESS) {
+        throw std::runtime_error("failed to create texture image view");
+      }
+    }
+    std::vector<SpriteRecord> sprites(atlas.sprite_count());
+    for (uint32_t i = 0; i < atlas.sprite_count(); i++) {
+      const AtlasRegion &region = atlas.region(i);
+      float scale = 1.0f / page_size;
+      sprites[i].uv_rect = glm::vec4(
+          region.x * scale, region.y * scale, (region.x + region.width) * scale,
+          (region.y + region.height) * scale);
+      sprites[i].page = region.page;
+    }
+    VkDeviceSize buffer_size = sizeof(SpriteRecord) * sprites.size();
+    create_buffer(
+        buffer_size,
+        VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, sprite_buffer,
+        sprite_buffer_allocation);
+    uploader.upload(sprite_buffer, 0, sprites.data(), buffer_size);
+    VkSamplerCreateInfo sampler_info{};
+    sampler_info.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+    sampler_info.magFilter = VK_FILTER_LINEAR;
+    sampler_info.minFilter = VK_FILTER_LINEAR;
+    sampler_info.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+    sampler_info.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    sampler_info.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    sampler_info.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    sampler_info.maxLod = 0.0f;
+    if (vkCreateSampler(device, &sampler_info, nullptr, &texture_sampler) !=
+        VK_SUCCESS) {
+      throw std::runtime_error("failed to create texture sampler");
+    }
+  }
+
+  void destroy_tile_textures() {
+    for (auto &page : texture_pages) {
+      vkDestroyImageView(device, page.view, nullptr);
+      vkDestroyImage(device, page.image, nullptr);
+      allocator.free(page.allocation);
+    }
+    texture_pages.clear();
+    destroy_buffer(sprite_buffer, sprite_buffer_allocation);
+    vkDestroySampler(device, texture_sampler, nullptr);
+  }
+
+  // Deterministic, so benchmark runs of the same tile count are comparable.
+  // The first tile_count tiles of a map_size square in row order, stored
+  // chunk by chunk.
+  std::vector<TileInstance> generate_tile_map(uint32_t tile_count,
+                                              uint32_t map_size) {
+    const uint32_t palette[] = {0xff4f8f3f, 0xff3f7f2f, 0xff8fbfcf,
+                                0xff9f9f9f, 0xff2f5f8f, 0xff6f6f4f,
+                                0xffcfdfef};
+    uint32_t chunks_per_row = (map_size + CHUNK_SIZE - 1) / CHUNK_SIZE;
+    std::vector<TileInstance> tiles(chunks_per_row * chunks_per_row *
+                                    CHUNK_TILES);
+    for (uint32_t y = 0; y < map_size; y++) {
+      for (uint32_t x = 0; x < map_size && y * map_size + x < tile_count;
+           x++) {
+        uint32_t hash = (x * 73856093u) ^ (y * 19349663u);
+        uint32_t chunk = (y / CHUNK_SIZE) * chunks_per_row + x / CHUNK_SIZE;
+        uint32_t slot = (y % CHUNK_SIZE) * CHUNK_SIZE + x % CHUNK_SIZE;
+        TileInstance &tile = tiles[chunk * CHUNK_TILES + slot];
+        tile.grid = {(uint16_t)x, (uint16_t)y};
+        tile.tile_type = hash % 8;
+        tile.color = {tile.tile_type ? palette[tile.tile_type - 1] : 0};
+      }
+    }
+    return tiles;
+  }
+
+  // Runs on a job thread, only touches scene, the allocator and the
+  // uploader.
+  void create_tile_scene(uint32_t tile_count, TileScene &scene) {
+    uint32_t map_size = (uint32_t)std::ceil(std::sqrt((double)tile_count));
+    if (map_size > TILE_MAP_MAX_SIZE) {
+      throw std::runtime_error("tile map too large");
+    }
+    std::vector<TileInstance> tiles = generate_tile_map(tile_count, map_size);
+    scene.map_size = map_size;
+    uint32_t chunks_per_row = (map_size + CHUNK_SIZE - 1) / CHUNK_SIZE;
+    scene.chunk_bounds.resize(chunks_per_row * chunks_per_row);
+    for (uint32_t y = 0; y < chunks_per_row; y++) {
+      for (uint32_t x = 0; x < chunks_per_row; x++) {
+        scene.chunk_bounds.set(y * chunks_per_row + x, (float)(x * CHUNK_SIZE),
+                               (float)(y * CHUNK_SIZE),
+                               (float)std::min((x + 1) * CHUNK_SIZE, map_size),
+                               (float)std::min((y + 1) * CHUNK_SIZE, map_size));
+      }
+    }
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(physical_device, &properties);
+    VkDeviceSize alignment = properties.limits.minStorageBufferOffsetAlignment;
+    scene.visible_chunk_stride =
+        (sizeof(uint32_t) * scene.chunk_bounds.count + alignment - 1) /
+        alignment * alignment;
+    create_buffer(scene.visible_chunk_stride * latency.frames_in_flight,
+                  VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                  VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                      VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                  scene.visible_chunk_buffer, scene.visible_chunk_allocation);
+    auto align = [alignment](VkDeviceSize size) {
+      return (size + alignment - 1) / alignment * alignment;
+    };
+    VkDeviceSize buffer_size = sizeof(TileInstance) * tiles.size();
+    create_buffer(buffer_size,
+                  VK_BUFFER_USAGE_TRANSFER_DST_BIT |
+                      VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                  VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, scene.tile_buffer,
+                  scene.tile_buffer_allocation);
+    uploader.upload(scene.tile_buffer, 0, tiles.data(), buffer_size);
+    // Every LOD gets room for all tiles.
+    scene.visible_tile_stride = align(buffer_size * TILE_LOD_COUNT);
+    create_buffer(scene.visible_tile_stride * latency.frames_in_flight,
+                  VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+                      VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+                  VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+                  scene.visible_tile_buffer,
+                  scene.visible_tile_buffer_allocation, true);
+    // One draw per LOD and slice, instanceCount is reset and filled by the
+    // compute pass every frame. firstInstance follows the visible chunk
+    // count, see prepare_visible_chunks().
+    scene.indirect_commands.resize(TILE_LOD_COUNT * workers.size());
+    for (uint32_t i = 0; i < scene.indirect_commands.size(); i++) {
+      const TileLod &lod = tile_lods[i / workers.size()];
+      scene.indirect_commands[i].indexCount = lod.index_count;
+      scene.indirect_commands[i].firstIndex = lod.first_index;
+    }
+    // Filled in by the compute pass itself, see record_tile_pass().
+    scene.indirect_stride = align(sizeof(VkDrawIndexedIndirectCommand) *
+                                  scene.indirect_commands.size());
+    create_buffer(scene.indirect_stride * latency.frames_in_flight,
+                  VK_BUFFER_USAGE_TRANSFER_DST_BIT |
+                      VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+                      VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT,
+                  VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, scene.indirect_buffer,
+                  scene.indirect_buffer_allocation, true);
+    scene.upload_point = uploader.flush();
+  }
+
+  void destroy_tile_scene(TileScene &scene) {
+    vkDestroyDescriptorPool(device, scene.descriptor_pool, nullptr);
+    destroy_buffer(scene.tile_buffer, scene.tile_buffer_allocation);
+    destroy_buffer(scene.visible_tile_buffer,
+                   scene.visible_tile_buffer_allocation);
+    destroy_buffer(scene.indirect_buffer, scene.indirect_buffer_allocation);
+    destroy_buffer(scene.visible_chunk_buffer, scene.visible_chunk_allocation);
+  }
+
+  // Builds a tile map on the job system. Frames keep drawing the current
+  // scene until the new one is installed on the render thread.
+  std::shared_ptr<JobCounter> load_tile_scene(uint32_t tile_count) {
+    auto loaded = std::make_shared<TileScene>();
+    auto counter = std::make_shared<JobCounter>();
+    counter->on_complete = [this, loaded] {
+      install_tile_scene(std::move(*loaded));
+    };
+    jobs.submit([this, tile_count,
+                 loaded] { create_tile_scene(tile_count, *loaded); },
+                counter);
+    return counter;
+  }
+
+  void install_tile_scene(TileScene &&loaded) {
+    if (tile_scene_ready) {
+      // Frames in flight may still read the old buffers and descriptors.
+      auto old = std::make_shared<TileScene>(std::move(scene));
+      deletions.retire([this, old] { destroy_tile_scene(*old); });
+    }
+    scene = std::move(loaded);
+    if (scene.upload_point.value > upload_point.value) {
+      upload_point = scene.upload_point;
+    }
+    Camera start;
+    start.center = glm::vec2(scene.map_size * 0.5f, scene.map_size * 0.5f);
+    start.extent = std::min((float)scene.map_size, CAMERA_DEFAULT_EXTENT);
+    reset_world(start);
+    visible_chunks.reserve(scene.chunk_bounds.count);
+    create_tile_descriptors(scene);
+    tile_scene_ready = true;
+  }
+
+  // Atlas packing and texture uploads run on the job system, the texture
+  // descriptors are written once they are done.
+  std::shared_ptr<JobCounter> load_tile_textures() {
+    auto point = std::make_shared<TimelinePoint>();
+    auto counter = std::make_shared<JobCounter>();
+    counter->on_complete = [this, point] {
+      create_texture_descriptors();
+      if (point->value > upload_point.value) {
+        upload_point = *point;
+      }
+      tile_textures_ready = true;
+    };
+    jobs.submit(
+        [this, point] {
+          create_tile_textures();
+          *point = uploader.flush();
+        },
+        counter);
+    return counter;
+  }
+
+  // Tiles are only drawn once every asset they use arrived.
+  bool tiles_ready() const { return tile_scene_ready && tile_textures_ready; }
+
+  void create_descriptor_pool() {
+    // Only the frame set, tile scenes bring their own pools.
+    std::array<VkDescriptorPoolSize, 1> pool_sizes{};
+    pool_sizes[0].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+    pool_sizes[0].descriptorCount = 1;
+    VkDescriptorPoolCreateInfo pool_info{};
+    pool_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+    pool_info.poolSizeCount = static_cast<uint32_t>(pool_sizes.size());
+    pool_info.pPoolSizes = pool_sizes.data();
+    pool_info.maxSets = 1;
+    if (vkCreateDescriptorPool(device, &pool_info, nullptr,
+                               &descriptor_pool) != VK_SUCCESS) {
+      throw std::runtime_error("failed to create descriptor pool");
+    }
+  }
+
+  void create_descriptor_sets() {
+    VkDescriptorSetAllocateInfo alloc_info{};
+    alloc_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+    alloc_info.descriptorPool = descriptor_pool;
+    alloc_info.descriptorSetCount = 1;
+    alloc_info.pSetLayouts = &frame_set_layout;
+    if (vkAllocateDescriptorSets(device, &alloc_info, &frame_descriptor_set) !=
+        VK_SUCCESS) {
+      throw std::runtime_error("failed to allocate descriptor sets");
+    }
+    // Written once, frames select their block with the dynamic offset.
+    VkDescriptorBufferInfo buffer_info{};
+    buffer_info.buffer = frame_uniforms.get_buffer();
+    buffer_info.offset = 0;
+    buffer_info.range = sizeof(FrameUniforms);
+    VkWriteDescriptorSet write{};
+    write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    write.dstSet = frame_descriptor_set;
+    write.dstBinding = 0;
+    write.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+    write.descriptorCount = 1;
+    write.pBufferInfo = &buffer_info;
+    vkUpdateDescriptorSets(device, 1, &write, 0, nullptr);
+  }
+
+  void create_texture_descriptors() {
+    std::array<VkDescriptorPoolSize, 3> pool_sizes{};
+    pool_sizes[0].type = VK_DESCRIPTOR_TYPE_SAMPLER;
+    pool_sizes[0].descriptorCount = 1;
+    pool_sizes[1].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    pool_sizes[1].descriptorCount = 1;
+    pool_sizes[2].type = VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE;
+    pool_sizes[2].descriptorCount = MAX_BINDLESS_TEXTURES;
+    VkDescriptorPoolCreateInfo pool_info{};
+    pool_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+    pool_info.flags = VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT;
+    pool_info.poolSizeCount = static_cast<uint32_t>(pool_sizes.size());
+    pool_info.pPoolSizes = pool_sizes.data();
+    pool_info.maxSets = 1;
+    if (vkCreateDescriptorPool(device, &pool_info, nullptr,
+                               &texture_descriptor_pool) != VK_SUCCESS) {
+      throw std::runtime_error("failed to create descriptor pool");
+    }
+    VkDescriptorSetAllocateInfo alloc_info{};
+    alloc_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+    alloc_info.descriptorPool = texture_descriptor_pool;
+    alloc_info.descriptorSetCount = 1;
+    alloc_info.pSetLayouts = &texture_set_layout;
+    if (vkAllocateDescriptorSets(device, &alloc_info,
+                                 &texture_descriptor_set) != VK_SUCCESS) {
+      throw std::runtime_error("failed to allocate descriptor sets");
+    }
+    VkDescriptorImageInfo sampler_info{};
+    sampler_info.sampler = texture_sampler;
+    VkDescriptorBufferInfo sprite_info{};
+    sprite_info.buffer = sprite_buffer;
+    sprite_info.offset = 0;
+    sprite_info.range = VK_WHOLE_SIZE;
+    std::vector<VkDescriptorImageInfo> page_infos(texture_pages.size());
+    for (size_t i = 0; i < texture_pages.size(); i++) {
+      page_infos[i].imageView = texture_pages[i].view;
+      page_infos[i].imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    }
+    std::array<VkWriteDescriptorSet, 3> writes{};
+    for (uint32_t i = 0; i < writes.size(); i++) {
+      writes[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+      writes[i].dstSet = texture_descriptor_set;
+      writes[i].dstBinding = i;
+      writes[i].descriptorCount = 1;
+    }
+    writes[0].descriptorType = VK_DESCRIPTOR_TYPE_SAMPLER;
+    writes[0].pImageInfo = &sampler_info;
+    writes[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    writes[1].pBufferInfo = &sprite_info;
+    writes[2].descriptorType = VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE;
+    writes[2].descriptorCount = static_cast<uint32_t>(page_infos.size());
+    writes[2].pImageInfo = page_infos.data();
+    vkUpdateDescriptorSets(device, static_cast<uint32_t>(writes.size()),
+                           writes.data(), 0, nullptr);
+  }
+
+  // A set of the scene's own, so installing a scene never rewrites the one
+  // frames in flight are culling with.
+  void create_tile_descriptors(TileScene &scene) {
+    std::array<VkDescriptorPoolSize, 2> pool_sizes{};
+    pool_sizes[0].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    pool_sizes[0].descriptorCount = 1;
+    pool_sizes[1].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC;
+    pool_sizes[1].descriptorCount = 3;
+    VkDescriptorPoolCreateInfo pool_info{};
+    pool_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+    pool_info.poolSizeCount = static_cast<uint32_t>(pool_sizes.size());
+    pool_info.pPoolSizes = pool_sizes.data();
+    pool_info.maxSets = 1;
+    if (vkCreateDescriptorPool(device, &pool_info, nullptr,
+                               &scene.descriptor_pool) != VK_SUCCESS) {
+      throw std::runtime_error("failed to create descriptor pool");
+    }
+    VkDescriptorSetAllocateInfo alloc_info{};
+    alloc_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+    alloc_info.descriptorPool = scene.descriptor_pool;
+    alloc_info.descriptorSetCount = 1;
+    alloc_info.pSetLayouts = &tile_set_layout;
+    if (vkAllocateDescriptorSets(device, &alloc_info,
+                                 &scene.descriptor_set) != VK_SUCCESS) {
+      throw std::runtime_error("failed to allocate descriptor sets");
+    }
+    VkBuffer buffers[] = {scene.tile_buffer, scene.visible_tile_buffer,
+                          scene.indirect_buffer, scene.visible_chunk_buffer};
+    std::array<VkDescriptorBufferInfo, 4> buffer_infos{};
+    std::array<VkWriteDescriptorSet, 4> writes{};
+    for (uint32_t i = 0; i < writes.size(); i++) {
+      buffer_infos[i].buffer = buffers[i];
+      buffer_infos[i].offset = 0;
+      buffer_infos[i].range = VK_WHOLE_SIZE;
+      writes[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+      writes[i].dstSet = scene.descriptor_set;
+      writes[i].dstBinding = i;
+      writes[i].descriptorType = tile_descriptor_type(i);
+      writes[i].descriptorCount = 1;
+      writes[i].pBufferInfo = &buffer_infos[i];
+    }
+    buffer_infos[1].range = scene.visible_tile_stride;
+    buffer_infos[2].range = scene.indirect_stride;
+    buffer_infos[3].range = scene.visible_chunk_stride;
+    vkUpdateDescriptorSets(device, static_cast<uint32_t>(writes.size()),
+                           writes.data(), 0, nullptr);
   }
 
   uint32_t find_memory_type(uint32_t type_filter,
@@ -638,7 +2203,7 @@ private:
   }
 
   void create_command_buffers() {
-    command_buffers.resize(MAX_FRAMES_IN_FLIGHT);
+    command_buffers.resize(latency.frames_in_flight);
     VkCommandBufferAllocateInfo alloc_info{};
     alloc_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
     alloc_info.commandPool = command_pool;
@@ -648,59 +2213,456 @@ private:
         VK_SUCCESS) {
       throw std::runtime_error("failed to allocate command buffers");
     }
+    compute_command_buffers.resize(latency.frames_in_flight);
+    alloc_info.commandPool = compute_command_pool;
+    if (vkAllocateCommandBuffers(device, &alloc_info,
+                                 compute_command_buffers.data()) !=
+        VK_SUCCESS) {
+      throw std::runtime_error("failed to allocate command buffers");
+    }
   }
 
   void create_sync_objects() {
-    image_available_semaphores.resize(MAX_FRAMES_IN_FLIGHT);
-    render_finished_semaphores.resize(MAX_FRAMES_IN_FLIGHT);
-    in_flight_fences.resize(MAX_FRAMES_IN_FLIGHT);
+    image_available_semaphores.resize(latency.frames_in_flight);
+    render_finished_semaphores.resize(latency.frames_in_flight);
+    frame_points.assign(latency.frames_in_flight, TimelinePoint{});
+    frame_arenas.resize(latency.frames_in_flight);
+    for (auto &arena : frame_arenas) {
+      arena.init();
+    }
     VkSemaphoreCreateInfo semaphore_info{};
     semaphore_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
-    VkFenceCreateInfo fence_info{};
-    fence_info.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
-    fence_info.flags = VK_FENCE_CREATE_SIGNALED_BIT;
-    for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+    for (size_t i = 0; i < latency.frames_in_flight; i++) {
       if (vkCreateSemaphore(device, &semaphore_info, nullptr,
                             &image_available_semaphores[i]) ||
           vkCreateSemaphore(device, &semaphore_info, nullptr,
-                            &render_finished_semaphores[i]) ||
-          vkCreateFence(device, &fence_info, nullptr, &in_flight_fences[i]) !=
-              VK_SUCCESS) {
+                            &render_finished_semaphores[i]) != VK_SUCCESS) {
         throw std::runtime_error("failed to create semaphore");
       }
     }
   }
 
-  void record_command_buffer(VkCommandBuffer buffer, uint32_t image_index) {
+  // Culls the chunks against the camera and lays out the slices of the
+  // visible ones for this frame.
+  void prepare_visible_chunks(uint32_t current_frame) {
+    cull_chunks(scene.chunk_bounds, camera.view(), visible_chunks);
+    sort_visible_chunks(frame_arenas[current_frame]);
+    uint32_t count = static_cast<uint32_t>(visible_chunks.size());
+    // The last submission reading this range completed before the frame
+    // started.
+    memcpy((char *)scene.visible_chunk_allocation.mapped +
+               current_frame * scene.visible_chunk_stride,
+           visible_chunks.data(), sizeof(uint32_t) * count);
+    IsoViewRect view = camera.view();
+    tile_push_constants.view = view;
+    tile_push_constants.chunk_count = count;
+    tile_push_constants.chunks_per_slice =
+        std::max(1u, (count + workers.size() - 1) / workers.size());
+    tile_push_constants.slice_count = workers.size();
+    tile_push_constants.pixels_per_unit =
+        swap_chain_extent.width * 0.5f / camera.extent;
+    tile_push_constants.lod0_min_pixels = TILE_LOD0_MIN_PIXELS;
+    uint32_t lod_stride = scene.chunk_bounds.count * CHUNK_TILES;
+    for (uint32_t i = 0; i < scene.indirect_commands.size(); i++) {
+      uint32_t lod = i / workers.size();
+      uint32_t slice = i % workers.size();
+      scene.indirect_commands[i].firstInstance =
+          lod * lod_stride +
+          slice * tile_push_constants.chunks_per_slice * CHUNK_TILES;
+    }
+  }
+
+  // Orders the visible chunks front to back. The compute pass hands out
+  // consecutive chunks to each slice and the slices execute in order, so
+  // every slice is a depth bucket drawn behind the ones before it and the
+  // depth test rejects its hidden fragments before they are shaded.
+  void sort_visible_chunks(FrameArena &arena) {
+    const ChunkBounds &bounds = scene.chunk_bounds;
+    FrameVector<uint64_t> keys = make_frame_vector<uint64_t>(arena);
+    FrameVector<uint64_t> scratch = make_frame_vector<uint64_t>(arena);
+    keys.reserve(visible_chunks.size());
+    for (uint32_t chunk : visible_chunks) {
+      glm::vec2 center((bounds.min_x[chunk] + bounds.max_x[chunk]) * 0.5f,
+                       (bounds.min_y[chunk] + bounds.max_y[chunk]) * 0.5f);
+      float depth = camera.depth(center);
+      // One pipeline and material for the whole map.
+      keys.push_back(opaque_draw_key(0, 0, depth, chunk));
+    }
+    radix_sort_draw_keys(keys, scratch);
+    for (size_t i = 0; i < keys.size(); i++) {
+      visible_chunks[i] = draw_key_payload(keys[i]);
+    }
+  }
+
+  // Writes camera and time of this frame into its uniform ring region.
+  void update_frame_uniforms(uint32_t current_frame) {
+    auto now = std::chrono::steady_clock::now();
+    FrameUniforms uniforms{};
+    // clip = (iso - center) / extent with iso = (x - y, x + y), in column
+    // major order.
+    IsoViewRect view = camera.view();
+    float scale = 1.0f / camera.extent;
+    float center_x = (view.min_x + view.max_x) * 0.5f;
+    float center_y = (view.min_y + view.max_y) * 0.5f;
+    uniforms.view_proj = glm::mat4(1.0f);
+    uniforms.view_proj[0] = glm::vec4(scale, scale, 0.0f, 0.0f);
+    uniforms.view_proj[1] = glm::vec4(-scale, scale, 0.0f, 0.0f);
+    uniforms.view_proj[3] =
+        glm::vec4(-center_x * scale, -center_y * scale, 0.0f, 1.0f);
+    uniforms.time = std::chrono::duration<float>(now - start_time).count();
+    uniforms.delta_time =
+        std::chrono::duration<float>(now - last_frame_time).count();
+    uniforms.frame = frame_number++;
+    last_frame_time = now;
+    frame_uniforms.begin_frame(current_frame);
+    frame_uniform_offset = frame_uniforms.push(uniforms);
+  }
+
+  // Runs on the compute queue. The ranges it writes were last drawn from
+  // by this frame in flight's previous use, which completed before the
+  // frame started, and the frame graph orders the draws after it.
+  void record_tile_pass(VkCommandBuffer buffer, uint32_t current_frame) {
+    vkCmdUpdateBuffer(
+        buffer, scene.indirect_buffer, current_frame * scene.indirect_stride,
+        sizeof(VkDrawIndexedIndirectCommand) * scene.indirect_commands.size(),
+        scene.indirect_commands.data());
+    VkMemoryBarrier reset_barrier{};
+    reset_barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    reset_barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    reset_barrier.dstAccessMask =
+        VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+    vkCmdPipelineBarrier(buffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1,
+                         &reset_barrier, 0, nullptr, 0, nullptr);
+    vkCmdBindPipeline(buffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+                      tile_compute_pipeline);
+    uint32_t offsets[] = {
+        static_cast<uint32_t>(current_frame * scene.visible_tile_stride),
+        static_cast<uint32_t>(current_frame * scene.indirect_stride),
+        static_cast<uint32_t>(current_frame * scene.visible_chunk_stride)};
+    vkCmdBindDescriptorSets(buffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+                            compute_pipeline_layout, 0, 1,
+                            &scene.descriptor_set, 3, offsets);
+    vkCmdPushConstants(buffer, compute_pipeline_layout,
+                       VK_SHADER_STAGE_COMPUTE_BIT, 0,
+                       sizeof(tile_push_constants), &tile_push_constants);
+    // One workgroup per visible chunk.
+    vkCmdDispatch(buffer, tile_push_constants.chunk_count, 1, 1);
+  }
+
+  // Runs on a worker thread, only touches the worker's own command pool.
+  void record_tile_slice(uint32_t worker, uint32_t current_frame,
+                         uint32_t image_index) {
+    RecordContext &context =
+        record_contexts[current_frame * workers.size() + worker];
+    VkCommandBuffer buffer = begin_secondary(context, image_index);
+    profiler.begin_gpu_scope(buffer, current_frame, GPU_SCOPE_SLICE + worker);
+    vkCmdBindPipeline(buffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
+                      pipelines.get(tile_variant));
+    VkDescriptorSet sets[] = {frame_descriptor_set, texture_descriptor_set};
+    vkCmdBindDescriptorSets(buffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
+                            pipeline_layout, 0, 2, sets, 1,
+                            &frame_uniform_offset);
+    VkBuffer vertex_buffers[] = {vertex_buffer, scene.visible_tile_buffer};
+    VkDeviceSize offsets[] = {0, current_frame * scene.visible_tile_stride};
+    vkCmdBindVertexBuffers(buffer, 0, 2, vertex_buffers, offsets);
+    vkCmdBindIndexBuffer(buffer, index_buffer, 0, index_type);
+    for (uint32_t lod = 0; lod < TILE_LOD_COUNT; lod++) {
+      TileDrawPushConstants push_constants{lod};
+      vkCmdPushConstants(buffer, pipeline_layout, VK_SHADER_STAGE_VERTEX_BIT,
+                         0, sizeof(push_constants), &push_constants);
+      vkCmdDrawIndexedIndirect(buffer, scene.indirect_buffer,
+                               current_frame * scene.indirect_stride +
+                                   (lod * workers.size() + worker) *
+                                       sizeof(VkDrawIndexedIndirectCommand),
+                               1, sizeof(VkDrawIndexedIndirectCommand));
+    }
+    profiler.end_gpu_scope(buffer, current_frame, GPU_SCOPE_SLICE + worker);
+    if (vkEndCommandBuffer(buffer) != VK_SUCCESS) {
+      throw std::runtime_error("failed to record command buffer");
+    }
+    secondary_buffers[worker] = buffer;
+  }
+
+  // Host writes to the batch's ring are visible to the submission that
+  // follows them, the ring needs no barrier.
+  void record_sprite_batch(uint32_t current_frame, uint32_t image_index) {
+    VkCommandBuffer buffer =
+        begin_secondary(sprite_contexts[current_frame], image_index);
+    VkDescriptorSet sets[] = {frame_descriptor_set, texture_descriptor_set};
+    vkCmdBindDescriptorSets(buffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
+                            sprite_pipeline_layout, 0, 2, sets, 1,
+                            &frame_uniform_offset);
+    VkBuffer vertex_buffers[] = {sprite_batch.get_buffer()};
+    VkDeviceSize offsets[] = {sprite_batch.vertex_offset()};
+    vkCmdBindVertexBuffers(buffer, 0, 1, vertex_buffers, offsets);
+    vkCmdBindIndexBuffer(buffer, sprite_batch.get_buffer(),
+                         sprite_batch.index_offset(), VK_INDEX_TYPE_UINT16);
+    SpritePushConstants push_constants{};
+    push_constants.screen_scale =
+        glm::vec2(2.0f / swap_chain_extent.width,
+                  2.0f / swap_chain_extent.height);
+    PipelineHandle bound = nullptr;
+    for (const auto &draw : sprite_batch.draws()) {
+      if (draw.pipeline != bound) {
+        vkCmdBindPipeline(buffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
+                          pipelines.get(draw.pipeline));
+        bound = draw.pipeline;
+      }
+      push_constants.space = draw.space;
+      vkCmdPushConstants(buffer, sprite_pipeline_layout,
+                         VK_SHADER_STAGE_VERTEX_BIT, 0,
+                         sizeof(push_constants), &push_constants);
+      vkCmdDrawIndexed(buffer, draw.index_count, 1, draw.first_index, 0, 0);
+    }
+    if (vkEndCommandBuffer(buffer) != VK_SUCCESS) {
+      throw std::runtime_error("failed to record command buffer");
+    }
+    sprite_secondary = buffer;
+  }
+
+  // Begins the secondary command buffer of context for drawing into the
+  // swap chain image, with viewport and scissor set.
+  VkCommandBuffer begin_secondary(RecordContext &context,
+                                  uint32_t image_index) {
+    vkResetCommandPool(device, context.command_pool, 0);
+    VkCommandBufferInheritanceRenderingInfoKHR rendering_info{};
+    rendering_info.sType =
+        VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_RENDERING_INFO_KHR;
+    rendering_info.colorAttachmentCount = 1;
+    rendering_info.pColorAttachmentFormats = &swap_chain_image_format;
+    rendering_info.depthAttachmentFormat = depth_format;
+    rendering_info.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
+    VkCommandBufferInheritanceInfo inheritance_info{};
+    inheritance_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+    if (profiler.fragment_statistics_enabled()) {
+      inheritance_info.pipelineStatistics =
+          VK_QUERY_PIPELINE_STATISTIC_FRAGMENT_SHADER_INVOCATIONS_BIT;
+    }
+    if (dynamic_rendering_enabled) {
+      inheritance_info.pNext = &rendering_info;
+    } else {
+      inheritance_info.renderPass = render_pass;
+      inheritance_info.subpass = 0;
+      inheritance_info.framebuffer = swap_chain_framebuffers[image_index];
+    }
     VkCommandBufferBeginInfo begin_info{};
     begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-    begin_info.flags = 0;
-    begin_info.pInheritanceInfo = nullptr;
+    begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT |
+                       VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT;
+    begin_info.pInheritanceInfo = &inheritance_info;
+    VkCommandBuffer buffer = context.command_buffer;
     if (vkBeginCommandBuffer(buffer, &begin_info) != VK_SUCCESS) {
       throw std::runtime_error("failed to begin recording command buffer");
     }
+    // Secondary command buffers inherit no dynamic state.
+    VkViewport viewport{};
+    viewport.width = (float)swap_chain_extent.width;
+    viewport.height = (float)swap_chain_extent.height;
+    viewport.maxDepth = 1.0f;
+    vkCmdSetViewport(buffer, 0, 1, &viewport);
+    VkRect2D scissor{{0, 0}, swap_chain_extent};
+    vkCmdSetScissor(buffer, 0, 1, &scissor);
+    return buffer;
+  }
+
+  // Culling goes to the compute queue and drawing to graphics, the frame
+  // graph derives the wait and the ownership transfers between the two,
+  // and with dynamic rendering the attachment barriers too. A render pass
+  // transitions its attachments itself, the drawing pass declares none and
+  // is kept as a side effect. Secondary command buffers are recorded right
+  // away, the primaries once the graph executes.
+  void build_frame_graph(uint32_t image_index, uint32_t current_frame) {
+    FrameArena &arena = frame_arenas[current_frame];
+    bool draw_tiles = tiles_ready();
+    frame_graph.reset(arena);
+    frame_graph.setup(TIMELINE_GRAPHICS).command_buffer =
+        command_buffers[current_frame];
+    frame_graph.setup(TIMELINE_COMPUTE).command_buffer =
+        compute_command_buffers[current_frame];
+    frame_graph.set_prologue([this, current_frame](VkCommandBuffer buffer) {
+      profiler.reset_queries(buffer, current_frame);
+    });
+    // Lives in the arena so the record function of the drawing pass stays
+    // small enough for std::function to keep it inline.
+    DrawPassParams *params = arena.create<DrawPassParams>();
+    params->image_index = image_index;
+    params->current_frame = current_frame;
+    params->draw_tiles = draw_tiles;
+    update_frame_uniforms(current_frame);
+    sprite_batch.begin_frame(current_frame, arena);
+    push_overlays();
+    sprite_batch.sort_back_to_front(
+        arena, [this](glm::vec2 position) { return camera.depth(position); });
+    // The sprite pipeline shares the texture set, which arrives with the
+    // tile textures.
+    params->draw_sprites = tile_textures_ready && !sprite_batch.empty();
+    uint32_t visible_tiles = 0;
+    uint32_t commands = 0;
+    if (draw_tiles) {
+      prepare_visible_chunks(current_frame);
+      visible_tiles = frame_graph.import_buffer(
+          {scene.visible_tile_buffer,
+           current_frame * scene.visible_tile_stride,
+           scene.visible_tile_stride, false});
+      commands = frame_graph.import_buffer(
+          {scene.indirect_buffer, current_frame * scene.indirect_stride,
+           scene.indirect_stride, false});
+      FrameGraphPass &cull_pass =
+          frame_graph.add_pass("tile cull", TIMELINE_COMPUTE);
+      cull_pass.writes = {
+          {visible_tiles, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,
+           VK_ACCESS_2_SHADER_WRITE_BIT},
+          {commands,
+           VK_PIPELINE_STAGE_2_TRANSFER_BIT |
+               VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,
+           VK_ACCESS_2_TRANSFER_WRITE_BIT | VK_ACCESS_2_SHADER_WRITE_BIT}};
+      cull_pass.record = [this, current_frame](VkCommandBuffer buffer) {
+        profiler.begin_gpu_scope(buffer, current_frame,
+                                 GPU_SCOPE_TILE_COMPUTE);
+        record_tile_pass(buffer, current_frame);
+        profiler.end_gpu_scope(buffer, current_frame, GPU_SCOPE_TILE_COMPUTE);
+      };
+    }
+    FrameGraphPass &draw_pass =
+        frame_graph.add_pass("tiles", TIMELINE_GRAPHICS);
+    draw_pass.side_effects = !dynamic_rendering_enabled;
+    if (dynamic_rendering_enabled) {
+      FrameGraphImage target{};
+      target.image = swap_chain_images[image_index];
+      target.view = swap_chain_image_views[image_index];
+      // Waits for the acquire there, offscreen targets for the frame that
+      // last drew them.
+      target.initial_stage = VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT;
+      target.initial_access =
+          options.headless ? VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT : 0;
+      target.output = true;
+      // Offscreen targets stay attachments, like the render pass's
+      // finalLayout.
+      target.final_layout = options.headless
+                                ? VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL
+                                : VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+      uint32_t color = frame_graph.import_image(target);
+      FrameGraphTransientImage depth_desc{};
+      depth_desc.format = depth_format;
+      depth_desc.extent = swap_chain_extent;
+      depth_desc.usage = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT;
+      depth_desc.aspect = VK_IMAGE_ASPECT_DEPTH_BIT;
+      params->depth = frame_graph.create_image(depth_desc);
+      draw_pass.image_writes = {
+          {color, VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT,
+           VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT,
+           VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL},
+          {params->depth,
+           VK_PIPELINE_STAGE_2_EARLY_FRAGMENT_TESTS_BIT |
+               VK_PIPELINE_STAGE_2_LATE_FRAGMENT_TESTS_BIT,
+           VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_READ_BIT |
+               VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
+           VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL}};
+    }
+    draw_pass.record = [this, params](VkCommandBuffer buffer) {
+      record_render_pass(buffer, *params);
+    };
+    if (draw_tiles) {
+      draw_pass.reads = {{visible_tiles, VK_PIPELINE_STAGE_2_VERTEX_INPUT_BIT,
+                          VK_ACCESS_2_VERTEX_ATTRIBUTE_READ_BIT},
+                         {commands, VK_PIPELINE_STAGE_2_DRAW_INDIRECT_BIT,
+                          VK_ACCESS_2_INDIRECT_COMMAND_READ_BIT}};
+      workers.run([this, current_frame, image_index](uint32_t worker) {
+        record_tile_slice(worker, current_frame, image_index);
+      });
+    }
+    if (params->draw_sprites) {
+      record_sprite_batch(current_frame, image_index);
+    }
+  }
+
+  // Tiles draw first, the sprite batch over them.
+  void record_render_pass(VkCommandBuffer buffer,
+                          const DrawPassParams &params) {
+    uint32_t current_frame = params.current_frame;
+    bool draw_tiles = params.draw_tiles;
+    bool secondary = draw_tiles || params.draw_sprites;
+    profiler.begin_gpu_scope(buffer, current_frame, GPU_SCOPE_RENDER_PASS);
+    if (draw_tiles) {
+      profiler.begin_fragment_statistics(buffer, current_frame);
+    }
+    if (dynamic_rendering_enabled) {
+      begin_dynamic_rendering(buffer, params.image_index,
+                              frame_graph.image_view(params.depth), secondary);
+    } else {
+      begin_render_pass(buffer, params.image_index, secondary);
+    }
+    if (draw_tiles) {
+      vkCmdExecuteCommands(buffer,
+                           static_cast<uint32_t>(secondary_buffers.size()),
+                           secondary_buffers.data());
+    }
+    if (params.draw_sprites) {
+      vkCmdExecuteCommands(buffer, 1, &sprite_secondary);
+    }
+    if (dynamic_rendering_enabled) {
+      end_rendering(buffer);
+    } else {
+      vkCmdEndRenderPass(buffer);
+    }
+    if (draw_tiles) {
+      profiler.end_fragment_statistics(
+          buffer, current_frame,
+          swap_chain_extent.width * swap_chain_extent.height);
+    }
+    profiler.end_gpu_scope(buffer, current_frame, GPU_SCOPE_RENDER_PASS);
+  }
+
+  void begin_render_pass(VkCommandBuffer buffer, uint32_t image_index,
+                         bool secondary) {
     VkRenderPassBeginInfo render_pass_info{};
     render_pass_info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
     render_pass_info.renderPass = render_pass;
     render_pass_info.framebuffer = swap_chain_framebuffers[image_index];
     render_pass_info.renderArea.offset = {0, 0};
     render_pass_info.renderArea.extent = swap_chain_extent;
-    VkClearValue clear_color = {{{0.0f, 0.0f, 0.0f, 1.0f}}};
-    render_pass_info.clearValueCount = 1;
-    render_pass_info.pClearValues = &clear_color;
+    VkClearValue clear_values[2]{};
+    clear_values[0].color = {{0.0f, 0.0f, 0.0f, 1.0f}};
+    clear_values[1].depthStencil = {1.0f, 0};
+    render_pass_info.clearValueCount = 2;
+    render_pass_info.pClearValues = clear_values;
+    vkCmdBeginRenderPass(buffer, &render_pass_info,
+                         secondary
+                             ? VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS
+                             : VK_SUBPASS_CONTENTS_INLINE);
+  }
 
-    vkCmdBeginRenderPass(buffer, &render_pass_info, VK_SUBPASS_CONTENTS_INLINE);
-    vkCmdBindPipeline(buffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
-                      graphics_pipeline);
-    VkBuffer vertex_buffers[] = {vertex_buffer};
-    VkDeviceSize offsets[] = {0};
-    vkCmdBindVertexBuffers(buffer, 0, 1, vertex_buffers, offsets);
-    vkCmdBindIndexBuffer(buffer, index_buffer, 0, VK_INDEX_TYPE_UINT16);
-    vkCmdDrawIndexed(buffer, static_cast<uint32_t>(indices.size()), 1, 0, 0, 0);
-    vkCmdEndRenderPass(buffer);
-    if (vkEndCommandBuffer(buffer) != VK_SUCCESS) {
-      throw std::runtime_error("failed to record command buffer");
-    }
+  // The frame graph put the attachments into their layouts, as declared by
+  // the drawing pass in build_frame_graph().
+  void begin_dynamic_rendering(VkCommandBuffer buffer, uint32_t image_index,
+                               VkImageView depth_view, bool secondary) {
+    VkRenderingAttachmentInfoKHR color_attachment{};
+    color_attachment.sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO_KHR;
+    color_attachment.imageView = swap_chain_image_views[image_index];
+    color_attachment.imageLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+    color_attachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+    color_attachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+    color_attachment.clearValue = {{{0.0f, 0.0f, 0.0f, 1.0f}}};
+    VkRenderingAttachmentInfoKHR depth_attachment{};
+    depth_attachment.sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO_KHR;
+    depth_attachment.imageView = depth_view;
+    depth_attachment.imageLayout =
+        VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+    depth_attachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+    depth_attachment.storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+    depth_attachment.clearValue.depthStencil = {1.0f, 0};
+    VkRenderingInfoKHR rendering_info{};
+    rendering_info.sType = VK_STRUCTURE_TYPE_RENDERING_INFO_KHR;
+    rendering_info.flags =
+        secondary ? VK_RENDERING_CONTENTS_SECONDARY_COMMAND_BUFFERS_BIT_KHR : 0;
+    rendering_info.renderArea.offset = {0, 0};
+    rendering_info.renderArea.extent = swap_chain_extent;
+    rendering_info.layerCount = 1;
+    rendering_info.colorAttachmentCount = 1;
+    rendering_info.pColorAttachments = &color_attachment;
+    rendering_info.pDepthAttachment = &depth_attachment;
+    begin_rendering(buffer, &rendering_info);
   }
 
   bool is_device_suitable(VkPhysicalDevice device) {
@@ -709,8 +2671,11 @@ private:
     // vkGetPhysicalDeviceProperties(device, &device_properties);
     // vkGetPhysicalDeviceFeatures(device, &device_features);
     queue_indices = find_queue_families(device);
+    if (!supports_required_features(device)) {
+      return false;
+    }
     bool extensions_support = check_device_extension_support(device);
-    if (extensions_support) {
+    if (extensions_support && !options.headless) {
       SwapChainSupportDetails swap_chain_support =
           query_swap_chain_support(device);
       if (swap_chain_support.formats.empty() ||
@@ -721,6 +2686,32 @@ private:
     return queue_indices.is_complete() && extensions_support;
   }
 
+  // Timeline semaphores and the descriptor indexing subset the bindless
+  // textures need.
+  bool supports_required_features(VkPhysicalDevice device) {
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(device, &properties);
+    if (properties.apiVersion < VK_API_VERSION_1_2) {
+      return false;
+    }
+    VkPhysicalDeviceDescriptorIndexingFeatures indexing_features{};
+    indexing_features.sType =
+        VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES;
+    VkPhysicalDeviceTimelineSemaphoreFeatures timeline_features{};
+    timeline_features.sType =
+        VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES;
+    timeline_features.pNext = &indexing_features;
+    VkPhysicalDeviceFeatures2 features{};
+    features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+    features.pNext = &timeline_features;
+    vkGetPhysicalDeviceFeatures2(device, &features);
+    return timeline_features.timelineSemaphore &&
+           indexing_features.runtimeDescriptorArray &&
+           indexing_features.shaderSampledImageArrayNonUniformIndexing &&
+           indexing_features.descriptorBindingPartiallyBound &&
+           indexing_features.descriptorBindingSampledImageUpdateAfterBind;
+  }
+
   bool check_device_extension_support(VkPhysicalDevice device) {
     uint32_t extension_count;
     vkEnumerateDeviceExtensionProperties(device, nullptr, &extension_count,
@@ -728,14 +2719,23 @@ private:
     std::vector<VkExtensionProperties> available_extensions(extension_count);
     vkEnumerateDeviceExtensionProperties(device, nullptr, &extension_count,
                                          available_extensions.data());
-    std::set<std::string> required_extensions(device_extensions.begin(),
-                                              device_extensions.end());
+    std::vector<const char *> extensions = required_device_extensions();
+    std::set<std::string> required_extensions(extensions.begin(),
+                                              extensions.end());
     for (const auto &extension : available_extensions) {
       required_extensions.erase(extension.extensionName);
     }
     return required_extensions.empty();
   }
 
+  // Nothing is presented in headless mode, so no swap chain either.
+  std::vector<const char *> required_device_extensions() {
+    if (options.headless) {
+      return {};
+    }
+    return device_extensions;
+  }
+
   VkSurfaceFormatKHR choose_swap_surface_format(
       const std::vector<VkSurfaceFormatKHR> &available_formats) {
     for (const auto &available_format : available_formats) {
@@ -750,9 +2750,11 @@ private:
 
   VkPresentModeKHR choose_swap_present_mode(
       const std::vector<VkPresentModeKHR> &available_present_modes) {
-    for (const auto &available_present_mode : available_present_modes) {
-      if (available_present_mode == VK_PRESENT_MODE_MAILBOX_KHR) {
-        return available_present_mode;
+    for (auto present_mode : latency.present_modes) {
+      for (const auto &available_present_mode : available_present_modes) {
+        if (available_present_mode == present_mode) {
+          return available_present_mode;
+        }
       }
     }
     return VK_PRESENT_MODE_FIFO_KHR;
@@ -763,11 +2765,8 @@ private:
         std::numeric_limits<uint32_t>::max()) {
       return capabilities.currentExtent;
     } else {
-      int width, height;
-      glfwGetFramebufferSize(window, &width, &height);
-
-      VkExtent2D actual_extent = {static_cast<uint32_t>(width),
-                                  static_cast<uint32_t>(height)};
+      VkExtent2D actual_extent = {static_cast<uint32_t>(framebuffer_width),
+                                  static_cast<uint32_t>(framebuffer_height)};
 
       actual_extent.width =
           std::clamp(actual_extent.width, capabilities.minImageExtent.width,
@@ -781,26 +2780,55 @@ private:
   }
 
   QueueFamilyIndices find_queue_families(VkPhysicalDevice device) {
+    queue_indices = QueueFamilyIndices{};
     uint32_t count = 0;
     vkGetPhysicalDeviceQueueFamilyProperties(device, &count, nullptr);
     std::vector<VkQueueFamilyProperties> families(count);
     vkGetPhysicalDeviceQueueFamilyProperties(device, &count, families.data());
     int i = 0;
     for (const auto &queue_family : families) {
-      VkBool32 present_support = false;
-      vkGetPhysicalDeviceSurfaceSupportKHR(device, i, surface,
-                                           &present_support);
-      if (present_support) {
-        queue_indices.present_family = i;
+      if (!queue_indices.is_complete()) {
+        VkBool32 present_support = false;
+        if (options.headless) {
+          // Keeps the present family on the graphics queue.
+          present_support =
+              (queue_family.queueFlags & VK_QUEUE_GRAPHICS_BIT) != 0;
+        } else {
+          vkGetPhysicalDeviceSurfaceSupportKHR(device, i, surface,
+                                               &present_support);
+        }
+        if (present_support) {
+          queue_indices.present_family = i;
+        }
+        if (queue_family.queueFlags & VK_QUEUE_GRAPHICS_BIT) {
+          queue_indices.graphics_family = i;
+        }
       }
-      if (queue_family.queueFlags & VK_QUEUE_GRAPHICS_BIT) {
-        queue_indices.graphics_family = i;
+      // A transfer only family maps to the copy engines, which run
+      // alongside graphics work.
+      if ((queue_family.queueFlags & VK_QUEUE_TRANSFER_BIT) &&
+          !(queue_family.queueFlags &
+            (VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT)) &&
+          !queue_indices.transfer_family.has_value()) {
+        queue_indices.transfer_family = i;
       }
-      if (queue_indices.is_complete()) {
-        break;
+      // A compute only family runs the culling of the next frame while
+      // graphics still draws the current one. The profiler times the pass,
+      // so the family needs timestamps.
+      if ((queue_family.queueFlags & VK_QUEUE_COMPUTE_BIT) &&
+          !(queue_family.queueFlags & VK_QUEUE_GRAPHICS_BIT) &&
+          queue_family.timestampValidBits > 0 && options.async_compute &&
+          !queue_indices.compute_family.has_value()) {
+        queue_indices.compute_family = i;
       }
       i++;
     }
+    if (!queue_indices.transfer_family.has_value()) {
+      queue_indices.transfer_family = queue_indices.graphics_family;
+    }
+    if (!queue_indices.compute_family.has_value()) {
+      queue_indices.compute_family = queue_indices.graphics_family;
+    }
     return queue_indices;
   }
 
@@ -847,50 +2875,509 @@ private:
     return true;
   }
 
+  // GLFW wants its events handled on the main thread, so input stays here.
+  // Simulation ticks and frames each run on a thread of their own, frames
+  // draw the snapshots the ticks publish, neither waits for the other.
   void main_loop() {
+    simulation.start(SIMULATION_TICK, SIMULATION_MAX_CATCH_UP,
+                     [this](double time) { simulate_tick(time); });
+    rendering = true;
+    render_thread = std::thread(&HelloTriangleApplication::render_main, this);
+    while (!glfwWindowShouldClose(window) && rendering &&
+           !simulation.failed()) {
+      glfwWaitEventsTimeout(INPUT_POLL_INTERVAL);
+      sample_input();
+    }
+    rendering = false;
+    render_thread.join();
+    simulation.stop();
+    if (render_error) {
+      std::rethrow_exception(render_error);
+    }
+    // Scene loads may still be submitting uploads.
+    timeline.wait_device_idle();
+    profiler.flush();
+    profiler.report(std::cout);
+    if (const char *trace_file = std::getenv(PROFILER_TRACE_ENV)) {
+      profiler.export_chrome_trace(trace_file);
+    }
+  }
+
+  // Owns the device from main_loop() on, everything the headers call
+  // render thread only happens here.
+  void render_main() {
     uint32_t current_frame = 0;
-    while (!glfwWindowShouldClose(window)) {
-      glfwPollEvents();
+    try {
+      while (rendering) {
+        jobs.dispatch_completions();
+        if (uint32_t toggles = feature_toggles.exchange(0)) {
+          set_tile_features(TilePermutation{tile_features.bits ^ toggles});
+        }
+        if (options.hot_reload) {
+          reload_shaders();
+        }
+        if (swap_chain_stale) {
+          recreate_swap_chain();
+        }
+        if (swap_chain_stale) {
+          // Nothing to draw into while minimized, loads keep completing.
+          std::this_thread::sleep_for(
+              std::chrono::duration<double>(MINIMIZED_WAIT_TIMEOUT));
+          continue;
+        }
+        interpolate_snapshot();
+        draw_frames(1, current_frame);
+      }
+    } catch (...) {
+      render_error = std::current_exception();
+      rendering = false;
+      glfwPostEmptyEvent();
+    }
+  }
+
+  // WASD pans the view, Q and E zoom out and in.
+  void sample_input() {
+    InputState &input = input_buffer.back();
+    input.pan = glm::vec2(0.0f, 0.0f);
+    if (glfwGetKey(window, GLFW_KEY_A) == GLFW_PRESS) {
+      input.pan.x -= 1.0f;
+    }
+    if (glfwGetKey(window, GLFW_KEY_D) == GLFW_PRESS) {
+      input.pan.x += 1.0f;
+    }
+    if (glfwGetKey(window, GLFW_KEY_W) == GLFW_PRESS) {
+      input.pan.y -= 1.0f;
+    }
+    if (glfwGetKey(window, GLFW_KEY_S) == GLFW_PRESS) {
+      input.pan.y += 1.0f;
+    }
+    input.zoom = 0.0f;
+    if (glfwGetKey(window, GLFW_KEY_Q) == GLFW_PRESS) {
+      input.zoom += 1.0f;
+    }
+    if (glfwGetKey(window, GLFW_KEY_E) == GLFW_PRESS) {
+      input.zoom -= 1.0f;
+    }
+    double cursor_x, cursor_y;
+    glfwGetCursorPos(window, &cursor_x, &cursor_y);
+    int width, height;
+    glfwGetWindowSize(window, &width, &height);
+    input.cursor = glm::vec2(-1.0f, -1.0f);
+    if (width > 0 && height > 0 && cursor_x >= 0.0 && cursor_y >= 0.0 &&
+        cursor_x < width && cursor_y < height) {
+      input.cursor = glm::vec2((float)(cursor_x / width),
+                               (float)(cursor_y / height));
+    }
+    input_buffer.publish();
+  }
+
+  static void step_world(WorldState &world, const InputState &input,
+                         float dt) {
+    Camera &camera = world.camera;
+    float step = camera.extent * CAMERA_PAN_SPEED * dt;
+    camera.center =
+        camera.center + glm::vec2(input.pan.x + input.pan.y,
+                                  input.pan.y - input.pan.x) *
+                            (0.5f * step);
+    if (input.zoom > 0.0f) {
+      camera.extent *= std::pow(CAMERA_ZOOM_SPEED, dt);
+    } else if (input.zoom < 0.0f) {
+      camera.extent =
+          std::max(camera.extent / std::pow(CAMERA_ZOOM_SPEED, dt),
+                   CAMERA_MIN_EXTENT);
+    }
+  }
+
+  // Simulation thread.
+  void simulate_tick(double time) {
+    WorldState previous = world;
+    {
+      std::lock_guard<std::mutex> lock(world_reset_mutex);
+      if (world_reset) {
+        // A reset jumps, there is nothing to interpolate from.
+        world = previous = *world_reset;
+        world_generation = world_reset_generation;
+        world_reset.reset();
+      }
+    }
+    const InputState &input = input_buffer.latest();
+    step_world(world, input, (float)SIMULATION_TICK);
+    WorldSnapshot &snapshot = world_buffer.back();
+    snapshot.previous = previous;
+    snapshot.current = world;
+    snapshot.time = time;
+    snapshot.generation = world_generation;
+    snapshot.cursor = input.cursor;
+    world_buffer.publish();
+  }
+
+  // Starts the simulation over from camera, which the render thread draws
+  // with until the first tick after the reset arrives.
+  void reset_world(const Camera &camera) {
+    this->camera = camera;
+    std::lock_guard<std::mutex> lock(world_reset_mutex);
+    world_reset = WorldState{camera};
+    world_reset_generation = ++render_generation;
+  }
+
+  // The world one tick behind the simulation, where it lies between the
+  // last two ticks.
+  void interpolate_snapshot() {
+    const WorldSnapshot &snapshot = world_buffer.latest();
+    if (!world_buffer.has_value() || snapshot.generation != render_generation) {
+      return;
+    }
+    float t = (float)std::clamp(
+        (SimulationThread::now() - snapshot.time) / SIMULATION_TICK, 0.0, 1.0);
+    camera = interpolate_world(snapshot.previous, snapshot.current, t).camera;
+    cursor = snapshot.cursor;
+  }
+
+  // Swaps in pipelines built from changed shader sources. Graphics
+  // pipelines recompile on the registry threads and keep drawing with the
+  // old code until they are done, the compute pipeline is small enough to
+  // rebuild right here. Replaced pipelines wait in the deletion queue for
+  // the frames still using them.
+  void reload_shaders() {
+    for (auto &update : shader_reloader.poll()) {
+      if (update.name != "tile_indirect.spv") {
+        pipelines.update_shader(update.name, std::move(update.code));
+        continue;
+      }
+      VkPipeline pipeline;
+      try {
+        pipeline = build_tile_compute_pipeline(
+            update.code.data(), update.code.size() * sizeof(uint32_t));
+      } catch (const std::exception &e) {
+        std::cerr << e.what() << std::endl;
+        continue;
+      }
+      retire_pipeline(tile_compute_pipeline);
+      tile_compute_pipeline = pipeline;
+    }
+    for (VkPipeline pipeline : pipelines.take_retired()) {
+      retire_pipeline(pipeline);
+    }
+  }
+
+  void retire_pipeline(VkPipeline pipeline) {
+    deletions.retire(
+        [this, pipeline] { vkDestroyPipeline(device, pipeline, nullptr); });
+  }
+
+  // Geometry regenerated every frame, into the sprite batch.
+  void push_overlays() {
+    if (!tile_scene_ready || cursor.x < 0.0f) {
+      return;
+    }
+    // The inverse of view_proj, see update_frame_uniforms().
+    IsoViewRect view = camera.view();
+    glm::vec2 clip(2.0f * cursor.x - 1.0f, 2.0f * cursor.y - 1.0f);
+    glm::vec2 iso =
+        clip * camera.extent + glm::vec2((view.min_x + view.max_x) * 0.5f,
+                                         (view.min_y + view.max_y) * 0.5f);
+    glm::vec2 tile(std::floor((iso.x + iso.y) * 0.5f),
+                   std::floor((iso.y - iso.x) * 0.5f));
+    if (tile.x < 0.0f || tile.y < 0.0f || tile.x >= scene.map_size ||
+        tile.y >= scene.map_size) {
+      return;
+    }
+    sprite_batch.push_quad(
+        sprite_pipeline, SPRITE_SPACE_WORLD, tile,
+        tile + glm::vec2(1.0f, 1.0f),
+        Unorm8x4::pack(glm::vec3(1.0f), CURSOR_HIGHLIGHT_ALPHA));
+  }
+
+  void draw_frames(uint32_t count, uint32_t &current_frame) {
+    for (uint32_t i = 0; i < count; i++) {
       draw_frame(current_frame);
-      current_frame = (current_frame + 1) % MAX_FRAMES_IN_FLIGHT;
+      profiler.collect();
+      current_frame = (current_frame + 1) % latency.frames_in_flight;
     }
+  }
+
+  // Renders every requested tile count for a fixed number of frames and
+  // prints one result line per scene.
+  void run_benchmark() {
+    uint32_t current_frame = 0;
+    for (size_t i = 0; i < options.tile_counts.size(); i++) {
+      uint32_t tile_count = options.tile_counts[i];
+      if (i > 0) {
+        jobs.wait(load_tile_scene(tile_count));
+      } else {
+        jobs.wait_idle();
+      }
+      draw_frames(BENCHMARK_WARMUP_FRAMES, current_frame);
+      vkDeviceWaitIdle(device);
+      profiler.flush();
+      profiler.reset();
+      auto start = std::chrono::steady_clock::now();
+      draw_frames(options.frame_count, current_frame);
+      vkDeviceWaitIdle(device);
+      double seconds = std::chrono::duration<double>(
+                           std::chrono::steady_clock::now() - start)
+                           .count();
+      profiler.flush();
+      ProfileSummary summary = profiler.summary();
+      std::cout << "tiles " << tile_count << ": " << options.frame_count
+                << " frames, " << options.frame_count / seconds
+                << " fps, cpu p50 " << summary.cpu_ms_p50 << " ms p99 "
+                << summary.cpu_ms_p99 << " ms, gpu p50 " << summary.gpu_ms_p50
+                << " ms p99 " << summary.gpu_ms_p99 << " ms, overdraw p50 "
+                << summary.overdraw_p50 << "x, heap allocations p99 "
+                << summary.heap_allocations_p99 << std::endl;
+    }
+  }
+
+  // Times the hot paths on their own with the first scene loaded and
+  // nothing in flight, then writes the results as JSON.
+  void run_micro_benchmarks() {
+    jobs.wait_idle();
     vkDeviceWaitIdle(device);
+    MicroBench bench;
+    bench_uploads(bench);
+    bench_recording(bench);
+    bench_pipelines(bench);
+    bench_culling(bench);
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(physical_device, &properties);
+    bench.write_json(options.bench_output,
+                     {{"executable", "isometric"},
+                      {"device", properties.deviceName},
+                      {"chunk_cull_isa", CHUNK_CULL_ISA}});
+  }
+
+  // Into a device local buffer, through the staging ring and the way
+  // uploads went before it, see upload_blocking().
+  void bench_uploads(MicroBench &bench) {
+    std::vector<char> data(MICRO_BENCH_UPLOAD_MAX);
+    for (VkDeviceSize size = MICRO_BENCH_UPLOAD_MIN;
+         size <= MICRO_BENCH_UPLOAD_MAX; size *= 4) {
+      VkBuffer buffer;
+      GpuAllocation allocation;
+      create_buffer(size, VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                    VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, buffer, allocation);
+      std::string suffix = "/" + std::to_string(size);
+      bench.run("upload/blocking" + suffix, (double)size, 0.0, [&] {
+        upload_blocking(buffer, data.data(), size);
+      });
+      bench.run("upload/staging_ring" + suffix, (double)size, 0.0, [&] {
+        uploader.upload(buffer, 0, data.data(), size);
+        uploader.wait(uploader.flush());
+      });
+      destroy_buffer(buffer, allocation);
+    }
+    // The staging buffers of the largest sizes got blocks of their own.
+    allocator.trim();
+  }
+
+  // A staging buffer of its own, a one time command buffer and a wait for
+  // the copy, what every upload paid before the staging ring.
+  void upload_blocking(VkBuffer dst, const void *data, VkDeviceSize size) {
+    VkBuffer staging_buffer;
+    GpuAllocation staging_allocation;
+    create_buffer(size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+                  VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                      VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                  staging_buffer, staging_allocation);
+    memcpy(staging_allocation.mapped, data, size);
+    VkCommandBufferAllocateInfo alloc_info{};
+    alloc_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    alloc_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    alloc_info.commandPool = command_pool;
+    alloc_info.commandBufferCount = 1;
+    VkCommandBuffer command_buffer;
+    if (vkAllocateCommandBuffers(device, &alloc_info, &command_buffer) !=
+        VK_SUCCESS) {
+      throw std::runtime_error("failed to allocate command buffers");
+    }
+    VkCommandBufferBeginInfo begin_info{};
+    begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    vkBeginCommandBuffer(command_buffer, &begin_info);
+    VkBufferCopy region{};
+    region.size = size;
+    vkCmdCopyBuffer(command_buffer, staging_buffer, dst, 1, &region);
+    vkEndCommandBuffer(command_buffer);
+    timeline.wait(timeline.submit(TIMELINE_GRAPHICS, command_buffer));
+    vkFreeCommandBuffers(device, command_pool, 1, &command_buffer);
+    destroy_buffer(staging_buffer, staging_allocation);
+  }
+
+  // Only the CPU side, the buffers are never submitted.
+  void bench_recording(MicroBench &bench) {
+    for (uint32_t draw_count : MICRO_BENCH_DRAW_COUNTS) {
+      std::string suffix = "/" + std::to_string(draw_count);
+      bench.run("record/single_thread" + suffix, 0.0, draw_count,
+                [&] { record_bench_draws(0, 0, draw_count); });
+      uint32_t slice = (draw_count + workers.size() - 1) / workers.size();
+      bench.run("record/threads:" + std::to_string(workers.size()) + suffix,
+                0.0, draw_count, [&] {
+                  workers.run([&](uint32_t worker) {
+                    uint32_t first = std::min(worker * slice, draw_count);
+                    record_bench_draws(worker, first,
+                                       std::min(slice, draw_count - first));
+                  });
+                });
+    }
+  }
+
+  // Tile draws with a push constant each into the context of worker for
+  // frame 0, which has nothing in flight.
+  void record_bench_draws(uint32_t worker, uint32_t first, uint32_t count) {
+    VkCommandBuffer buffer = begin_secondary(record_contexts[worker], 0);
+    vkCmdBindPipeline(buffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
+                      pipelines.get(tile_pipeline));
+    VkDescriptorSet sets[] = {frame_descriptor_set, texture_descriptor_set};
+    uint32_t uniform_offset = 0;
+    vkCmdBindDescriptorSets(buffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
+                            pipeline_layout, 0, 2, sets, 1, &uniform_offset);
+    VkBuffer vertex_buffers[] = {vertex_buffer, scene.visible_tile_buffer};
+    VkDeviceSize offsets[] = {0, 0};
+    vkCmdBindVertexBuffers(buffer, 0, 2, vertex_buffers, offsets);
+    vkCmdBindIndexBuffer(buffer, index_buffer, 0, index_type);
+    for (uint32_t i = first; i < first + count; i++) {
+      TileDrawPushConstants push_constants{i % TILE_LOD_COUNT};
+      vkCmdPushConstants(buffer, pipeline_layout, VK_SHADER_STAGE_VERTEX_BIT,
+                         0, sizeof(push_constants), &push_constants);
+      const TileLod &lod = tile_lods[push_constants.lod];
+      vkCmdDrawIndexed(buffer, lod.index_count, 1, lod.first_index, 0, 0);
+    }
+    if (vkEndCommandBuffer(buffer) != VK_SUCCESS) {
+      throw std::runtime_error("failed to record command buffer");
+    }
+  }
+
+  // A fresh registry per iteration, so every request compiles. The warm
+  // cache already holds the pipeline, as the one on disk does from the
+  // second start on. Drivers with a shader cache of their own narrow the
+  // gap.
+  void bench_pipelines(MicroBench &bench) {
+    auto compile = [this](VkPipelineCache cache) {
+      PipelineRegistry registry;
+      registry.init(device, cache, assets, 0);
+      registry.request_blocking(tile_pipeline_desc(TILE_DEFAULT_PERMUTATION));
+      registry.destroy();
+    };
+    VkPipelineCacheCreateInfo cache_info{};
+    cache_info.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+    VkPipelineCache warm_cache;
+    if (vkCreatePipelineCache(device, &cache_info, nullptr, &warm_cache) !=
+        VK_SUCCESS) {
+      throw std::runtime_error("failed to create pipeline cache");
+    }
+    compile(warm_cache);
+    bench.run("pipeline/no_cache", 0.0, 1.0, [&] { compile(VK_NULL_HANDLE); });
+    bench.run("pipeline/warm_cache", 0.0, 1.0, [&] { compile(warm_cache); });
+    vkDestroyPipelineCache(device, warm_cache, nullptr);
+  }
+
+  // Square grids of chunks with the view over their middle, about half of
+  // the chunks pass.
+  void bench_culling(MicroBench &bench) {
+    for (uint32_t grid : MICRO_BENCH_CHUNK_GRIDS) {
+      ChunkBounds bounds;
+      bounds.resize(grid * grid);
+      for (uint32_t y = 0; y < grid; y++) {
+        for (uint32_t x = 0; x < grid; x++) {
+          bounds.set(y * grid + x, (float)(x * CHUNK_SIZE),
+                     (float)(y * CHUNK_SIZE), (float)((x + 1) * CHUNK_SIZE),
+                     (float)((y + 1) * CHUNK_SIZE));
+        }
+      }
+      // The grid is a diamond in iso space, its center at (0, size).
+      float size = (float)(grid * CHUNK_SIZE);
+      IsoViewRect view{-size * 0.5f, size * 0.5f, size * 0.5f, size * 1.5f};
+      std::vector<uint32_t> visible;
+      visible.reserve(bounds.count);
+      std::string suffix = "/" + std::to_string(bounds.count);
+      bench.run("cull/scalar" + suffix, 0.0, bounds.count, [&] {
+        cull_chunks<cull_chunk_batch_scalar>(bounds, view, visible);
+      });
+      bench.run("cull/simd" + suffix, 0.0, bounds.count,
+                [&] { cull_chunks(bounds, view, visible); });
+    }
   }
 
   void draw_frame(uint32_t current_frame) {
-    vkWaitForFences(device, 1, &in_flight_fences[current_frame], VK_TRUE,
-                    UINT64_MAX);
-    uint32_t image_index;
-    VkResult result =
-        vkAcquireNextImageKHR(device, swap_chain, UINT64_MAX,
-                              image_available_semaphores[current_frame],
-                              VK_NULL_HANDLE, &image_index);
-    if (result == VK_ERROR_OUT_OF_DATE_KHR) {
-      recreate_swap_chain();
-      return;
-    } else if (result != VK_SUCCESS && result != VK_SUBOPTIMAL_KHR) {
-      throw std::runtime_error("failed to acquire swap chain image");
-    }
-    vkResetFences(device, 1, &in_flight_fences[current_frame]);
-    vkResetCommandBuffer(command_buffers[current_frame], 0);
-    record_command_buffer(command_buffers[current_frame], image_index);
-    VkSubmitInfo submit_info{};
-    submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-    VkSemaphore wait_semaphores[] = {image_available_semaphores[current_frame]};
-    VkPipelineStageFlags wait_stages[] = {
-        VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT};
-    submit_info.waitSemaphoreCount = 1;
-    submit_info.pWaitSemaphores = wait_semaphores;
-    submit_info.pWaitDstStageMask = wait_stages;
-    submit_info.commandBufferCount = 1;
-    submit_info.pCommandBuffers = &command_buffers[current_frame];
+    profiler.begin_frame();
+    profiler.begin_phase(PROFILE_WAIT_FRAME);
+    timeline.wait(frame_points[current_frame]);
+    profiler.end_phase(PROFILE_WAIT_FRAME);
+    // Everything the last use of this slot allocated is done with. With a
+    // single frame in flight that includes the frame graph and sprite draws
+    // of the frame before, which let go of the arena first.
+    frame_graph.release();
+    sprite_batch.release();
+    frame_arenas[current_frame].reset();
+    deletions.collect();
+    profiler.resolve(current_frame);
+    if (present_wait_enabled && present_id > 0) {
+      // Only start on a frame once the previous one reached the screen, so
+      // no frame ever queues behind another one.
+      ProfileScope scope(profiler, PROFILE_PRESENT_WAIT);
+      wait_for_present(device, swap_chain, present_id, PRESENT_WAIT_TIMEOUT);
+    }
+    // Offscreen targets are owned by their frame in flight.
+    uint32_t image_index = current_frame;
+    if (!options.headless) {
+      profiler.begin_phase(PROFILE_ACQUIRE);
+      VkResult result =
+          vkAcquireNextImageKHR(device, swap_chain, UINT64_MAX,
+                                image_available_semaphores[current_frame],
+                                VK_NULL_HANDLE, &image_index);
+      profiler.end_phase(PROFILE_ACQUIRE);
+      if (result == VK_ERROR_OUT_OF_DATE_KHR) {
+        profiler.end_frame(current_frame, false);
+        recreate_swap_chain();
+        return;
+      } else if (result != VK_SUCCESS && result != VK_SUBOPTIMAL_KHR) {
+        throw std::runtime_error("failed to acquire swap chain image");
+      }
+    }
+    {
+      ProfileScope scope(profiler, PROFILE_RECORD);
+      build_frame_graph(image_index, current_frame);
+    }
+    if (upload_point.value > 0) {
+      if (timeline.is_complete(upload_point)) {
+        upload_point = TimelinePoint{};
+      } else {
+        // Freshly uploaded buffers are consumed from the compute pass on.
+        frame_graph.setup(TIMELINE_COMPUTE)
+            .waits.push_back({upload_point,
+                              VK_PIPELINE_STAGE_TRANSFER_BIT |
+                                  VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT});
+        frame_graph.setup(TIMELINE_GRAPHICS)
+            .waits.push_back({upload_point,
+                              VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT |
+                                  VK_PIPELINE_STAGE_VERTEX_INPUT_BIT});
+      }
+    }
     VkSemaphore signal_semaphores[] = {
         render_finished_semaphores[current_frame]};
-    submit_info.signalSemaphoreCount = 1;
-    submit_info.pSignalSemaphores = signal_semaphores;
-    if (vkQueueSubmit(graphics_queue, 1, &submit_info,
-                      in_flight_fences[current_frame]) != VK_SUCCESS) {
-      throw std::runtime_error("failed to submit draw command buffer");
+    if (!options.headless) {
+      FrameGraphQueueSetup &graphics = frame_graph.setup(TIMELINE_GRAPHICS);
+      graphics.binary_wait = image_available_semaphores[current_frame];
+      graphics.binary_wait_stage =
+          VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+      graphics.binary_signal = signal_semaphores[0];
+    }
+    profiler.begin_phase(PROFILE_SUBMIT);
+    // Also records the primary command buffers.
+    frame_points[current_frame] =
+        frame_graph.execute()[TIMELINE_GRAPHICS];
+    profiler.end_phase(PROFILE_SUBMIT);
+    if (enable_validation_layers && frame_graph.transients_changed()) {
+      frame_graph.print_transient_stats(std::cout);
+    }
+    if (enable_validation_layers && sprite_batch.dropped_quads() > 0) {
+      std::cerr << "sprite batch full, dropped "
+                << sprite_batch.dropped_quads() << " quads" << std::endl;
+    }
+    if (options.headless) {
+      profiler.end_frame(current_frame, true);
+      return;
     }
     VkPresentInfoKHR present_info{};
     present_info.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
@@ -901,16 +3388,52 @@ private:
     present_info.pSwapchains = swap_chains;
     present_info.pImageIndices = &image_index;
     present_info.pResults = nullptr;
-    result = vkQueuePresentKHR(present_queue, &present_info);
+    VkPresentIdKHR present_id_info{};
+    present_id_info.sType = VK_STRUCTURE_TYPE_PRESENT_ID_KHR;
+    present_id_info.swapchainCount = 1;
+    uint64_t next_present_id = present_id + 1;
+    present_id_info.pPresentIds = &next_present_id;
+    if (present_wait_enabled) {
+      present_info.pNext = &present_id_info;
+    }
+    profiler.begin_phase(PROFILE_PRESENT);
+    VkResult result = timeline.present(present_queue, present_info);
+    profiler.end_phase(PROFILE_PRESENT);
+    profiler.end_frame(current_frame, true);
+    if (result == VK_SUCCESS || result == VK_SUBOPTIMAL_KHR) {
+      present_id = next_present_id;
+    }
+    bool resized = frame_buffer_resized.exchange(false);
     if (result == VK_ERROR_OUT_OF_DATE_KHR || result == VK_SUBOPTIMAL_KHR ||
-        frame_buffer_resized) {
-      frame_buffer_resized = false;
+        resized) {
       recreate_swap_chain();
     } else if (result != VK_SUCCESS) {
       throw std::runtime_error("failed to present swap chain image");
     }
   }
 
+  void retire_swap_chain() {
+    deletions.retire([this, swap_chain = swap_chain,
+                      framebuffers = std::move(swap_chain_framebuffers),
+                      image_views = std::move(swap_chain_image_views),
+                      depth_image = depth_image,
+                      depth_image_view = depth_image_view,
+                      depth_allocation = depth_allocation]() mutable {
+      for (auto framebuffer : framebuffers) {
+        vkDestroyFramebuffer(device, framebuffer, nullptr);
+      }
+      for (auto image_view : image_views) {
+        vkDestroyImageView(device, image_view, nullptr);
+      }
+      vkDestroyImageView(device, depth_image_view, nullptr);
+      vkDestroyImage(device, depth_image, nullptr);
+      allocator.free(depth_allocation);
+      vkDestroySwapchainKHR(device, swap_chain, nullptr);
+    });
+    swap_chain_framebuffers.clear();
+    swap_chain_image_views.clear();
+  }
+
   void cleanup_swapchain() {
     for (auto framebuffer : swap_chain_framebuffers) {
       vkDestroyFramebuffer(device, framebuffer, nullptr);
@@ -918,64 +3441,293 @@ private:
     for (auto image_view : swap_chain_image_views) {
       vkDestroyImageView(device, image_view, nullptr);
     }
-    vkDestroySwapchainKHR(device, swap_chain, nullptr);
+    destroy_depth_resources();
+    if (options.headless) {
+      for (size_t i = 0; i < swap_chain_images.size(); i++) {
+        vkDestroyImage(device, swap_chain_images[i], nullptr);
+        allocator.free(offscreen_allocations[i]);
+      }
+    } else {
+      vkDestroySwapchainKHR(device, swap_chain, nullptr);
+    }
   }
 
   void cleanup() {
+    // Loads still in flight install their results, so they are freed below.
+    jobs.wait_idle();
+    jobs.destroy();
     cleanup_swapchain();
-    vkDestroyBuffer(device, vertex_buffer, nullptr);
-    vkFreeMemory(device, vertex_buffer_memory, nullptr);
-    vkDestroyBuffer(device, index_buffer, nullptr);
-    vkFreeMemory(device, index_buffer_memory, nullptr);
-    for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+    shader_reloader.destroy();
+    deletions.flush();
+    frame_graph.destroy();
+    for (auto &arena : frame_arenas) {
+      arena.destroy();
+    }
+    uploader.destroy();
+    destroy_buffer(staging_ring_buffer, staging_ring_allocation);
+    destroy_buffer(frame_uniform_buffer, frame_uniform_allocation);
+    destroy_buffer(sprite_batch_buffer, sprite_batch_allocation);
+    destroy_buffer(vertex_buffer, vertex_buffer_allocation);
+    destroy_buffer(index_buffer, index_buffer_allocation);
+    if (asset_buffer != VK_NULL_HANDLE) {
+      vkDestroyBuffer(device, asset_buffer, nullptr);
+      vkFreeMemory(device, asset_memory, nullptr);
+    }
+    destroy_tile_scene(scene);
+    destroy_tile_textures();
+    vkDestroyDescriptorPool(device, descriptor_pool, nullptr);
+    vkDestroyDescriptorPool(device, texture_descriptor_pool, nullptr);
+    vkDestroyDescriptorSetLayout(device, tile_set_layout, nullptr);
+    vkDestroyDescriptorSetLayout(device, frame_set_layout, nullptr);
+    vkDestroyDescriptorSetLayout(device, texture_set_layout, nullptr);
+    for (size_t i = 0; i < latency.frames_in_flight; i++) {
       vkDestroySemaphore(device, image_available_semaphores[i], nullptr);
       vkDestroySemaphore(device, render_finished_semaphores[i], nullptr);
-      vkDestroyFence(device, in_flight_fences[i], nullptr);
     }
     vkDestroyCommandPool(device, command_pool, nullptr);
-    vkDestroyPipeline(device, graphics_pipeline, nullptr);
+    vkDestroyCommandPool(device, compute_command_pool, nullptr);
+    for (auto &context : record_contexts) {
+      vkDestroyCommandPool(device, context.command_pool, nullptr);
+    }
+    for (auto &context : sprite_contexts) {
+      vkDestroyCommandPool(device, context.command_pool, nullptr);
+    }
+    workers.destroy();
+    profiler.destroy();
+    pipelines.destroy();
+    assets.close();
+    save_pipeline_cache(device, pipeline_cache, PIPELINE_CACHE_FILE);
+    vkDestroyPipelineCache(device, pipeline_cache, nullptr);
     vkDestroyPipelineLayout(device, pipeline_layout, nullptr);
+    vkDestroyPipelineLayout(device, sprite_pipeline_layout, nullptr);
+    vkDestroyPipeline(device, tile_compute_pipeline, nullptr);
+    vkDestroyPipelineLayout(device, compute_pipeline_layout, nullptr);
     vkDestroyRenderPass(device, render_pass, nullptr);
+    allocator.destroy();
+    timeline.destroy();
     vkDestroyDevice(device, nullptr);
-    vkDestroySurfaceKHR(instance, surface, nullptr);
+    if (!options.headless) {
+      vkDestroySurfaceKHR(instance, surface, nullptr);
+    }
     vkDestroyInstance(instance, nullptr);
-    glfwDestroyWindow(window);
-    glfwTerminate();
+    if (!options.headless) {
+      glfwDestroyWindow(window);
+      glfwTerminate();
+    }
   }
 
+  AppOptions options;
+  LatencyProfile latency;
+  bool present_wait_enabled = false;
+  bool external_memory_host_enabled = false;
+  bool dynamic_rendering_enabled = false;
+  // Pipeline statistics with inherited queries, for the overdraw report.
+  bool fragment_statistics_supported = false;
+  PFN_vkCmdBeginRenderingKHR begin_rendering = nullptr;
+  PFN_vkCmdEndRenderingKHR end_rendering = nullptr;
+  // Null without VK_KHR_synchronization2, the frame graph falls back to
+  // vkCmdPipelineBarrier.
+  PFN_vkCmdPipelineBarrier2 pipeline_barrier2 = nullptr;
+  PFN_vkWaitForPresentKHR wait_for_present = nullptr;
+  // Id of the last present, 0 before the first one of a swap chain.
+  uint64_t present_id = 0;
   GLFWwindow *window;
   QueueFamilyIndices queue_indices;
   VkInstance instance;
   VkSurfaceKHR surface;
   VkSwapchainKHR swap_chain;
   std::vector<VkImage> swap_chain_images;
+  // Memory of the offscreen targets standing in for swap_chain_images.
+  std::vector<GpuAllocation> offscreen_allocations;
   std::vector<VkImageView> swap_chain_image_views;
   VkFormat swap_chain_image_format;
   VkExtent2D swap_chain_extent;
+  // Matches swap_chain_extent, recreated with the swap chain.
+  VkFormat depth_format;
+  VkImage depth_image = VK_NULL_HANDLE;
+  VkImageView depth_image_view = VK_NULL_HANDLE;
+  GpuAllocation depth_allocation;
   VkDevice device;
   VkPhysicalDevice physical_device;
   VkQueue graphics_queue;
   VkQueue present_queue;
-  VkRenderPass render_pass;
+  VkQueue transfer_queue;
+  VkQueue compute_queue;
+  // VK_NULL_HANDLE with dynamic rendering.
+  VkRenderPass render_pass = VK_NULL_HANDLE;
   VkPipelineLayout pipeline_layout;
-  VkPipeline graphics_pipeline;
+  PipelineRegistry pipelines;
+  PipelineHandle tile_pipeline;
+  // Pipeline of tile_features, tile_pipeline for the default permutation.
+  PipelineHandle tile_variant;
+  TilePermutation tile_features;
+  VkPipelineLayout sprite_pipeline_layout;
+  PipelineHandle sprite_pipeline;
+  VkPipelineCache pipeline_cache;
+  VkDescriptorSetLayout tile_set_layout;
+  VkPipelineLayout compute_pipeline_layout;
+  VkPipeline tile_compute_pipeline;
+  VkDescriptorPool descriptor_pool;
+  VkDescriptorSetLayout frame_set_layout;
+  VkDescriptorSet frame_descriptor_set;
+  VkDescriptorSetLayout texture_set_layout;
+  VkDescriptorPool texture_descriptor_pool;
+  VkDescriptorSet texture_descriptor_set;
   std::vector<VkFramebuffer> swap_chain_framebuffers;
   VkCommandPool command_pool;
   std::vector<VkCommandBuffer> command_buffers;
+  VkCommandPool compute_command_pool;
+  std::vector<VkCommandBuffer> compute_command_buffers;
+  WorkerPool workers;
+  // Indexed by frame * workers.size() + worker.
+  std::vector<RecordContext> record_contexts;
+  std::vector<VkCommandBuffer> secondary_buffers;
+  // Per frame in flight, the sprite batch is recorded on the render thread.
+  std::vector<RecordContext> sprite_contexts;
+  VkCommandBuffer sprite_secondary = VK_NULL_HANDLE;
+  FrameProfiler profiler;
   std::vector<VkSemaphore> image_available_semaphores;
   std::vector<VkSemaphore> render_finished_semaphores;
-  std::vector<VkFence> in_flight_fences;
-  bool frame_buffer_resized;
+  TimelineScheduler timeline;
+  // Graphics submission of each frame in flight, it waits for the frame's
+  // compute work.
+  std::vector<TimelinePoint> frame_points;
+  FrameGraph frame_graph;
+  // Uploads the next frame has to wait for on the GPU.
+  TimelinePoint upload_point;
+  // Written by the GLFW callbacks on the main thread.
+  std::atomic<bool> frame_buffer_resized{false};
+  std::atomic<int> framebuffer_width{0};
+  std::atomic<int> framebuffer_height{0};
+  // TileFeature bits to flip before the next frame.
+  std::atomic<uint32_t> feature_toggles{0};
+  // Set while the window has no area to create a swap chain for.
+  bool swap_chain_stale = false;
+  // Swap chains, views and pipelines waiting for their last frames.
+  DeletionQueue deletions;
+  ShaderReloader shader_reloader;
+  GpuAllocator allocator;
   VkBuffer vertex_buffer;
-  VkDeviceMemory vertex_buffer_memory;
+  GpuAllocation vertex_buffer_allocation;
   VkBuffer index_buffer;
-  VkDeviceMemory index_buffer_memory;
+  GpuAllocation index_buffer_allocation;
+  VkIndexType index_type;
+  AssetArchive assets;
+  // The whole mapped archive as a transfer source, VK_NULL_HANDLE when the
+  // device could not import it.
+  VkBuffer asset_buffer = VK_NULL_HANDLE;
+  VkDeviceMemory asset_memory = VK_NULL_HANDLE;
+  TilePushConstants tile_push_constants;
+  FrameUniformRing frame_uniforms;
+  VkBuffer frame_uniform_buffer;
+  GpuAllocation frame_uniform_allocation;
+  SpriteBatch sprite_batch;
+  VkBuffer sprite_batch_buffer;
+  GpuAllocation sprite_batch_allocation;
+  // Dynamic offset of this frame's FrameUniforms block.
+  uint32_t frame_uniform_offset;
+  uint32_t frame_number = 0;
+  std::chrono::steady_clock::time_point start_time;
+  std::chrono::steady_clock::time_point last_frame_time;
+  // Camera of the frame being drawn, between the last two ticks.
+  Camera camera;
+  // Cursor of the frame being drawn, see InputState.
+  glm::vec2 cursor = glm::vec2(-1.0f, -1.0f);
+  SimulationThread simulation;
+  // From the main thread to the simulation.
+  TripleBuffer<InputState> input_buffer;
+  // From the simulation to the render thread.
+  TripleBuffer<WorldSnapshot> world_buffer;
+  // Simulation thread only.
+  WorldState world;
+  uint32_t world_generation = 0;
+  // A world the simulation starts over from at its next tick, with the
+  // generation its snapshots will carry.
+  std::mutex world_reset_mutex;
+  std::optional<WorldState> world_reset;
+  uint32_t world_reset_generation = 0;
+  // Render thread only, snapshots of older generations are ignored.
+  uint32_t render_generation = 0;
+  std::thread render_thread;
+  std::atomic<bool> rendering{false};
+  std::exception_ptr render_error;
+  std::vector<uint32_t> visible_chunks;
+  // Per frame in flight, reset once the frame's submissions completed.
+  std::vector<FrameArena> frame_arenas;
+  TileScene scene;
+  bool tile_scene_ready = false;
+  bool tile_textures_ready = false;
+  JobSystem jobs;
+  // Atlas pages, slot i of the bindless array.
+  std::vector<TexturePage> texture_pages;
+  VkBuffer sprite_buffer;
+  GpuAllocation sprite_buffer_allocation;
+  VkSampler texture_sampler;
+  StagingUploader uploader;
+  VkBuffer staging_ring_buffer;
+  GpuAllocation staging_ring_allocation;
 };
 
-int main() {
+// Counts for the profiler's heap allocations per frame, allocations of the
+// driver and of C libraries do not go through here.
+void *operator new(size_t size) {
+  heap_allocation_count.fetch_add(1, std::memory_order_relaxed);
+  if (void *memory = malloc(size ? size : 1)) {
+    return memory;
+  }
+  throw std::bad_alloc();
+}
+
+void *operator new[](size_t size) { return operator new(size); }
+
+void *operator new(size_t size, std::align_val_t alignment) {
+  heap_allocation_count.fetch_add(1, std::memory_order_relaxed);
+  size_t align = static_cast<size_t>(alignment);
+  // aligned_alloc wants a multiple of the alignment.
+  size = (std::max(size, (size_t)1) + align - 1) & ~(align - 1);
+  if (void *memory = aligned_alloc(align, size)) {
+    return memory;
+  }
+  throw std::bad_alloc();
+}
+
+void *operator new[](size_t size, std::align_val_t alignment) {
+  return operator new(size, alignment);
+}
+
+void operator delete(void *memory) noexcept { free(memory); }
+
+void operator delete[](void *memory) noexcept { free(memory); }
+
+void operator delete(void *memory, size_t) noexcept { free(memory); }
+
+void operator delete[](void *memory, size_t) noexcept { free(memory); }
+
+void operator delete(void *memory, std::align_val_t) noexcept {
+  free(memory);
+}
+
+void operator delete[](void *memory, std::align_val_t) noexcept {
+  free(memory);
+}
+
+void operator delete(void *memory, size_t, std::align_val_t) noexcept {
+  free(memory);
+}
+
+void operator delete[](void *memory, size_t, std::align_val_t) noexcept {
+  free(memory);
+}
+
+int main(int argc, char **argv) {
   HelloTriangleApplication app;
   try {
-    app.run();
+    AppOptions options = parse_options(argc, argv);
+    if (!options.pack_assets.empty()) {
+      pack_assets(options.pack_assets);
+      return EXIT_SUCCESS;
+    }
+    app.run(options);
   } catch (const std::exception &e) {
     std::cerr << e.what() << std::endl;
     return EXIT_FAILURE;